@@ -6,36 +6,183 @@
 #include <exception>
 #include <cstdlib>
 #include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include "bst.h"
 
 struct KeyError { };
 
 /**
-* A special kind of node for an AVL tree, which adds the height as a data member, plus
-* other additional helper functions. You do NOT need to implement any functionality or
-* add additional data members or helper functions.
+* An augmentation lets every node of an AVLTree cache a summary of its subtree. The node
+* inherits from the augmentation class, which holds the cached data and provides a static
+* pull(node) that recomputes it from the node and its two children. The tree calls pull()
+* bottom up on every node whose subtree changes. NoAugment is empty and costs nothing.
 */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+struct NoAugment
+{
+    template<typename NodeType>
+    static void pull(NodeType* node);
+};
+
+/**
+* Caches the number of nodes in every subtree, which gives AVLTree rank(), select() and
+* advance() in O(log n).
+*/
+struct SubtreeSize
+{
+    template<typename NodeType>
+    static void pull(NodeType* node);
+
+    template<typename NodeType>
+    static std::size_t sizeOf(const NodeType* node);
+
+protected:
+    std::size_t subtreeSize_;
+};
+
+template<typename NodeType>
+inline void NoAugment::pull(NodeType*)
+{
+
+}
+
+template<typename NodeType>
+inline void SubtreeSize::pull(NodeType* node)
+{
+    static_cast<SubtreeSize*>(node)->subtreeSize_ = 1 + sizeOf(node->getLeft()) + sizeOf(node->getRight());
+}
+
+/**
+* The size of the subtree rooted at node, 0 for NULL.
+*/
+template<typename NodeType>
+inline std::size_t SubtreeSize::sizeOf(const NodeType* node)
+{
+    return (node == nullptr) ? 0 : static_cast<const SubtreeSize*>(node)->subtreeSize_;
+}
+
+/**
+* Caches, for every subtree, the combination of all its items under a user supplied monoid,
+* which gives AVLTree aggregate(first, last) in O(log n). A Monoid provides
+*
+*   typedef ... value_type;
+*   static value_type identity();
+*   static value_type combine(const value_type& a, const value_type& b);   // associative
+*   static value_type lift(const Key& key, const Value& value);
+*
+* combine() need not be commutative; items are always combined in key order. Changing a
+* value through an iterator bypasses the cache, use insert() to overwrite values instead.
+*/
+template<typename Monoid>
+struct MonoidAugment
+{
+    typedef Monoid monoid_type;
+    typedef typename Monoid::value_type value_type;
+
+    template<typename NodeType>
+    static void pull(NodeType* node);
+
+    template<typename NodeType>
+    static value_type aggregateOf(const NodeType* node);
+
+protected:
+    value_type aggregate_;
+};
+
+template<typename Monoid>
+template<typename NodeType>
+inline void MonoidAugment<Monoid>::pull(NodeType* node)
+{
+    static_cast<MonoidAugment<Monoid>*>(node)->aggregate_ =
+        Monoid::combine(Monoid::combine(aggregateOf(node->getLeft()), Monoid::lift(node->getKey(), node->getValue())),
+                        aggregateOf(node->getRight()));
+}
+
+/**
+* The aggregate of the subtree rooted at node, the identity for NULL.
+*/
+template<typename Monoid>
+template<typename NodeType>
+inline typename MonoidAugment<Monoid>::value_type MonoidAugment<Monoid>::aggregateOf(const NodeType* node)
+{
+    return (node == nullptr) ? Monoid::identity() : static_cast<const MonoidAugment<Monoid>*>(node)->aggregate_;
+}
+
+/**
+* Ready made monoids for MonoidAugment: the sum, minimum or maximum of the values, and the
+* number of items.
+*/
+template<typename T>
+struct SumMonoid
+{
+    typedef T value_type;
+    static T identity() { return T(); }
+    static T combine(const T& a, const T& b) { return a + b; }
+    template<typename Key, typename Value>
+    static T lift(const Key&, const Value& value) { return value; }
+};
+
+template<typename T>
+struct MinMonoid
+{
+    typedef T value_type;
+    static T identity() { return std::numeric_limits<T>::max(); }
+    static T combine(const T& a, const T& b) { return (b < a) ? b : a; }
+    template<typename Key, typename Value>
+    static T lift(const Key&, const Value& value) { return value; }
+};
+
+template<typename T>
+struct MaxMonoid
+{
+    typedef T value_type;
+    static T identity() { return std::numeric_limits<T>::lowest(); }
+    static T combine(const T& a, const T& b) { return (a < b) ? b : a; }
+    template<typename Key, typename Value>
+    static T lift(const Key&, const Value& value) { return value; }
+};
+
+struct CountMonoid
+{
+    typedef std::size_t value_type;
+    static std::size_t identity() { return 0; }
+    static std::size_t combine(std::size_t a, std::size_t b) { return a + b; }
+    template<typename Key, typename Value>
+    static std::size_t lift(const Key&, const Value&) { return 1; }
+};
+
+/**
+* A special kind of node for an AVL tree, which adds the balance factor, plus
+* other additional helper functions. The balance factor is height(right) - height(left)
+* and is always -1, 0 or +1 in a valid tree, so it is kept in the two tag bits of the
+* parent link. Without an augmentation an AVLNode is therefore exactly as large as a
+* plain Node.
+*/
+template <typename Key, typename Value, typename Augment = NoAugment>
+class AVLNode : public Node<Key, Value>, public Augment
 {
 public:
-    // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    // Constructor.
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment>* parent);
+    template<typename... ItemArgs>
+    AVLNode(AVLNode<Key, Value, Augment>* parent, ItemArgs&&... itemArgs);
 
-    // Getter/setter for the node's height.
-    int getHeight () const;
-    void setHeight (int height);
+    // Getter/setter for the node's balance factor (-1, 0 or +1).
+    int getBalance () const;
+    void setBalance (int balance);
 
-    // Getters for parent, left, and right. These need to be redefined since they
+    // Getters for parent, left, and right. These hide the Node versions since they
     // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
     // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
-
-protected:
-    int height_;
+    AVLNode<Key, Value, Augment>* getParent() const;
+    AVLNode<Key, Value, Augment>* getLeft() const;
+    AVLNode<Key, Value, Augment>* getRight() const;
 };
 
 /*
@@ -46,67 +193,71 @@ protected:
 
 /**
 * An explicit constructor to initialize the elements by calling the base class constructor.
+* A new node is a leaf, so it starts out balanced and its augmentation covers just itself.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), height_(1)
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment> *parent) :
+    Node<Key, Value>(key, value, parent)
 {
-
+    Augment::pull(this);
 }
 
 /**
-* A destructor which does nothing.
+* Same as above, with the item built in place from itemArgs.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, class Augment>
+template<typename... ItemArgs>
+AVLNode<Key, Value, Augment>::AVLNode(AVLNode<Key, Value, Augment>* parent, ItemArgs&&... itemArgs) :
+    Node<Key, Value>(parent, std::forward<ItemArgs>(itemArgs)...)
 {
-
+    Augment::pull(this);
 }
 
 /**
-* A getter for the height of a AVLNode.
+* A getter for the balance factor of a AVLNode. Tag 1 encodes +1 and tag 2 encodes -1.
 */
-template<class Key, class Value>
-int AVLNode<Key, Value>::getHeight() const
+template<class Key, class Value, class Augment>
+inline int AVLNode<Key, Value, Augment>::getBalance() const
 {
-    return height_;
+    unsigned tag = this->getTag();
+    return static_cast<int>(tag & 1) - static_cast<int>(tag >> 1);
 }
 
 /**
-* A setter for the height of a AVLNode.
+* A setter for the balance factor of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setHeight(int height)
+template<class Key, class Value, class Augment>
+inline void AVLNode<Key, Value, Augment>::setBalance(int balance)
 {
-    height_ = height;
+    this->setTag((balance > 0 ? 1u : 0u) | (balance < 0 ? 2u : 0u));
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A getter for the parent that hides Node::getParent, since a static_cast is necessary to make
+* sure that our node is a AVLNode. Every node in an AVLTree is an AVLNode, so the cast is free.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+template<class Key, class Value, class Augment>
+inline AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getParent() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(Node<Key, Value>::getParent());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<class Key, class Value, class Augment>
+inline AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getLeft() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(this->left_);
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+template<class Key, class Value, class Augment>
+inline AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getRight() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(this->right_);
 }
 
 
@@ -117,246 +268,446 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value, class Augment = NoAugment, class Compare = std::less<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Compare>
 {
 public:
+    AVLTree();
+    explicit AVLTree(const Compare& comp);
+    virtual ~AVLTree();
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
+    virtual void insert(std::pair<const Key, Value>&& new_item);
+    // The hinted inserts, emplace, try_emplace, insert_or_assign and operator[] are
+    // BinarySearchTree's; they reach insertItem() below, which rebalances. Writing through
+    // the reference operator[] returns bypasses the augmentation cache, see MonoidAugment.
+    using BinarySearchTree<Key, Value, Compare>::insert;
     virtual void remove(const Key& key);  // TODO
+    using BinarySearchTree<Key, Value, Compare>::remove;
+    virtual void clear();
+
+    // Bulk loading. Both replace the current contents; on equal keys the last one wins,
+    // just like a sequence of inserts.
+    template<typename RandomIt>
+    void build_from_sorted(RandomIt first, RandomIt last);
+    template<typename InputIt>
+    void build_from_unsorted(InputIt first, InputIt last);
+    // Replaces the contents with a tree image written by save(), in O(n) without rotations.
+    void load(const std::string& path);
+
+    // O(log n) structural operations. Nodes move between the trees instead of being copied,
+    // so the trees involved end up sharing one node arena, which is not thread-safe.
+    void split(const Key& key, AVLTree<Key, Value, Augment, Compare>& left, AVLTree<Key, Value, Augment, Compare>& right);
+    void join(AVLTree<Key, Value, Augment, Compare>& left, const std::pair<const Key, Value>& pivot, AVLTree<Key, Value, Augment, Compare>& right);
+    void join(AVLTree<Key, Value, Augment, Compare>& left, AVLTree<Key, Value, Augment, Compare>& right);
+
+    // Set algebra by divide and conquer over split/join; the two halves of each step run on
+    // separate threads near the top of the recursion. other is consumed and left empty, and
+    // must order its keys the same way as this tree.
+    // On equal keys union_with keeps other's value and intersect_with keeps this tree's.
+    void union_with(AVLTree<Key, Value, Augment, Compare>& other);
+    void intersect_with(AVLTree<Key, Value, Augment, Compare>& other);
+    void difference_with(AVLTree<Key, Value, Augment, Compare>& other);
+
+    // Order statistics, O(log n). These need the SubtreeSize augmentation:
+    // AVLTree<Key, Value, SubtreeSize>.
+    std::size_t rank(const Key& key) const;
+    typename BinarySearchTree<Key, Value, Compare>::iterator select(std::size_t index);
+    typename BinarySearchTree<Key, Value, Compare>::const_iterator select(std::size_t index) const;
+    typename BinarySearchTree<Key, Value, Compare>::iterator advance(typename BinarySearchTree<Key, Value, Compare>::iterator it, std::ptrdiff_t steps);
+    typename BinarySearchTree<Key, Value, Compare>::const_iterator advance(typename BinarySearchTree<Key, Value, Compare>::const_iterator it,
+                                                                  std::ptrdiff_t steps) const;
+
+    // Combines the items with first <= key < last in key order, O(log n). Needs a
+    // MonoidAugment: AVLTree<Key, Value, MonoidAugment<SumMonoid<Value> > >.
+    template<typename A = Augment>
+    typename A::value_type aggregate(const Key& first, const Key& last) const;
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    static const bool AUGMENTED = !std::is_same<Augment, NoAugment>::value;
+    static const bool SIZED = std::is_base_of<SubtreeSize, Augment>::value;
 
-    // Add helper functions here
-    bool parentHeightChange(AVLNode<Key, Value>* node);
+    static void pullPath(AVLNode<Key, Value, Augment>* n);
 
-    void insertFix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* node);
+    static std::size_t knownSize(AVLNode<Key, Value, Augment>* n);
+    static std::size_t knownSize(AVLNode<Key, Value, Augment>* n, std::true_type);
+    static std::size_t knownSize(AVLNode<Key, Value, Augment>* n, std::false_type);
 
-    bool checkIfBalanced(AVLNode<Key, Value>* node);
+    AVLNode<Key, Value, Augment>* selectNode(std::size_t index) const;
+    AVLNode<Key, Value, Augment>* advanceNode(Node<Key, Value>* from, std::ptrdiff_t steps) const;
 
-    int identifyImbalanceType(AVLNode<Key, Value>* z, AVLNode<Key, Value>* y, AVLNode<Key, Value>* x);
+    virtual void nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2);
+    virtual void eraseNode(Node<Key, Value>* node);
+    virtual Node<Key, Value>* insertItem(Node<Key, Value>* hint, ItemSource<Key, Value>& source, bool& created);
 
-    AVLNode<Key,Value>* getGreaterChild(AVLNode<Key, Value>* node);
+    template<typename RandomIt>
+    AVLNode<Key, Value, Augment>* buildBalanced(RandomIt first, RandomIt last, int& height);
 
-    void updateHeight(AVLNode<Key, Value>* node);
+    template<typename RandomIt, typename Less>
+    static void parallelStableSort(RandomIt first, RandomIt last, Less less, unsigned depth);
 
-    void rightRotate(AVLNode<Key, Value>* node);
+    // Set operations on subtrees below this height are not worth a thread of their own.
+    static const int PARALLEL_MIN_HEIGHT = 12;
 
-    void leftRotate(AVLNode<Key, Value>* node);
+    // Add helper functions here
+    AVLNode<Key, Value, Augment>* finishInsert(AVLNode<Key, Value, Augment>* node, bool created);
 
-    int caclHeight(AVLNode<Key, Value>* node);
+    void insertFix(AVLNode<Key, Value, Augment>* parent, AVLNode<Key, Value, Augment>* node);
 
-    void removeFix(AVLNode<Key, Value>* n);
+    void removeFix(AVLNode<Key, Value, Augment>* n, int diff);
 
-    AVLNode<Key,Value>* getG(AVLNode<Key, Value>* c, AVLNode<Key, Value>* n);
+    AVLNode<Key, Value, Augment>* detachNode(AVLNode<Key, Value, Augment>* n);
 
-    bool willHeightChange( AVLNode<Key,Value>* n);
+    static AVLNode<Key, Value, Augment>* retraceGrowth(AVLNode<Key, Value, Augment>* parent, AVLNode<Key, Value, Augment>* node, bool& grewToTop);
 
-    void rightRotateForRemove(AVLNode<Key, Value>* z);
+    // Helpers for split/join. They work on detached subtrees (root has no parent) and pass
+    // heights along, since nodes only store balance factors.
+    static int subtreeHeight(AVLNode<Key, Value, Augment>* n);
 
-    void leftRotateForRemove(AVLNode<Key, Value>* z);
+    static AVLNode<Key, Value, Augment>* joinNodes(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* pivot,
+                                          AVLNode<Key, Value, Augment>* right, int rightHeight, int& height);
 
-};
+    void splitNodes(AVLNode<Key, Value, Augment>* t, int height, const Key& key,
+                    AVLNode<Key, Value, Augment>*& left, int& leftHeight, AVLNode<Key, Value, Augment>*& match,
+                    AVLNode<Key, Value, Augment>*& right, int& rightHeight) const;
 
+    static AVLNode<Key, Value, Augment>* splitLast(AVLNode<Key, Value, Augment>* t, int height, AVLNode<Key, Value, Augment>*& last, int& restHeight);
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
-{
-    // TODO 
-    // ** BST's Insert**
+    static AVLNode<Key, Value, Augment>* concatNodes(AVLNode<Key, Value, Augment>* left, int leftHeight,
+                                            AVLNode<Key, Value, Augment>* right, int rightHeight, int& height);
 
-    // CASE 1: Empty Tree
-    if(this->root_ == nullptr){
+    static void joinThreads(AVLNode<Key, Value, Augment>* left, AVLNode<Key, Value, Augment>* pivot, AVLNode<Key, Value, Augment>* right);
 
-        this->root_ = new AVLNode<Key, Value>(new_item.first, new_item.second ,nullptr); 
+    // Workers of the set operations. Nodes that drop out are collected in discarded and
+    // destroyed by the caller afterwards, since the arena is not thread safe. The in-order
+    // links inside a returned subtree are right; only its two ends may still point outside it.
+    AVLNode<Key, Value, Augment>* unionNodes(AVLNode<Key, Value, Augment>* a, int aHeight, AVLNode<Key, Value, Augment>* b, int bHeight,
+                                    int& height, std::vector<AVLNode<Key, Value, Augment>*>& discarded, unsigned depth) const;
 
-        return;
-    }
+    AVLNode<Key, Value, Augment>* intersectNodes(AVLNode<Key, Value, Augment>* a, int aHeight, AVLNode<Key, Value, Augment>* b, int bHeight,
+                                        int& height, std::vector<AVLNode<Key, Value, Augment>*>& discarded, unsigned depth) const;
 
-    // CASE 2: Non-Empty Tree
-    int direction = 0;  // 2 = left child, 1 = right child
-    AVLNode<Key, Value>* temp = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value, Augment>* differenceNodes(AVLNode<Key, Value, Augment>* a, int aHeight, AVLNode<Key, Value, Augment>* b, int bHeight,
+                                         int& height, std::vector<AVLNode<Key, Value, Augment>*>& discarded, unsigned depth) const;
 
-    AVLNode<Key, Value>* prev;
+    static void collectNodes(AVLNode<Key, Value, Augment>* n, std::vector<AVLNode<Key, Value, Augment>*>& out);
 
-    while(temp != nullptr){
-        prev = temp;
+    void absorbForSetOperation(AVLTree<Key, Value, Augment, Compare>& other, AVLNode<Key, Value, Augment>*& a, int& aHeight,
+                               AVLNode<Key, Value, Augment>*& b, int& bHeight, std::size_t& count);
 
-        if(new_item.first > temp->getKey()){
+    void finishSetOperation(const std::vector<AVLNode<Key, Value, Augment>*>& discarded, std::size_t count);
 
-            direction = 1;
+    void joinTrees(AVLTree<Key, Value, Augment, Compare>& left, AVLNode<Key, Value, Augment>* pivot, AVLTree<Key, Value, Augment, Compare>& right);
 
-            temp = temp->getRight();
-        }
-        else if(new_item.first < temp->getKey()){
+    static AVLNode<Key, Value, Augment>* leftmost(AVLNode<Key, Value, Augment>* n);
 
-            direction = 2;
+    static AVLNode<Key, Value, Augment>* rightmost(AVLNode<Key, Value, Augment>* n);
 
-            temp = temp->getLeft();
-        }
-        else if(new_item.first == temp->getKey()){   // then overwrite value
+    // Rotations only relink nodes and pull the augmentation of the two nodes that moved; they
+    // fix the link from the old parent but never touch root_ or balance factors, so they also
+    // work on detached subtrees.
+    static AVLNode<Key, Value, Augment>* rightRotate(AVLNode<Key, Value, Augment>* z);
 
-            temp->setValue(new_item.second);
+    static AVLNode<Key, Value, Augment>* leftRotate(AVLNode<Key, Value, Augment>* z);
 
-            return;
-        }
-    }
-    // create the new node with parent set to prev
-    temp = new AVLNode<Key, Value>(new_item.first, new_item.second, prev);
+    static AVLNode<Key, Value, Augment>* rebalance(AVLNode<Key, Value, Augment>* z, int balance, bool& heightDropped);
+
+};
 
-    // set parent's child to new node
-    if(direction == 2){
 
-        prev->setLeft(temp);
+template<class Key, class Value, class Augment, class Compare>
+AVLTree<Key, Value, Augment, Compare>::AVLTree() :
+    BinarySearchTree<Key, Value, Compare>()
+{
 
-    } 
-    else if(direction == 1){
+}
 
-        prev->setRight(temp);
+template<class Key, class Value, class Augment, class Compare>
+AVLTree<Key, Value, Augment, Compare>::AVLTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(comp)
+{
 
-    }
-    
+}
 
-    if(prev->getHeight() == 2){
+template<class Key, class Value, class Augment, class Compare>
+AVLTree<Key, Value, Augment, Compare>::~AVLTree()
+{
+    clear();
+}
+
+/**
+* Removes all contents of the tree, destroying every node as an AVLNode.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::clear()
+{
+    this->template clearAs<AVLNode<Key, Value, Augment> >();
+}
+
+/**
+* Replaces the contents with the elements of [first, last), which must be sorted by key.
+* The tree is linked together in a single pass with every balance factor known up front,
+* so there are no searches and no rotations: O(n) instead of O(n log n).
+* Nodes are allocated in key order, which keeps in-order scans walking forward in memory.
+* With move iterators the items are moved into the nodes instead of copied.
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename RandomIt>
+void AVLTree<Key, Value, Augment, Compare>::build_from_sorted(RandomIt first, RandomIt last)
+{
+    this->clear();
+
+    // collapse runs of equal keys, keeping the last one, only if there are any
+    const Compare& comp = this->compare_;
+    RandomIt dup = std::adjacent_find(first, last,
+        [&comp](const typename std::iterator_traits<RandomIt>::value_type& a,
+                const typename std::iterator_traits<RandomIt>::value_type& b) { return !comp(a.first, b.first); });
+
+    int height;
+    if(dup == last){
+        this->root_ = buildBalanced(first, last, height);
+        this->size_ = static_cast<std::size_t>(last - first);
+        this->rethread();
         return;
     }
-    else if(prev->getHeight() == 1){
-        prev->setHeight(2);
-        insertFix(prev, temp);
-    }
 
+    std::vector<std::pair<Key, Value> > unique;
+    unique.reserve(static_cast<std::size_t>(last - first));
+    for(RandomIt it = first; it != last; ++it){
+        if(!unique.empty() && !comp(unique.back().first, it->first)){
+            unique.back().second = (*it).second;
+        }
+        else{
+            unique.emplace_back(*it);
+        }
+    }
+    this->root_ = buildBalanced(std::make_move_iterator(unique.begin()), std::make_move_iterator(unique.end()), height);
+    this->size_ = unique.size();
+    this->rethread();
 }
 
+/**
+* Same as build_from_sorted() for input in any order. The elements are copied and stably
+* sorted first, on several threads when the input is large enough to make it worthwhile.
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename InputIt>
+void AVLTree<Key, Value, Augment, Compare>::build_from_unsorted(InputIt first, InputIt last)
+{
+    std::vector<std::pair<Key, Value> > items;
+    for(; first != last; ++first){
+        items.emplace_back(*first);
+    }
 
+    Compare comp = this->compare_;
+    parallelStableSort(items.begin(), items.end(),
+        [comp](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) { return comp(a.first, b.first); },
+        BinarySearchTree<Key, Value, Compare>::parallelDepth());
 
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
+    build_from_sorted(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+}
 
+/**
+* Maps the tree image at path (see FrozenTree::map(), which also lists the exceptions), reads
+* its elements out in key order and links them into a perfectly balanced tree as
+* build_from_sorted() does. Every step is linear and nothing is compared against the existing
+* contents, so this is much faster than inserting the elements one by one.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::load(const std::string& path)
+{
+    FrozenTree<Key, Value, Compare> image(this->compare_);
+    image.map(path);
 
+    std::vector<std::pair<Key, Value> > items;
+    items.reserve(image.size());
+    for(typename FrozenTree<Key, Value, Compare>::const_iterator it = image.begin(); it != image.end(); ++it){
+        items.emplace_back(it.key(), it.value());
+    }
+    build_from_sorted(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+}
 
-template<class Key, class Value>
-void AVLTree<Key,Value>::insertFix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* node)
+/**
+* Links the sorted, duplicate free range [first, last) into a perfect AVL subtree and returns
+* its root (or NULL for an empty range). The middle element becomes the root, so the left half
+* is never smaller than the right one and every balance factor is 0 or -1.
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename RandomIt>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::buildBalanced(RandomIt first, RandomIt last, int& height)
 {
-
-    if(parent == nullptr){
-        
-        return;
+    if(first == last){
+        height = 0;
+        return nullptr;
     }
 
-    AVLNode<Key, Value>* grandParent = parent->getParent();
+    RandomIt mid = first + (last - first) / 2;
 
-    if(grandParent== nullptr){
+    int leftHeight;
+    int rightHeight;
+    AVLNode<Key, Value, Augment>* left = buildBalanced(first, mid, leftHeight);
+    AVLNode<Key, Value, Augment>* node = this->template createNode<AVLNode<Key, Value, Augment> >(static_cast<AVLNode<Key, Value, Augment>*>(nullptr), *mid);
+    AVLNode<Key, Value, Augment>* right = buildBalanced(mid + 1, last, rightHeight);
+
+    node->setLeft(left);
+    node->setRight(right);
+    if(left != nullptr){
+        left->setParent(node);
+    }
+    if(right != nullptr){
+        right->setParent(node);
+    }
+    node->setBalance(rightHeight - leftHeight);
+    Augment::pull(node);
 
-        return;
-    }    
-    
-    // if grandParent Height did  not change we are done 
-    if(!parentHeightChange(parent)){
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+}
 
+/**
+* A fork/join merge sort: each level hands its left half to a new thread until depth runs
+* out or the range gets small, then the halves are merged in place.
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename RandomIt, typename Less>
+void AVLTree<Key, Value, Augment, Compare>::parallelStableSort(RandomIt first, RandomIt last, Less less, unsigned depth)
+{
+    const std::ptrdiff_t MIN_PARALLEL = 1 << 15;
+    if(depth == 0 || last - first < MIN_PARALLEL){
+        std::stable_sort(first, last, less);
         return;
-
     }
-    
-    updateHeight(grandParent);
-
-    // CHECK if grandParent is balanced
-    
-    if(checkIfBalanced(grandParent)){
 
-        insertFix(grandParent, parent);
-
-    } else{    // else grandParent is not balanced and grandParent = z
+    RandomIt mid = first + (last - first) / 2;
+    BinarySearchTree<Key, Value, Compare>::forkJoin(true,
+        [=]() { parallelStableSort(first, mid, less, depth - 1); },
+        [=]() { parallelStableSort(mid, last, less, depth - 1); });
+    std::inplace_merge(first, mid, last, less);
+}
 
-        AVLNode<Key, Value>* z = grandParent;
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::insert(const std::pair<const Key, Value> &new_item)
+{
+    // TODO 
+    // ** BST's Insert**
+    bool created;
+    AVLNode<Key, Value, Augment>* temp = this->template insertNode<AVLNode<Key, Value, Augment> >(nullptr, new_item.first, new_item.second, created);
+    finishInsert(temp, created);
+}
 
-        AVLNode<Key, Value>* y = getGreaterChild(z);
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::insert(std::pair<const Key, Value>&& new_item)
+{
+    bool created;
+    AVLNode<Key, Value, Augment>* temp = this->template insertNode<AVLNode<Key, Value, Augment> >(nullptr, new_item.first, std::move(new_item.second), created);
+    finishInsert(temp, created);
+}
 
-        AVLNode<Key, Value>* x = getGreaterChild(y);
+/**
+* Every templated insertion of BinarySearchTree ends up here. Near a good hint the
+* rebalancing stays local too: insertFix() stops at the first subtree that keeps its height,
+* which for appends is O(1) amortized.
+*/
+template<class Key, class Value, class Augment, class Compare>
+Node<Key, Value>* AVLTree<Key, Value, Augment, Compare>::insertItem(Node<Key, Value>* hint, ItemSource<Key, Value>& source, bool& created)
+{
+    AVLNode<Key, Value, Augment>* temp = this->insertItemAs(static_cast<AVLNode<Key, Value, Augment>*>(hint), source, created);
+    return finishInsert(temp, created);
+}
 
-        int imbalanceType = identifyImbalanceType(z, y, x); // z y x 
+/**
+* Restores balance and augmentation after the engine has put node into the tree. If no
+* node was created only the value may have changed, so just the cached aggregates on the
+* path are refreshed. Returns node.
+*/
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::finishInsert(AVLNode<Key, Value, Augment>* node, bool created)
+{
+    // an existing key only had its value overwritten, the shape did not change
+    if(!created){
+        pullPath(node);
+        return node;
+    }
 
-        if(imbalanceType == 1){     // Fix left zig-zig 
+    insertFix(node->getParent(), node);
+    pullPath(node->getParent());
+    return node;
+}
 
-            // Call right rotate
-            rightRotate(z);
 
-        }
-        else if(imbalanceType == 2){    // Fix left zig - zag
 
-            // Call left rotate then right rotate
-            leftRotate(y);
-            rightRotate(z);
+// **************************************************************************************************
+// **************************************************************************************************
+// **************************************************************************************************
+// **************************************************************************************************
+// **************************************************************************************************
+// **************************************************************************************************
 
-        }
-        else if(imbalanceType == 3){    // Fix right zig-zig
-            
-            // Call left rotate
-            leftRotate(z);
 
-        }
-        else if(imbalanceType == 4){    // Fix right zig-zag
 
-            // Call right rotate then left rotate
-            rightRotate(y);
-            leftRotate(z);
+// Walks up from a freshly linked leaf and restores the balance of the tree.
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::insertFix(AVLNode<Key, Value, Augment>* parent, AVLNode<Key, Value, Augment>* node)
+{
 
-        }
+    if(parent == nullptr){
+        return;
+    }
 
+    bool grewToTop;
+    AVLNode<Key, Value, Augment>* top = retraceGrowth(parent, node, grewToTop);
+    if(top->getParent() == nullptr){
+        this->root_ = top;
     }
 }
 
-
-template<class Key, class Value>
-int AVLTree<Key,Value>::identifyImbalanceType(AVLNode<Key, Value>* z, AVLNode<Key, Value>* y, AVLNode<Key, Value>* x)
+// node's subtree just grew by one level, so its parent leans one step further towards it:
+// at 0 the parent's height did not change and we are done, at +/-1 the parent grew too and we
+// continue, at +/-2 a rotation fixes it. After an insert the rotation always restores the old
+// height; after a join the taller child can be balanced, and then the growth carries on.
+// Returns the root of the last subtree touched, and whether the growth went past the top.
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::retraceGrowth(AVLNode<Key, Value, Augment>* parent, AVLNode<Key, Value, Augment>* node, bool& grewToTop)
 {
 
-    // Check left Zig - Zig:
-    if(z->getLeft() == y && y->getLeft() == x){
-
-        return 1;
-
-    }
+    grewToTop = false;
 
-    // Check left Zig - Zag
-    else if(z->getLeft() == y && y ->getRight() == x){
+    while(parent != nullptr){
 
-        return 2;
+        int balance = parent->getBalance() + ((parent->getLeft() == node) ? -1 : 1);
 
-    }
+        if(balance == 0){
 
-    // Check right Zig - Zig
-    else if(z->getRight() == y && y ->getRight() == x){
+            parent->setBalance(0);
+            return parent;
 
-        return 3;
+        }
+        else if(balance == 1 || balance == -1){
 
-    }
+            parent->setBalance(balance);
 
-    // Check right Zig - Zag
-    else if(z->getRight() == y && y->getLeft() == x){
+        }
+        else{   // parent is out of balance
 
-        return 4;
+            bool heightDropped;
+            parent = rebalance(parent, balance, heightDropped);
+            if(heightDropped){
+                return parent;
+            }
 
+        }
+        node = parent;
+        parent = parent->getParent();
     }
-    return 0;
+
+    grewToTop = true;
+    return node;
 }
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>:: remove(const Key& key)
 {
 
-    AVLNode<Key, Value>* nodeToRemove = static_cast<AVLNode<Key,Value>*>(this->internalFind(key));
-
-    AVLNode<Key, Value>* p;
+    AVLNode<Key, Value, Augment>* nodeToRemove = this->findNode(static_cast<AVLNode<Key, Value, Augment>*>(this->root_), key);
 
     // CASE 1: key not in the tree
     if(nodeToRemove == nullptr) {
@@ -364,790 +715,1162 @@ void AVLTree<Key, Value>:: remove(const Key& key)
         return; // Key not found, nothing to remove
     }
 
-    if((nodeToRemove->getLeft() != nullptr) && (nodeToRemove->getRight() != nullptr)){
-
-        AVLNode<Key, Value>* succ = static_cast<AVLNode<Key,Value>*>(this->successor(nodeToRemove));
-        nodeSwap(succ, nodeToRemove);
-    }
-
-    p = nodeToRemove->getParent();
-
-    // CASE 2: nodeToRemove has no children
-    if(nodeToRemove->getLeft()== nullptr && nodeToRemove->getRight()==nullptr){
-        
-        if(nodeToRemove->getParent() != nullptr) {  // if no children + existing parent -> make the the parent's child null
-            if (nodeToRemove->getParent()->getLeft() == nodeToRemove){
-                nodeToRemove->getParent()->setLeft(nullptr);
-            }
-            else if(nodeToRemove->getParent()->getRight() == nodeToRemove){
-                nodeToRemove->getParent()->setRight(nullptr);
-            }
-            delete nodeToRemove;
-        }
-        else{   // if no children + null parent = root node
-            this->root_ = nullptr;
-            p = nullptr;
-            delete nodeToRemove;
-        }
-    }
-
-    // CASE 3: nodeToRemove has one child 
-    else if((nodeToRemove->getLeft() != nullptr && nodeToRemove->getRight() == nullptr) || (nodeToRemove->getLeft() == nullptr && nodeToRemove->getRight() != nullptr)){
+    detachNode(nodeToRemove);
 
-        AVLNode<Key, Value>* child = (nodeToRemove->getLeft() != nullptr) ? nodeToRemove->getLeft() : nodeToRemove->getRight();
+    this->destroyNode(nodeToRemove);
 
-        if(nodeToRemove == this->root_){   // if that node with one child is the root 
-            this->root_ = child;
-            child->setParent(nullptr);
-            p = nullptr;
-            delete nodeToRemove;
-        } else{   // if not a root node then it has a parent 
-            AVLNode<Key, Value>* parent = nodeToRemove->getParent();
+    this->addToSize(-1);
+}
 
-            if(nodeToRemove->getParent()->getLeft() == nodeToRemove){   // if nodeToRemove is its parent's left child then 
-                parent->setLeft(child);
-            }else{
-                parent->setRight(child);
-            }
-            child->setParent(parent);
+// Removes a node found by one of the base class lookups, with the usual rebalancing.
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::eraseNode(Node<Key, Value>* node)
+{
+    AVLNode<Key, Value, Augment>* nodeToRemove = static_cast<AVLNode<Key, Value, Augment>*>(node);
 
-            p = parent;
+    detachNode(nodeToRemove);
 
-            delete nodeToRemove;
-        }
-    }
+    this->destroyNode(nodeToRemove);
 
-    removeFix(p);
+    this->addToSize(-1);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n)
+// Takes nodeToRemove out of the tree and rebalances, without destroying it.
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::detachNode(AVLNode<Key, Value, Augment>* nodeToRemove)
 {
 
-    // If n is null, return
-    if(n == nullptr){
-
-        return;
+    if((nodeToRemove->getLeft() != nullptr) && (nodeToRemove->getRight() != nullptr)){
 
+        AVLNode<Key, Value, Augment>* succ = static_cast<AVLNode<Key, Value, Augment>*>(this->successor(nodeToRemove));
+        nodeSwap(succ, nodeToRemove);
     }
-    
-    AVLNode<Key, Value>* p = n->getParent();
-
-    
-    // CASE 1: n is out of balance
-    if(!checkIfBalanced(n)){  
+    this->unthreadNode(nodeToRemove);
 
-        AVLNode<Key, Value>* c = getGreaterChild(n);
+    // the side of the parent that loses a level: removing a left child tips it to the right
+    AVLNode<Key, Value, Augment>* p = nodeToRemove->getParent();
+    int diff = (p != nullptr && p->getLeft() == nodeToRemove) ? 1 : -1;
 
-        AVLNode<Key, Value>* g = getG(c, n);
+    // CASE 2/3: nodeToRemove now has at most one child
+    this->spliceNode(nodeToRemove);
 
-        int typeImbalance = identifyImbalanceType(n, c, g);
+    removeFix(p, diff);
+    pullPath(p);
 
-        if(typeImbalance == 1){     // Fix left zig-zig 
-
-            // Call right rotate
-            rightRotateForRemove(n);
+    return nodeToRemove;
+}
 
-            updateHeight(n);
-            updateHeight(c);
+// Walks up after one of n's subtrees lost a level; diff is +1 if it was the left one and
+// -1 if it was the right one. Stops as soon as some subtree keeps its height.
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::removeFix(AVLNode<Key, Value, Augment>* n, int diff)
+{
 
-            removeFix(p);
-        }
-        else if(typeImbalance == 2){    // Fix left zig - zag
+    while(n != nullptr){
 
-            // Call left rotate then right rotate
+        AVLNode<Key, Value, Augment>* p = n->getParent();
+        int nextDiff = (p != nullptr && p->getLeft() == n) ? 1 : -1;
 
-            leftRotateForRemove(c);
-            rightRotateForRemove(n);
+        int balance = n->getBalance() + diff;
 
-            updateHeight(n);
-            updateHeight(c);
-            updateHeight(g);
+        if(balance == 1 || balance == -1){  // n was balanced, its height does not change
 
-            removeFix(p);
+            n->setBalance(balance);
+            return;
 
         }
-        else if(typeImbalance == 3){    // Fix right zig-zig
-            
-            // Call left rotate
-            leftRotateForRemove(n);
-
-            updateHeight(n);
-            updateHeight(c);
+        else if(balance == 0){  // n's height shrank, keep going
 
-            removeFix(p);
+            n->setBalance(0);
 
         }
-        else if(typeImbalance == 4){    // Fix right zig-zag
+        else{   // n is out of balance
 
-            // Call right rotate then left rotate
-            rightRotateForRemove(c);
-            leftRotateForRemove(n);
-
-            updateHeight(n);
-            updateHeight(c);
-            updateHeight(g);
+            bool heightDropped;
+            AVLNode<Key, Value, Augment>* top = rebalance(n, balance, heightDropped);
+            if(top->getParent() == nullptr){
+                this->root_ = top;
+            }
+            if(!heightDropped){
+                return;
+            }
 
-            removeFix(p);
-        }   
+        }
 
+        n = p;
+        diff = nextDiff;
     }
-    else if(!willHeightChange(n)){  // n's height does not to change then done
+}
 
-        return;
 
-    } else{
 
-        updateHeight(n);
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2)
+{
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
+    int tempB = n1->getBalance();
+    n1->setBalance(n2->getBalance());
+    n2->setBalance(tempB);
+
+    // the cached subtree data belongs to the position, not to the item
+    std::swap(static_cast<Augment&>(*n1), static_cast<Augment&>(*n2));
+}
 
-        removeFix(p);
+/**
+* Recomputes the augmentation of n and every ancestor of n, bottom up. Does nothing without
+* an augmentation.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::pullPath(AVLNode<Key, Value, Augment>* n)
+{
+    if(!AUGMENTED){
+        return;
+    }
+    for(; n != nullptr; n = n->getParent()){
+        Augment::pull(n);
     }
 }
 
+/**
+* The number of nodes below n if the augmentation keeps subtree sizes, UNKNOWN_SIZE otherwise.
+*/
+template<class Key, class Value, class Augment, class Compare>
+std::size_t AVLTree<Key, Value, Augment, Compare>::knownSize(AVLNode<Key, Value, Augment>* n)
+{
+    return knownSize(n, std::integral_constant<bool, SIZED>());
+}
 
+template<class Key, class Value, class Augment, class Compare>
+std::size_t AVLTree<Key, Value, Augment, Compare>::knownSize(AVLNode<Key, Value, Augment>* n, std::true_type)
+{
+    return SubtreeSize::sizeOf(n);
+}
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+template<class Key, class Value, class Augment, class Compare>
+std::size_t AVLTree<Key, Value, Augment, Compare>::knownSize(AVLNode<Key, Value, Augment>*, std::false_type)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
-    int tempH = n1->getHeight();
-    n1->setHeight(n2->getHeight());
-    n2->setHeight(tempH);
+    return BinarySearchTree<Key, Value, Compare>::UNKNOWN_SIZE;
 }
 
 
-// ************* Rotations *******************
-// ********************************************
-// ********************************************
-// ********************************************
+// ************* Augmented queries ***********
 // ********************************************
 
 
 
-template<class Key, class Value>
-void AVLTree<Key,Value>::leftRotate(AVLNode<Key, Value>* z)
+/**
+* Returns how many keys in the tree are less than key.
+*/
+template<class Key, class Value, class Augment, class Compare>
+std::size_t AVLTree<Key, Value, Augment, Compare>::rank(const Key& key) const
 {
-
-    if(z == nullptr){
-
+    static_assert(SIZED, "rank() needs the SubtreeSize augmentation");
+
+    std::size_t count = 0;
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while(n != nullptr){
+        if(this->compare_(n->getKey(), key)){
+            count += SubtreeSize::sizeOf(n->getLeft()) + 1;
+            n = n->getRight();
+        }
+        else{
+            n = n->getLeft();
+        }
     }
+    return count;
+}
 
-    AVLNode<Key, Value>* y = z->getRight();
-
-    AVLNode<Key, Value>* p = z -> getParent();
+/**
+* Returns an iterator to the element with the given zero-based position in key order, or
+* end() if there are not that many elements.
+*/
+template<class Key, class Value, class Augment, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator AVLTree<Key, Value, Augment, Compare>::select(std::size_t index)
+{
+    return this->makeIterator(selectNode(index));
+}
 
-    if(p != nullptr){   // CASE 1: z is not the root and has a parent 
+template<class Key, class Value, class Augment, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator AVLTree<Key, Value, Augment, Compare>::select(std::size_t index) const
+{
+    return this->makeIterator(selectNode(index));
+}
 
+/**
+* Returns it moved by steps positions (backwards if negative), or end() if that runs off
+* either end of the tree. end() itself counts as the position after the last element.
+*/
+template<class Key, class Value, class Augment, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+AVLTree<Key, Value, Augment, Compare>::advance(typename BinarySearchTree<Key, Value, Compare>::iterator it, std::ptrdiff_t steps)
+{
+    return this->makeIterator(advanceNode(this->iteratorNode(it), steps));
+}
 
-        bool zIsLC;    // if true then z is left child of its parent 
+template<class Key, class Value, class Augment, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+AVLTree<Key, Value, Augment, Compare>::advance(typename BinarySearchTree<Key, Value, Compare>::const_iterator it, std::ptrdiff_t steps) const
+{
+    return this->makeIterator(advanceNode(this->iteratorNode(it), steps));
+}
 
-        if(p->getLeft() == z){
-            
-            zIsLC = true;
-
-        }else{
-
-            zIsLC = false;
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::selectNode(std::size_t index) const
+{
+    static_assert(SIZED, "select() needs the SubtreeSize augmentation");
 
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while(n != nullptr){
+        std::size_t leftSize = SubtreeSize::sizeOf(n->getLeft());
+        if(index < leftSize){
+            n = n->getLeft();
         }
-
-        // Y and P connection
-        if(zIsLC){
-
-            p->setLeft(y);
-
-        }else{
-
-            p->setRight(y);
-
+        else if(index == leftSize){
+            break;
         }
-        y->setParent(p);
-
-        // Z and Y connection 
-        z->setParent(y);
-
-        AVLNode<Key, Value>* oldYLeftChild = y->getLeft();
-        y->setLeft(z);
-
-        z->setRight(oldYLeftChild);
-
-        if(oldYLeftChild != nullptr){
-            oldYLeftChild->setParent(z);
+        else{
+            index -= leftSize + 1;
+            n = n->getRight();
         }
+    }
+    return n;
+}
 
-        // Update heights 
-        updateHeight(z);
-        updateHeight(y);
-
-
-    }else{      // CASE 2: Z is the root and doesnt have a parent 
-
-        this->root_ = y;
-
-        y->setParent(nullptr);
-
-        AVLNode<Key, Value>* oldYLeftChild = y->getLeft();
-
-        y->setLeft(z);
-
-        z->setParent(y);
-    
-        z->setRight(oldYLeftChild);
-
-        if(oldYLeftChild != nullptr){
-            oldYLeftChild->setParent(z);
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::advanceNode(Node<Key, Value>* from, std::ptrdiff_t steps) const
+{
+    static_assert(SIZED, "advance() needs the SubtreeSize augmentation");
+
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(from);
+    std::size_t position = this->size();
+    if(n != nullptr){
+        // position of n: everything left of it, plus everything left of each ancestor it is right of
+        position = SubtreeSize::sizeOf(n->getLeft());
+        for(AVLNode<Key, Value, Augment>* p = n->getParent(); p != nullptr; n = p, p = p->getParent()){
+            if(p->getRight() == n){
+                position += SubtreeSize::sizeOf(p->getLeft()) + 1;
+            }
         }
-
-        updateHeight(z);
-
-        updateHeight(y);
     }
 
+    if(steps < 0 && static_cast<std::size_t>(-steps) > position){
+        return nullptr;
+    }
+    return selectNode(position + static_cast<std::size_t>(steps));
 }
 
 
-template<class Key, class Value>
-void AVLTree<Key,Value>::rightRotate(AVLNode<Key, Value>* z)
+/**
+* Finds the highest node inside [first, last); the range is then that node, the part of its
+* left subtree at or above first and the part of its right subtree below last. Each part is
+* one walk down, picking up whole subtrees from the cache on the way.
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename A>
+typename A::value_type AVLTree<Key, Value, Augment, Compare>::aggregate(const Key& first, const Key& last) const
 {
+    typedef typename A::value_type Result;
+    typedef AVLNode<Key, Value, Augment> NodeType;
 
-    if(z == nullptr){
-
+    NodeType* top = static_cast<NodeType*>(this->root_);
+    while(top != nullptr){
+        if(this->compare_(top->getKey(), first)){
+            top = top->getRight();
+        }
+        else if(!this->compare_(top->getKey(), last)){
+            top = top->getLeft();
+        }
+        else{
+            break;
+        }
+    }
+    if(top == nullptr){
+        return A::aggregateOf(top);
     }
 
-    AVLNode<Key, Value>* y = z->getLeft();
-
-    AVLNode<Key, Value>* p = z -> getParent();
-
-
-    if(p != nullptr){   // CASE 1: z is not the root and has a parent 
-
-        bool zIsLC;    // if true then z is left child of its parent 
-
-        if(p->getLeft() == z){
-            
-            zIsLC = true;
-
-        }else{
-
-            zIsLC = false;
-
+    // below top on the left every key is < last, so only first matters; pieces found
+    // further down hold smaller keys and go in front
+    Result below = A::aggregateOf(static_cast<NodeType*>(nullptr));
+    for(NodeType* n = top->getLeft(); n != nullptr; ){
+        if(this->compare_(n->getKey(), first)){
+            n = n->getRight();
         }
- 
-
-        // Y and P connection
-        if(zIsLC){
-
-            p->setLeft(y);
-
-        }else{
-
-            p->setRight(y);
-
+        else{
+            below = A::monoid_type::combine(A::monoid_type::combine(A::monoid_type::lift(n->getKey(), n->getValue()),
+                                                                    A::aggregateOf(n->getRight())), below);
+            n = n->getLeft();
         }
-        y->setParent(p);
-
-        // Z and Y connection 
-        z->setParent(y);
-
-        AVLNode<Key, Value>* oldYRightChild = y->getRight();
-        y->setRight(z);
-
-        z->setLeft(oldYRightChild);
+    }
 
-        if(oldYRightChild != nullptr){
-            oldYRightChild->setParent(z);
+    // and on the right only last matters; pieces found further down go behind
+    Result above = A::aggregateOf(static_cast<NodeType*>(nullptr));
+    for(NodeType* n = top->getRight(); n != nullptr; ){
+        if(this->compare_(n->getKey(), last)){
+            above = A::monoid_type::combine(above, A::monoid_type::combine(A::aggregateOf(n->getLeft()),
+                                                                           A::monoid_type::lift(n->getKey(), n->getValue())));
+            n = n->getRight();
+        }
+        else{
+            n = n->getLeft();
         }
+    }
 
-        updateHeight(z);
-        updateHeight(y);
+    return A::monoid_type::combine(A::monoid_type::combine(below, A::monoid_type::lift(top->getKey(), top->getValue())), above);
+}
 
-    }else{      // CASE 2: Z is the root and doesnt have a parent 
 
-        this->root_ = y;
+// ************* Split / Join ****************
+// ********************************************
 
-        y->setParent(nullptr);
 
-        AVLNode<Key, Value>* oldYRightChild = y->getRight();
 
-        y->setRight(z);
+/**
+* Moves every element with a key less than key into left and all others into right, leaving
+* this tree empty. Whatever left and right held before is cleared. O(log n).
+*
+* The nodes are not copied, so both halves go on allocating from and freeing into this tree's
+* arena, and a NodeArena is not synchronised: left and right may be read from different
+* threads, but inserting into or erasing from them concurrently needs a lock around both
+* (or copies, as ShardedAVLTree makes when it splits a shard).
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::split(const Key& key, AVLTree<Key, Value, Augment, Compare>& left, AVLTree<Key, Value, Augment, Compare>& right)
+{
+    if(&left == &right){
+        throw std::invalid_argument("AVLTree::split needs two different trees");
+    }
 
-        z->setParent(y);
-    
-        z->setLeft(oldYRightChild);
+    AVLNode<Key, Value, Augment>* t = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    int height = subtreeHeight(t);
+    this->root_ = nullptr;
+    this->rightmost_ = nullptr;
 
-        if(oldYRightChild != nullptr){
-            oldYRightChild->setParent(z);
-        }
-
-        updateHeight(z);
-        updateHeight(y);
+    NodeArena::resolve(this->arena_);
+    std::shared_ptr<NodeArena> nodes = this->arena_;
+    if(&left != this){
+        left.clear();
+    }
+    if(&right != this){
+        right.clear();
+    }
+    // the nodes stay where they are, both halves now share this tree's arena
+    left.arena_ = nodes;
+    right.arena_ = nodes;
+    if(&left != this && &right != this){
+        this->arena_ = std::make_shared<NodeArena>();
+    }
 
+    AVLNode<Key, Value, Augment>* l;
+    AVLNode<Key, Value, Augment>* match;
+    AVLNode<Key, Value, Augment>* r;
+    int leftHeight;
+    int rightHeight;
+    splitNodes(t, height, key, l, leftHeight, match, r, rightHeight);
+    if(match != nullptr){
+        // the element with the split key itself belongs to the right half
+        r = joinNodes(nullptr, 0, match, r, rightHeight, rightHeight);
+    }
+#ifdef BST_THREADED
+    // the in-order links are still right inside each half, only the link across the cut goes
+    this->linkThreads(rightmost(l), nullptr);
+    this->linkThreads(nullptr, leftmost(r));
+#endif
+    left.root_ = l;
+    right.root_ = r;
+    left.rightmost_ = nullptr;
+    right.rightmost_ = nullptr;
+    left.size_ = knownSize(l);
+    right.size_ = knownSize(r);
+    if(&left != this && &right != this){
+        this->size_ = 0;
     }
 }
 
-
-
-template<class Key, class Value>
-void AVLTree<Key,Value>::leftRotateForRemove(AVLNode<Key, Value>* z)
+/**
+* Makes this tree hold the elements of left, pivot and right, emptying left and right. Every
+* key of left must be less than pivot's key, which must be less than every key of right.
+* Anything this tree held before (unless it is left or right) is cleared. O(log n).
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::join(AVLTree<Key, Value, Augment, Compare>& left, const std::pair<const Key, Value>& pivot, AVLTree<Key, Value, Augment, Compare>& right)
 {
-
-    if(z == nullptr){
-
+    if(&left == &right){
+        throw std::invalid_argument("AVLTree::join needs two different trees");
     }
 
-    AVLNode<Key, Value>* y = z->getRight();
-
-    AVLNode<Key, Value>* p = z -> getParent();
-
-
-    if(p != nullptr){   // CASE 1: z is not the root and has a parent 
-
-        bool zIsLC;    // if true then z is left child of its parent 
-
-        if(p->getLeft() == z){
-            
-            zIsLC = true;
-
-        }else{
-
-            zIsLC = false;
-
-        }
-
-        // Y and P connection
-        if(zIsLC){
-
-            p->setLeft(y);
-
-        }else{
-
-            p->setRight(y);
-
-        }
-        y->setParent(p);
+    AVLNode<Key, Value, Augment>* l = rightmost(static_cast<AVLNode<Key, Value, Augment>*>(left.root_));
+    AVLNode<Key, Value, Augment>* r = leftmost(static_cast<AVLNode<Key, Value, Augment>*>(right.root_));
+    if((l != nullptr && !this->compare_(l->getKey(), pivot.first)) || (r != nullptr && !this->compare_(pivot.first, r->getKey()))){
+        throw std::invalid_argument("AVLTree::join: keys are not in order");
+    }
 
-        // Z and Y connection 
-        z->setParent(y);
+    AVLNode<Key, Value, Augment>* node = this->template createNode<AVLNode<Key, Value, Augment> >(pivot.first, pivot.second, nullptr);
+    joinTrees(left, node, right);
+}
 
-        AVLNode<Key, Value>* oldYLeftChild = y->getLeft();
-        y->setLeft(z);
+/**
+* Concatenates left and right into this tree, emptying them. Every key of left must be less
+* than every key of right. The largest node of left becomes the pivot. O(log n).
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::join(AVLTree<Key, Value, Augment, Compare>& left, AVLTree<Key, Value, Augment, Compare>& right)
+{
+    if(&left == &right){
+        throw std::invalid_argument("AVLTree::join needs two different trees");
+    }
 
-        z->setRight(oldYLeftChild);
+    AVLNode<Key, Value, Augment>* l = rightmost(static_cast<AVLNode<Key, Value, Augment>*>(left.root_));
+    AVLNode<Key, Value, Augment>* r = leftmost(static_cast<AVLNode<Key, Value, Augment>*>(right.root_));
+    if(l != nullptr && r != nullptr && !this->compare_(l->getKey(), r->getKey())){
+        throw std::invalid_argument("AVLTree::join: keys are not in order");
+    }
 
-        if(oldYLeftChild != nullptr){
-            oldYLeftChild->setParent(z);
+    if(l == nullptr){
+        // nothing to join, right simply becomes this tree
+        if(this == &right){
+            return;
         }
-
-        // Update heights 
-
-
-    }else{      // CASE 2: Z is the root and doesnt have a parent 
-
-        this->root_ = y;
-
-        y->setParent(nullptr);
-
-        AVLNode<Key, Value>* oldYLeftChild = y->getLeft();
-
-        y->setLeft(z);
-
-        z->setParent(y);
-    
-        z->setRight(oldYLeftChild);
-
-        if(oldYLeftChild != nullptr){
-            oldYLeftChild->setParent(z);
+        AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(right.root_);
+        std::size_t count = right.size_;
+        right.root_ = nullptr;
+        if(this != &left){
+            this->clear();
         }
+        this->absorbArena(right);
+        this->root_ = root;
+        this->rightmost_ = right.rightmost_;
+        right.rightmost_ = nullptr;
+        right.size_ = 0;
+        this->size_ = count;
+        return;
     }
 
+    left.detachNode(l);
+    left.addToSize(-1);
+    joinTrees(left, l, right);
 }
 
-
-template<class Key, class Value>
-void AVLTree<Key,Value>::rightRotateForRemove(AVLNode<Key, Value>* z)
+/**
+* Links left, the detached node pivot and right together as the new contents of this tree.
+* pivot must already live in one of the three trees' arenas.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::joinTrees(AVLTree<Key, Value, Augment, Compare>& left, AVLNode<Key, Value, Augment>* pivot, AVLTree<Key, Value, Augment, Compare>& right)
 {
-
-    if(z == nullptr){
-
-
+    AVLNode<Key, Value, Augment>* l = static_cast<AVLNode<Key, Value, Augment>*>(left.root_);
+    AVLNode<Key, Value, Augment>* r = static_cast<AVLNode<Key, Value, Augment>*>(right.root_);
+    int leftHeight = subtreeHeight(l);
+    int rightHeight = subtreeHeight(r);
+    std::size_t count = (left.size_ == this->UNKNOWN_SIZE || right.size_ == this->UNKNOWN_SIZE)
+                        ? this->UNKNOWN_SIZE : left.size_ + right.size_ + 1;
+    left.root_ = nullptr;
+    right.root_ = nullptr;
+    left.rightmost_ = nullptr;
+    right.rightmost_ = nullptr;
+    left.size_ = 0;
+    right.size_ = 0;
+
+    if(this != &left && this != &right){
+        // pivot may have been made in this tree's arena, so keep the arena and only drop the nodes
+        AVLNode<Key, Value, Augment>* old = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+        this->root_ = nullptr;
+        this->clearNodes(old);
     }
+    this->rightmost_ = nullptr;
+    this->absorbArena(left);
+    this->absorbArena(right);
 
-    AVLNode<Key, Value>* y = z->getLeft();
-
-    AVLNode<Key, Value>* p = z -> getParent();
-
-
-    if(p != nullptr){   // CASE 1: z is not the root and has a parent 
-
-        bool zIsLC;    // if true then z is left child of its parent 
-
-        if(p->getLeft() == z){
-            
-            zIsLC = true;
-
-        }else{
+#ifdef BST_THREADED
+    this->linkThreads(rightmost(l), pivot);
+    this->linkThreads(pivot, leftmost(r));
+#endif
+    int height;
+    this->root_ = joinNodes(l, leftHeight, pivot, r, rightHeight, height);
+    this->size_ = count;
+}
 
-            zIsLC = false;
+// Counts levels by always stepping into the taller child. O(log n).
+template<class Key, class Value, class Augment, class Compare>
+int AVLTree<Key, Value, Augment, Compare>::subtreeHeight(AVLNode<Key, Value, Augment>* n)
+{
+    int height = 0;
+    while(n != nullptr){
+        ++height;
+        n = (n->getBalance() < 0) ? n->getLeft() : n->getRight();
+    }
+    return height;
+}
 
+// Returns a tree made of left, pivot and right. If the heights are close pivot simply becomes
+// the root; otherwise pivot is hung off the spine of the taller tree at the first node that is
+// no more than one level taller than the shorter tree, and the growth is retraced from there.
+// Costs O(|leftHeight - rightHeight| + 1). height receives the height of the result.
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::joinNodes(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* pivot,
+                                                    AVLNode<Key, Value, Augment>* right, int rightHeight, int& height)
+{
+    if(leftHeight > rightHeight + 1){   // walk down the right spine of left
+
+        AVLNode<Key, Value, Augment>* p = nullptr;
+        AVLNode<Key, Value, Augment>* c = left;
+        int h = leftHeight;
+        while(h > rightHeight + 1){
+            h -= (c->getBalance() < 0) ? 2 : 1;
+            p = c;
+            c = c->getRight();
         }
- 
-
-        // Y and P connection
-        if(zIsLC){
-
-            p->setLeft(y);
-
-        }else{
-
-            p->setRight(y);
 
+        pivot->setLeft(c);
+        pivot->setRight(right);
+        if(c != nullptr){
+            c->setParent(pivot);
         }
-        y->setParent(p);
-
-        // Z and Y connection 
-        z->setParent(y);
-
-        AVLNode<Key, Value>* oldYRightChild = y->getRight();
-        y->setRight(z);
-
-        z->setLeft(oldYRightChild);
-
-        if(oldYRightChild != nullptr){
-            oldYRightChild->setParent(z);
+        if(right != nullptr){
+            right->setParent(pivot);
         }
+        pivot->setBalance(rightHeight - h);
+        pivot->setParent(p);
+        p->setRight(pivot);
 
+        bool grewToTop;
+        AVLNode<Key, Value, Augment>* top = retraceGrowth(p, pivot, grewToTop);
+        pullPath(pivot);
+        height = leftHeight + (grewToTop ? 1 : 0);
+        return (top->getParent() == nullptr) ? top : left;
 
-    }else{      // CASE 2: Z is the root and doesnt have a parent 
-
-        this->root_ = y;
-
-        y->setParent(nullptr);
-
-        AVLNode<Key, Value>* oldYRightChild = y->getRight();
-
-        y->setRight(z);
-
-        z->setParent(y);
-    
-        z->setLeft(oldYRightChild);
+    }
+    else if(rightHeight > leftHeight + 1){  // walk down the left spine of right
+
+        AVLNode<Key, Value, Augment>* p = nullptr;
+        AVLNode<Key, Value, Augment>* c = right;
+        int h = rightHeight;
+        while(h > leftHeight + 1){
+            h -= (c->getBalance() > 0) ? 2 : 1;
+            p = c;
+            c = c->getLeft();
+        }
 
-        if(oldYRightChild != nullptr){
-            oldYRightChild->setParent(z);
+        pivot->setLeft(left);
+        pivot->setRight(c);
+        if(left != nullptr){
+            left->setParent(pivot);
         }
+        if(c != nullptr){
+            c->setParent(pivot);
+        }
+        pivot->setBalance(h - leftHeight);
+        pivot->setParent(p);
+        p->setLeft(pivot);
 
+        bool grewToTop;
+        AVLNode<Key, Value, Augment>* top = retraceGrowth(p, pivot, grewToTop);
+        pullPath(pivot);
+        height = rightHeight + (grewToTop ? 1 : 0);
+        return (top->getParent() == nullptr) ? top : right;
 
     }
-}
 
+    pivot->setLeft(left);
+    pivot->setRight(right);
+    pivot->setParent(nullptr);
+    if(left != nullptr){
+        left->setParent(pivot);
+    }
+    if(right != nullptr){
+        right->setParent(pivot);
+    }
+    pivot->setBalance(rightHeight - leftHeight);
+    Augment::pull(pivot);
+    height = std::max(leftHeight, rightHeight) + 1;
+    return pivot;
+}
 
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-// **************************************************************************************************
-
-// will a particular node's height need to be updated given the current state of its children
-template<class Key, class Value>
-bool AVLTree<Key, Value>::willHeightChange( AVLNode<Key,Value>* n)
+// Splits the detached subtree t of the given height into the nodes with keys less than key,
+// the node whose key equals key (match, or NULL) and the nodes with greater keys. Walks down
+// one path and joins the pieces back up on the way out; the joins telescope, so the whole
+// split costs O(height).
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::splitNodes(AVLNode<Key, Value, Augment>* t, int height, const Key& key,
+                                     AVLNode<Key, Value, Augment>*& left, int& leftHeight, AVLNode<Key, Value, Augment>*& match,
+                                     AVLNode<Key, Value, Augment>*& right, int& rightHeight) const
 {
-    int oldHeight = n->getHeight();
-
-    int leftHeight; 
+    if(t == nullptr){
+        left = right = match = nullptr;
+        leftHeight = rightHeight = 0;
+        return;
+    }
 
-    int rightHeight;
+    AVLNode<Key, Value, Augment>* tl = t->getLeft();
+    AVLNode<Key, Value, Augment>* tr = t->getRight();
+    int tlHeight = height - ((t->getBalance() > 0) ? 2 : 1);
+    int trHeight = height - ((t->getBalance() < 0) ? 2 : 1);
+    if(tl != nullptr){
+        tl->setParent(nullptr);
+    }
+    if(tr != nullptr){
+        tr->setParent(nullptr);
+    }
 
-    if(n->getLeft() != nullptr){
+    AVLNode<Key, Value, Augment>* a;
+    AVLNode<Key, Value, Augment>* b;
+    int aHeight;
+    int bHeight;
 
-        leftHeight = n->getLeft()->getHeight();
+    if(this->compare_(t->getKey(), key)){  // t and its left subtree go left
 
-    }else{
+        splitNodes(tr, trHeight, key, a, aHeight, match, b, bHeight);
+        left = joinNodes(tl, tlHeight, t, a, aHeight, leftHeight);
+        right = b;
+        rightHeight = bHeight;
 
-        leftHeight = 0;
     }
-    
-    if(n->getRight() != nullptr){
-
-        rightHeight = n->getRight()->getHeight();
+    else if(this->compare_(key, t->getKey())){   // t and its right subtree go right
 
-    }else{
+        splitNodes(tl, tlHeight, key, a, aHeight, match, b, bHeight);
+        left = a;
+        leftHeight = aHeight;
+        right = joinNodes(b, bHeight, t, tr, trHeight, rightHeight);
 
-        rightHeight = 0;
     }
+    else{   // found the key, its subtrees are already the two halves
+
+        t->setLeft(nullptr);
+        t->setRight(nullptr);
+        t->setParent(nullptr);
+        t->setBalance(0);
+        Augment::pull(t);
+        match = t;
+        left = tl;
+        leftHeight = tlHeight;
+        right = tr;
+        rightHeight = trHeight;
 
-    int newHeight = std::max(leftHeight, rightHeight) + 1;
-
-    if(newHeight != oldHeight){
-
-        return true;
-
-    } else{
-
-        return false;
     }
-    
 }
 
-
-template<class Key, class Value>
-AVLNode<Key,Value>* AVLTree<Key,Value>::getG(AVLNode<Key, Value>* c, AVLNode<Key, Value>* n)
+// Detaches the largest node of the detached subtree t into last and returns what remains.
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::splitLast(AVLNode<Key, Value, Augment>* t, int height, AVLNode<Key, Value, Augment>*& last, int& restHeight)
 {
-    if(c == nullptr){
-
-        return nullptr;
-
+    AVLNode<Key, Value, Augment>* tl = t->getLeft();
+    AVLNode<Key, Value, Augment>* tr = t->getRight();
+    int tlHeight = height - ((t->getBalance() > 0) ? 2 : 1);
+    int trHeight = height - ((t->getBalance() < 0) ? 2 : 1);
+    if(tl != nullptr){
+        tl->setParent(nullptr);
     }
 
-    int leftHeight;
-
-    int rightHeight;
-
-    if(c->getLeft() != nullptr){
-
-        leftHeight = c->getLeft()->getHeight();
-
-    }else{
-
-        leftHeight = 0;
+    if(tr == nullptr){
+        last = t;
+        t->setLeft(nullptr);
+        t->setParent(nullptr);
+        t->setBalance(0);
+        Augment::pull(t);
+        restHeight = tlHeight;
+        return tl;
     }
-    
-    if(c->getRight() != nullptr){
-
-        rightHeight = c->getRight()->getHeight();
 
-    }else{
-
-        rightHeight = 0;
+    tr->setParent(nullptr);
+    int rest;
+    AVLNode<Key, Value, Augment>* r = splitLast(tr, trHeight, last, rest);
+    return joinNodes(tl, tlHeight, t, r, rest, restHeight);
+}
 
+// Like joinNodes, but without a pivot: the largest node of left takes that role.
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::concatNodes(AVLNode<Key, Value, Augment>* left, int leftHeight,
+                                                      AVLNode<Key, Value, Augment>* right, int rightHeight, int& height)
+{
+    if(left == nullptr){
+        height = rightHeight;
+        return right;
     }
+    AVLNode<Key, Value, Augment>* last;
+    int restHeight;
+    AVLNode<Key, Value, Augment>* rest = splitLast(left, leftHeight, last, restHeight);
+    return joinNodes(rest, restHeight, last, right, rightHeight, height);
+}
 
-    if(rightHeight == leftHeight){
-
-        // return the one that causes a zig zig
-        
-        if(n->getLeft() == c){
-
-            return c->getLeft();
+/**
+* Patches the in-order links where joinNodes() or concatNodes() is about to put left, pivot
+* and right side by side; pivot is NULL for concatNodes(). Only the seams are touched, at
+* O(height) for finding them, so a set operation never has to rethread the whole tree.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::joinThreads(AVLNode<Key, Value, Augment>* left, AVLNode<Key, Value, Augment>* pivot, AVLNode<Key, Value, Augment>* right)
+{
+#ifdef BST_THREADED
+    AVLNode<Key, Value, Augment>* last = rightmost(left);
+    AVLNode<Key, Value, Augment>* first = leftmost(right);
+    if(pivot != nullptr){
+        BinarySearchTree<Key, Value, Compare>::linkThreads(last, pivot);
+        BinarySearchTree<Key, Value, Compare>::linkThreads(pivot, first);
+    }
+    else if(last != nullptr && first != nullptr){
+        BinarySearchTree<Key, Value, Compare>::linkThreads(last, first);
+    }
+#else
+    (void)left;
+    (void)pivot;
+    (void)right;
+#endif
+}
 
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::leftmost(AVLNode<Key, Value, Augment>* n)
+{
+    if(n != nullptr){
+        while(n->getLeft() != nullptr){
+            n = n->getLeft();
         }
-        else if(n->getRight() == c){
-
-            return c->getRight();
+    }
+    return n;
+}
 
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::rightmost(AVLNode<Key, Value, Augment>* n)
+{
+    if(n != nullptr){
+        while(n->getRight() != nullptr){
+            n = n->getRight();
         }
-
     }
-
-    // assuming right and left are not null
-
-    if(rightHeight > leftHeight) return c->getRight();
-
-    return c->getLeft();   
-
+    return n;
 }
 
 
+// ************* Set algebra *****************
+// ********************************************
 
 
-// RETURNS: void. FUNCTION: look's at node's children and update's height 
-template<class Key, class Value>
-void AVLTree<Key,Value>::updateHeight(AVLNode<Key, Value>* node)
-{   
 
-    if(node == nullptr){
+/**
+* Adds every element of other to this tree; for keys present in both, other's value wins.
+* Takes O(m log(n/m + 1)) work for trees of sizes m <= n.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::union_with(AVLTree<Key, Value, Augment, Compare>& other)
+{
+    if(&other == this){
         return;
     }
+    AVLNode<Key, Value, Augment>* a;
+    AVLNode<Key, Value, Augment>* b;
+    int aHeight;
+    int bHeight;
+    std::size_t count;
+    absorbForSetOperation(other, a, aHeight, b, bHeight, count);
+
+    std::vector<AVLNode<Key, Value, Augment>*> discarded;
+    int height;
+    this->root_ = unionNodes(a, aHeight, b, bHeight, height, discarded, BinarySearchTree<Key, Value, Compare>::parallelDepth());
+    finishSetOperation(discarded, count);
+}
 
-    int leftHeight; 
+/**
+* Keeps only the elements whose keys are also in other.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::intersect_with(AVLTree<Key, Value, Augment, Compare>& other)
+{
+    if(&other == this){
+        return;
+    }
+    AVLNode<Key, Value, Augment>* a;
+    AVLNode<Key, Value, Augment>* b;
+    int aHeight;
+    int bHeight;
+    std::size_t count;
+    absorbForSetOperation(other, a, aHeight, b, bHeight, count);
+
+    std::vector<AVLNode<Key, Value, Augment>*> discarded;
+    int height;
+    this->root_ = intersectNodes(a, aHeight, b, bHeight, height, discarded, BinarySearchTree<Key, Value, Compare>::parallelDepth());
+    finishSetOperation(discarded, count);
+}
 
-    int rightHeight;
+/**
+* Removes every element whose key is in other.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::difference_with(AVLTree<Key, Value, Augment, Compare>& other)
+{
+    if(&other == this){
+        clear();
+        return;
+    }
+    AVLNode<Key, Value, Augment>* a;
+    AVLNode<Key, Value, Augment>* b;
+    int aHeight;
+    int bHeight;
+    std::size_t count;
+    absorbForSetOperation(other, a, aHeight, b, bHeight, count);
+
+    std::vector<AVLNode<Key, Value, Augment>*> discarded;
+    int height;
+    this->root_ = differenceNodes(a, aHeight, b, bHeight, height, discarded, BinarySearchTree<Key, Value, Compare>::parallelDepth());
+    finishSetOperation(discarded, count);
+}
 
-    if(node->getLeft() != nullptr){
+// Takes both root subtrees out and moves other's nodes into this tree's arena. count receives
+// the number of nodes in both trees together.
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::absorbForSetOperation(AVLTree<Key, Value, Augment, Compare>& other, AVLNode<Key, Value, Augment>*& a, int& aHeight,
+                                                         AVLNode<Key, Value, Augment>*& b, int& bHeight, std::size_t& count)
+{
+    count = (this->size_ == this->UNKNOWN_SIZE || other.size_ == this->UNKNOWN_SIZE)
+            ? this->UNKNOWN_SIZE : this->size_ + other.size_;
+    other.size_ = 0;
+    a = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    b = static_cast<AVLNode<Key, Value, Augment>*>(other.root_);
+    aHeight = subtreeHeight(a);
+    bHeight = subtreeHeight(b);
+    this->root_ = nullptr;
+    other.root_ = nullptr;
+    this->rightmost_ = nullptr;
+    other.rightmost_ = nullptr;
+    this->absorbArena(other);
+}
 
-        leftHeight = node->getLeft()->getHeight();
+// Destroys the nodes a set operation dropped and brings the counters up to date; count is
+// the number of nodes the operation started with.
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::finishSetOperation(const std::vector<AVLNode<Key, Value, Augment>*>& discarded, std::size_t count)
+{
+    for(std::size_t i = 0; i < discarded.size(); ++i){
+        this->destroyNode(discarded[i]);
+    }
+    this->size_ = (count == this->UNKNOWN_SIZE) ? count : count - discarded.size();
 
-    }else{
+    // the workers linked every seam they joined; only the ends of the result are left over
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    this->linkThreads(nullptr, leftmost(root));
+    this->linkThreads(rightmost(root), nullptr);
+}
 
-        leftHeight = 0;
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::collectNodes(AVLNode<Key, Value, Augment>* n, std::vector<AVLNode<Key, Value, Augment>*>& out)
+{
+    if(n == nullptr){
+        return;
     }
-    
-    if(node->getRight() != nullptr){
+    collectNodes(n->getLeft(), out);
+    collectNodes(n->getRight(), out);
+    out.push_back(n);
+}
 
-        rightHeight = node->getRight()->getHeight();
+// union(a, b): split b around a's root, unite the two sides independently and join them
+// back with a's root (or b's equal node, whose value wins) in the middle.
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::unionNodes(AVLNode<Key, Value, Augment>* a, int aHeight, AVLNode<Key, Value, Augment>* b, int bHeight,
+                                                     int& height, std::vector<AVLNode<Key, Value, Augment>*>& discarded, unsigned depth) const
+{
+    if(a == nullptr){
+        height = bHeight;
+        return b;
+    }
+    if(b == nullptr){
+        height = aHeight;
+        return a;
+    }
 
-    }else{
+    AVLNode<Key, Value, Augment>* al = a->getLeft();
+    AVLNode<Key, Value, Augment>* ar = a->getRight();
+    int alHeight = aHeight - ((a->getBalance() > 0) ? 2 : 1);
+    int arHeight = aHeight - ((a->getBalance() < 0) ? 2 : 1);
+    if(al != nullptr){
+        al->setParent(nullptr);
+    }
+    if(ar != nullptr){
+        ar->setParent(nullptr);
+    }
 
-        rightHeight = 0;
+    AVLNode<Key, Value, Augment>* bl;
+    AVLNode<Key, Value, Augment>* match;
+    AVLNode<Key, Value, Augment>* br;
+    int blHeight;
+    int brHeight;
+    splitNodes(b, bHeight, a->getKey(), bl, blHeight, match, br, brHeight);
+
+    AVLNode<Key, Value, Augment>* l;
+    AVLNode<Key, Value, Augment>* r;
+    int lHeight;
+    int rHeight;
+    bool parallel = depth > 0 && std::min(aHeight, bHeight) >= PARALLEL_MIN_HEIGHT;
+    std::vector<AVLNode<Key, Value, Augment>*> rightDiscarded;
+    std::vector<AVLNode<Key, Value, Augment>*>& rightSink = parallel ? rightDiscarded : discarded;
+    BinarySearchTree<Key, Value, Compare>::forkJoin(parallel,
+        [&]() { l = unionNodes(al, alHeight, bl, blHeight, lHeight, discarded, depth > 0 ? depth - 1 : 0); },
+        [&]() { r = unionNodes(ar, arHeight, br, brHeight, rHeight, rightSink, depth > 0 ? depth - 1 : 0); });
+    discarded.insert(discarded.end(), rightDiscarded.begin(), rightDiscarded.end());
+
+    AVLNode<Key, Value, Augment>* pivot = a;
+    if(match != nullptr){
+        discarded.push_back(a);
+        pivot = match;
+    }
+    joinThreads(l, pivot, r);
+    return joinNodes(l, lHeight, pivot, r, rHeight, height);
+}
+
+// intersect(a, b): split b around a's root, intersect both sides, and keep a's root only if
+// b had the same key.
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::intersectNodes(AVLNode<Key, Value, Augment>* a, int aHeight, AVLNode<Key, Value, Augment>* b, int bHeight,
+                                                         int& height, std::vector<AVLNode<Key, Value, Augment>*>& discarded, unsigned depth) const
+{
+    if(a == nullptr || b == nullptr){
+        collectNodes(a, discarded);
+        collectNodes(b, discarded);
+        height = 0;
+        return nullptr;
     }
 
-    int newHeight= std::max(rightHeight, leftHeight) + 1;
+    AVLNode<Key, Value, Augment>* al = a->getLeft();
+    AVLNode<Key, Value, Augment>* ar = a->getRight();
+    int alHeight = aHeight - ((a->getBalance() > 0) ? 2 : 1);
+    int arHeight = aHeight - ((a->getBalance() < 0) ? 2 : 1);
+    if(al != nullptr){
+        al->setParent(nullptr);
+    }
+    if(ar != nullptr){
+        ar->setParent(nullptr);
+    }
 
-    node->setHeight(newHeight);
+    AVLNode<Key, Value, Augment>* bl;
+    AVLNode<Key, Value, Augment>* match;
+    AVLNode<Key, Value, Augment>* br;
+    int blHeight;
+    int brHeight;
+    splitNodes(b, bHeight, a->getKey(), bl, blHeight, match, br, brHeight);
+
+    AVLNode<Key, Value, Augment>* l;
+    AVLNode<Key, Value, Augment>* r;
+    int lHeight;
+    int rHeight;
+    bool parallel = depth > 0 && std::min(aHeight, bHeight) >= PARALLEL_MIN_HEIGHT;
+    std::vector<AVLNode<Key, Value, Augment>*> rightDiscarded;
+    std::vector<AVLNode<Key, Value, Augment>*>& rightSink = parallel ? rightDiscarded : discarded;
+    BinarySearchTree<Key, Value, Compare>::forkJoin(parallel,
+        [&]() { l = intersectNodes(al, alHeight, bl, blHeight, lHeight, discarded, depth > 0 ? depth - 1 : 0); },
+        [&]() { r = intersectNodes(ar, arHeight, br, brHeight, rHeight, rightSink, depth > 0 ? depth - 1 : 0); });
+    discarded.insert(discarded.end(), rightDiscarded.begin(), rightDiscarded.end());
+
+    if(match != nullptr){
+        discarded.push_back(match);
+        joinThreads(l, a, r);
+        return joinNodes(l, lHeight, a, r, rHeight, height);
+    }
+    discarded.push_back(a);
+    joinThreads(l, nullptr, r);
+    return concatNodes(l, lHeight, r, rHeight, height);
 }
 
-
-// RETURN: if node is balanced or not
-template<class Key, class Value>
-bool AVLTree<Key,Value>::checkIfBalanced(AVLNode<Key, Value>* node)
+// difference(a, b): split a around b's root, subtract b's sides from a's sides, and drop b's
+// root together with a's equal node if there is one.
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::differenceNodes(AVLNode<Key, Value, Augment>* a, int aHeight, AVLNode<Key, Value, Augment>* b, int bHeight,
+                                                          int& height, std::vector<AVLNode<Key, Value, Augment>*>& discarded, unsigned depth) const
 {
+    if(a == nullptr || b == nullptr){
+        collectNodes(b, discarded);
+        height = aHeight;
+        return a;
+    }
 
-    if(node == nullptr){
-        return true;
+    AVLNode<Key, Value, Augment>* bl = b->getLeft();
+    AVLNode<Key, Value, Augment>* br = b->getRight();
+    int blHeight = bHeight - ((b->getBalance() > 0) ? 2 : 1);
+    int brHeight = bHeight - ((b->getBalance() < 0) ? 2 : 1);
+    if(bl != nullptr){
+        bl->setParent(nullptr);
+    }
+    if(br != nullptr){
+        br->setParent(nullptr);
     }
 
-    int leftHeight; 
+    AVLNode<Key, Value, Augment>* al;
+    AVLNode<Key, Value, Augment>* match;
+    AVLNode<Key, Value, Augment>* ar;
+    int alHeight;
+    int arHeight;
+    splitNodes(a, aHeight, b->getKey(), al, alHeight, match, ar, arHeight);
+
+    AVLNode<Key, Value, Augment>* l;
+    AVLNode<Key, Value, Augment>* r;
+    int lHeight;
+    int rHeight;
+    bool parallel = depth > 0 && std::min(aHeight, bHeight) >= PARALLEL_MIN_HEIGHT;
+    std::vector<AVLNode<Key, Value, Augment>*> rightDiscarded;
+    std::vector<AVLNode<Key, Value, Augment>*>& rightSink = parallel ? rightDiscarded : discarded;
+    BinarySearchTree<Key, Value, Compare>::forkJoin(parallel,
+        [&]() { l = differenceNodes(al, alHeight, bl, blHeight, lHeight, discarded, depth > 0 ? depth - 1 : 0); },
+        [&]() { r = differenceNodes(ar, arHeight, br, brHeight, rHeight, rightSink, depth > 0 ? depth - 1 : 0); });
+    discarded.insert(discarded.end(), rightDiscarded.begin(), rightDiscarded.end());
+
+    discarded.push_back(b);
+    if(match != nullptr){
+        discarded.push_back(match);
+    }
+    joinThreads(l, nullptr, r);
+    return concatNodes(l, lHeight, r, rHeight, height);
+}
 
-    int rightHeight;
 
-    if(node->getLeft() != nullptr){
+// ************* Rotations *******************
+// ********************************************
 
-        leftHeight = node->getLeft()->getHeight();
 
 
-    }else{
+// Fixes node z whose real balance factor is +/-2 (its stored one is stale) with a single or
+// double rotation and sets the balance factors of every node involved. Returns the new root
+// of the subtree. heightDropped tells whether the subtree ended up one level shorter than z
+// was; that is only false when z's taller child was itself balanced, which can happen on
+// removal but never on insertion.
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::rebalance(AVLNode<Key, Value, Augment>* z, int balance, bool& heightDropped)
+{
+    if(balance > 0){    // right heavy
 
-        leftHeight = 0;
-    }
-    
-    if(node->getRight() != nullptr){
+        AVLNode<Key, Value, Augment>* y = z->getRight();
+        int yBalance = y->getBalance();
 
-        rightHeight = node->getRight()->getHeight();
+        if(yBalance >= 0){      // Fix right zig-zig
 
+            leftRotate(z);
+            heightDropped = (yBalance != 0);
+            z->setBalance(yBalance == 0 ? 1 : 0);
+            y->setBalance(yBalance == 0 ? -1 : 0);
+            return y;
+
+        }
 
-    }else{
+        // Fix right zig-zag
+        AVLNode<Key, Value, Augment>* x = y->getLeft();
+        int xBalance = x->getBalance();
+        rightRotate(y);
+        leftRotate(z);
+        heightDropped = true;
+        z->setBalance(xBalance == 1 ? -1 : 0);
+        y->setBalance(xBalance == -1 ? 1 : 0);
+        x->setBalance(0);
+        return x;
 
-        rightHeight = 0;
     }
+    else{   // left heavy
 
+        AVLNode<Key, Value, Augment>* y = z->getLeft();
+        int yBalance = y->getBalance();
 
-    if(abs(rightHeight - leftHeight) <= 1){     // node is balanced acorrding to balance factor avl property
+        if(yBalance <= 0){      // Fix left zig-zig
 
-        return true;
+            rightRotate(z);
+            heightDropped = (yBalance != 0);
+            z->setBalance(yBalance == 0 ? -1 : 0);
+            y->setBalance(yBalance == 0 ? 1 : 0);
+            return y;
 
-    }else{      // node not balanced 
+        }
 
-        return false;
+        // Fix left zig-zag
+        AVLNode<Key, Value, Augment>* x = y->getRight();
+        int xBalance = x->getBalance();
+        leftRotate(y);
+        rightRotate(z);
+        heightDropped = true;
+        z->setBalance(xBalance == -1 ? 1 : 0);
+        y->setBalance(xBalance == 1 ? -1 : 0);
+        x->setBalance(0);
+        return x;
 
     }
-
 }
 
-// RETURN: wheather node's parent's height has chanegd or not 
-template<class Key, class Value>
-bool AVLTree<Key,Value>::parentHeightChange(AVLNode<Key, Value>* node)
-{
-
-    AVLNode<Key, Value>* parent = node->getParent();
 
-    int oldParentHeight = parent->getHeight();
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::leftRotate(AVLNode<Key, Value, Augment>* z)
+{
 
-    int leftHeight; 
+    AVLNode<Key, Value, Augment>* y = z->getRight();
 
-    int rightHeight;
+    AVLNode<Key, Value, Augment>* p = z -> getParent();
 
-    if(parent->getLeft() != nullptr){
+    // Y and P connection
+    if(p != nullptr){
 
-        leftHeight = parent->getLeft()->getHeight();
-
-    }else{
+        if(p->getLeft() == z){
 
-        leftHeight = 0;
-    }
-    
-    if(parent->getRight() != nullptr){
+            p->setLeft(y);
 
-        rightHeight = parent->getRight()->getHeight();
+        }else{
 
-    }else{
+            p->setRight(y);
 
-        rightHeight = 0;
+        }
     }
+    y->setParent(p);
 
-    int newParentHeight = std::max(leftHeight, rightHeight) + 1;
+    // Z and Y connection 
+    AVLNode<Key, Value, Augment>* oldYLeftChild = y->getLeft();
 
-    if(newParentHeight != oldParentHeight){
+    y->setLeft(z);
 
-        return true;
+    z->setParent(y);
 
-    } else{
+    z->setRight(oldYLeftChild);
 
-        return false;
+    if(oldYLeftChild != nullptr){
+        oldYLeftChild->setParent(z);
     }
-}
-
-// RETURN: child with greater height 
-template<class Key, class Value>
-AVLNode<Key,Value>* AVLTree<Key,Value>::getGreaterChild(AVLNode<Key, Value>* node)
-{
-    int leftChildH;
 
-    int rightChildH;
+    Augment::pull(z);
+    Augment::pull(y);
 
-    if(node->getLeft() != nullptr){
+    return y;
+}
 
-        leftChildH = node->getLeft()->getHeight();
 
-    }else{
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment, Compare>::rightRotate(AVLNode<Key, Value, Augment>* z)
+{
 
-        leftChildH = 0;
-    }
-    
-    if(node->getRight() != nullptr){
+    AVLNode<Key, Value, Augment>* y = z->getLeft();
 
-        rightChildH = node->getRight()->getHeight();
+    AVLNode<Key, Value, Augment>* p = z -> getParent();
 
-    }else{
+    // Y and P connection
+    if(p != nullptr){
 
-        rightChildH = 0;
-    }
+        if(p->getLeft() == z){
 
-    if(leftChildH > rightChildH){
+            p->setLeft(y);
 
-        return node->getLeft();
+        }else{
 
-    }
-    else{
+            p->setRight(y);
 
-        return node->getRight();
+        }
     }
-}
-
-
-// RETURNS: height of a node after checking it's rightchild and leftchild
-template<class Key, class Value>
-int AVLTree<Key,Value>::caclHeight(AVLNode<Key, Value>* node)
-{
-    int leftChildH;
+    y->setParent(p);
 
-    int rightChildH;
+    // Z and Y connection 
+    AVLNode<Key, Value, Augment>* oldYRightChild = y->getRight();
 
-    if(node->getLeft() != nullptr){
+    y->setRight(z);
 
-        leftChildH = node->getLeft()->getHeight();
+    z->setParent(y);
 
-    }else{
+    z->setLeft(oldYRightChild);
 
-        leftChildH = 0;
+    if(oldYRightChild != nullptr){
+        oldYRightChild->setParent(z);
     }
-    
-    if(node->getRight() != nullptr){
 
-        rightChildH = node->getRight()->getHeight();
+    Augment::pull(z);
+    Augment::pull(y);
 
-    }else{
-
-        rightChildH = 0;
-    }
-
-    return std::max(leftChildH, rightChildH) + 1;
+    return y;
 }
 
 
 #endif
-
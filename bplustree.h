@@ -0,0 +1,1240 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "node_arena.h"
+
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__AVX2__))
+#include <immintrin.h>
+#endif
+
+/**
+* Counts the keys of a sorted node that are less than (bplusCountLess) or greater than
+* (bplusCountGreater) key. Nodes are small, so every key is looked at: there is no branch to
+* mispredict, and 32- and 64-bit integers are compared a whole vector at a time with SSE2 or
+* AVX2 when the compiler targets them. Other key types take the scalar loop.
+*/
+template<typename T>
+inline unsigned bplusCountLess(const T* keys, unsigned n, const T& key)
+{
+    unsigned count = 0;
+    for(unsigned i = 0; i < n; ++i){
+        count += (keys[i] < key) ? 1 : 0;
+    }
+    return count;
+}
+
+template<typename T>
+inline unsigned bplusCountGreater(const T* keys, unsigned n, const T& key)
+{
+    unsigned count = 0;
+    for(unsigned i = 0; i < n; ++i){
+        count += (key < keys[i]) ? 1 : 0;
+    }
+    return count;
+}
+
+inline unsigned bplusCountLess(const std::int32_t* keys, unsigned n, const std::int32_t& key)
+{
+    unsigned count = 0;
+    unsigned i = 0;
+#if defined(__GNUC__) && defined(__AVX2__)
+    const __m256i k = _mm256_set1_epi32(key);
+    for(; i + 8 <= n; i += 8){
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v))));
+    }
+#elif defined(__GNUC__) && defined(__SSE2__)
+    const __m128i k = _mm_set1_epi32(key);
+    for(; i + 4 <= n; i += 4){
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v))));
+    }
+#endif
+    for(; i < n; ++i){
+        count += (keys[i] < key) ? 1 : 0;
+    }
+    return count;
+}
+
+inline unsigned bplusCountGreater(const std::int32_t* keys, unsigned n, const std::int32_t& key)
+{
+    unsigned count = 0;
+    unsigned i = 0;
+#if defined(__GNUC__) && defined(__AVX2__)
+    const __m256i k = _mm256_set1_epi32(key);
+    for(; i + 8 <= n; i += 8){
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k))));
+    }
+#elif defined(__GNUC__) && defined(__SSE2__)
+    const __m128i k = _mm_set1_epi32(key);
+    for(; i + 4 <= n; i += 4){
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k))));
+    }
+#endif
+    for(; i < n; ++i){
+        count += (key < keys[i]) ? 1 : 0;
+    }
+    return count;
+}
+
+inline unsigned bplusCountLess(const std::int64_t* keys, unsigned n, const std::int64_t& key)
+{
+    unsigned count = 0;
+    unsigned i = 0;
+#if defined(__GNUC__) && defined(__AVX2__)
+    const __m256i k = _mm256_set1_epi64x(key);
+    for(; i + 4 <= n; i += 4){
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v))));
+    }
+#endif
+    for(; i < n; ++i){
+        count += (keys[i] < key) ? 1 : 0;
+    }
+    return count;
+}
+
+inline unsigned bplusCountGreater(const std::int64_t* keys, unsigned n, const std::int64_t& key)
+{
+    unsigned count = 0;
+    unsigned i = 0;
+#if defined(__GNUC__) && defined(__AVX2__)
+    const __m256i k = _mm256_set1_epi64x(key);
+    for(; i + 4 <= n; i += 4){
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k))));
+    }
+#endif
+    for(; i < n; ++i){
+        count += (key < keys[i]) ? 1 : 0;
+    }
+    return count;
+}
+
+/**
+* Finds positions inside one node. Arithmetic keys under std::less use the counting scans
+* above; everything else is ordered by Compare with a binary search, which keeps the number of
+* (possibly expensive) comparisons down.
+*/
+template<typename Key, typename Compare, typename = void>
+struct BPlusKeySearch
+{
+    // number of keys[i] < key, and of keys[i] <= key
+    static unsigned countLess(const Key* keys, unsigned n, const Key& key, const Compare& comp)
+    {
+        unsigned low = 0;
+        while(n > 0){
+            unsigned half = n / 2;
+            if(comp(keys[low + half], key)){
+                low += half + 1;
+                n -= half + 1;
+            }
+            else{
+                n = half;
+            }
+        }
+        return low;
+    }
+
+    static unsigned countNotGreater(const Key* keys, unsigned n, const Key& key, const Compare& comp)
+    {
+        unsigned low = 0;
+        while(n > 0){
+            unsigned half = n / 2;
+            if(!comp(key, keys[low + half])){
+                low += half + 1;
+                n -= half + 1;
+            }
+            else{
+                n = half;
+            }
+        }
+        return low;
+    }
+};
+
+template<typename Key>
+struct BPlusKeySearch<Key, std::less<Key>, typename std::enable_if<std::is_arithmetic<Key>::value>::type>
+{
+    static unsigned countLess(const Key* keys, unsigned n, const Key& key, const std::less<Key>&)
+    {
+        return bplusCountLess(keys, n, key);
+    }
+
+    static unsigned countNotGreater(const Key* keys, unsigned n, const Key& key, const std::less<Key>&)
+    {
+        return n - bplusCountGreater(keys, n, key);
+    }
+};
+
+/**
+* A B+tree with the interface of BinarySearchTree: unique keys, insert() overwrites the value
+* of a key that is already there, iterators walk the elements in key order.
+*
+* Every node holds up to SLOTS keys in an array that fills NODE_KEY_LINES cache lines, so one
+* node visit costs a handful of adjacent (and prefetched) line fills instead of one miss per
+* key, and the tree is only log_{SLOTS/2}(n) levels deep. Inner nodes hold separators and
+* child pointers only; all elements live in the leaves, which are linked in key order so scans
+* never go back up the tree. Leaf keys and values sit in separate arrays, which keeps the keys
+* dense for the search; dereferencing an iterator therefore gives a pair of references.
+*
+* Key and Value have to be default constructible and move assignable. Nodes come from two
+* NodeArenas, one per node kind, so clear() hands memory back in blocks.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class BPlusTree
+{
+protected:
+    struct Leaf;
+
+public:
+    /**
+    * Walks the leaves in either direction; end() is one past the last element and --end() is
+    * the last element. iterator can change the values, const_iterator cannot.
+    */
+    template<bool IsConst>
+    class basic_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key&, typename std::conditional<IsConst, const Value&, Value&>::type> reference;
+
+        // operator-> has to return something that outlives the call, so it hands out a copy
+        // of the reference pair
+        struct pointer
+        {
+            reference ref;
+            const reference* operator->() const { return &ref; }
+        };
+
+        basic_iterator();
+        // iterator -> const_iterator only; as a template it leaves the implicit copy operations alone
+        template<bool C, typename = typename std::enable_if<IsConst && !C>::type>
+        basic_iterator(const basic_iterator<C>& other);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        template<bool RhsConst>
+        bool operator==(const basic_iterator<RhsConst>& rhs) const;
+        template<bool RhsConst>
+        bool operator!=(const basic_iterator<RhsConst>& rhs) const;
+
+        basic_iterator& operator++();
+        basic_iterator operator++(int);
+        basic_iterator& operator--();
+        basic_iterator operator--(int);
+
+    protected:
+        friend class BPlusTree<Key, Value, Compare>;
+        template<bool> friend class basic_iterator;
+        basic_iterator(Leaf* leaf, unsigned slot, const BPlusTree<Key, Value, Compare>* tree);
+        Leaf* leaf_;      // NULL for end()
+        unsigned slot_;
+        const BPlusTree<Key, Value, Compare>* tree_;   // lets --end() find the last leaf
+    };
+
+    typedef basic_iterator<false> iterator;
+    typedef basic_iterator<true> const_iterator;
+
+    BPlusTree();
+    explicit BPlusTree(const Compare& comp);
+    ~BPlusTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    void print() const;
+    bool empty() const;
+    std::size_t size() const;
+    Compare key_comp() const;
+
+    iterator begin();
+    const_iterator begin() const;
+    iterator end();
+    const_iterator end() const;
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key);
+    const_iterator upper_bound(const Key& key) const;
+
+protected:
+    static const std::size_t CACHE_LINE = 64;
+    static const std::size_t NODE_KEY_LINES = 4;
+
+    // Keys per node: as many as fit in NODE_KEY_LINES cache lines, at least 4 and always even
+    // so a full node splits into two legal halves.
+    static const unsigned SLOTS = (NODE_KEY_LINES * CACHE_LINE / sizeof(Key) < 4) ? 4
+                                : static_cast<unsigned>(NODE_KEY_LINES * CACHE_LINE / sizeof(Key)) & ~1u;
+    // Fewest keys a node other than the root may hold.
+    static const unsigned MIN_KEYS = SLOTS / 2;
+    // No tree with 64-bit sizes can get deeper than this with at least MIN_KEYS + 1 children
+    // per inner node.
+    static const unsigned MAX_DEPTH = 48;
+
+    struct NodeBase
+    {
+        unsigned count;   // keys in use
+        bool leaf;
+    };
+
+    struct Inner : NodeBase
+    {
+        Key keys[SLOTS];                  // keys[i] separates children[i] from children[i + 1]
+        NodeBase* children[SLOTS + 1];
+    };
+
+    struct Leaf : NodeBase
+    {
+        Key keys[SLOTS];
+        Value values[SLOTS];
+        Leaf* prev;
+        Leaf* next;
+    };
+
+    typedef BPlusKeySearch<Key, Compare> KeySearch;
+
+    Leaf* createLeaf();
+    Inner* createInner();
+    void destroyNode(NodeBase* node);
+    void destroyAll(NodeBase* node);
+    static void prefetchKeys(const NodeBase* node);
+
+    Leaf* findLeaf(const Key& key) const;
+    unsigned childIndex(const Inner* node, const Key& key) const;
+    void lowerBoundPos(const Key& key, Leaf*& leaf, unsigned& slot) const;
+    void upperBoundPos(const Key& key, Leaf*& leaf, unsigned& slot) const;
+    static void normalize(Leaf*& leaf, unsigned& slot);
+
+    void splitLeaf(Leaf* leaf, unsigned pos, const std::pair<const Key, Value>& keyValuePair, Key& separator, NodeBase*& right);
+    void splitInner(Inner* node, unsigned pos, Key& separator, NodeBase*& right);
+    void rebalanceLeaf(Inner* parent, unsigned index);
+    void rebalanceInner(Inner* parent, unsigned index);
+    static void eraseFromInner(Inner* node, unsigned keyIndex);
+
+    int checkNode(const NodeBase* node, const Key* low, const Key* high, bool isRoot) const;
+
+    NodeBase* root_;
+    Leaf* head_;          // leftmost leaf, where begin() starts
+    Leaf* tail_;          // rightmost leaf, where --end() starts
+    std::size_t size_;
+    NodeArena leafArena_;
+    NodeArena innerArena_;
+    Compare compare_;
+
+private:
+    BPlusTree(const BPlusTree<Key, Value, Compare>&);
+    BPlusTree<Key, Value, Compare>& operator=(const BPlusTree<Key, Value, Compare>&);
+};
+
+/*
+-------------------------------------------------------
+Begin implementations for the BPlusTree::iterator class.
+-------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::basic_iterator() :
+    leaf_(nullptr),
+    slot_(0),
+    tree_(nullptr)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::basic_iterator(Leaf* leaf, unsigned slot, const BPlusTree<Key, Value, Compare>* tree) :
+    leaf_(leaf),
+    slot_(slot),
+    tree_(tree)
+{
+
+}
+
+/**
+* Lets an iterator be used wherever a const_iterator is expected.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+template<bool C, typename>
+BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::basic_iterator(const basic_iterator<C>& other) :
+    leaf_(other.leaf_),
+    slot_(other.slot_),
+    tree_(other.tree_)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare>::template basic_iterator<IsConst>::reference
+BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::operator*() const
+{
+    return reference(leaf_->keys[slot_], leaf_->values[slot_]);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare>::template basic_iterator<IsConst>::pointer
+BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::operator->() const
+{
+    pointer p = { **this };
+    return p;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+template<bool RhsConst>
+bool BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::operator==(const basic_iterator<RhsConst>& rhs) const
+{
+    return leaf_ == rhs.leaf_ && slot_ == rhs.slot_;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+template<bool RhsConst>
+bool BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::operator!=(const basic_iterator<RhsConst>& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare>::template basic_iterator<IsConst>&
+BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::operator++()
+{
+    if(++slot_ == leaf_->count){
+        leaf_ = leaf_->next;
+        slot_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare>::template basic_iterator<IsConst>
+BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::operator++(int)
+{
+    basic_iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare>::template basic_iterator<IsConst>&
+BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::operator--()
+{
+    if(leaf_ == nullptr){
+        leaf_ = tree_->tail_;
+        slot_ = leaf_->count;
+    }
+    else if(slot_ == 0){
+        leaf_ = leaf_->prev;
+        slot_ = leaf_->count;
+    }
+    --slot_;
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename BPlusTree<Key, Value, Compare>::template basic_iterator<IsConst>
+BPlusTree<Key, Value, Compare>::basic_iterator<IsConst>::operator--(int)
+{
+    basic_iterator old = *this;
+    --(*this);
+    return old;
+}
+
+/*
+-----------------------------------------------------
+End implementations for the BPlusTree::iterator class.
+-----------------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the BPlusTree class.
+-----------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+const std::size_t BPlusTree<Key, Value, Compare>::CACHE_LINE;
+
+template<typename Key, typename Value, typename Compare>
+const std::size_t BPlusTree<Key, Value, Compare>::NODE_KEY_LINES;
+
+template<typename Key, typename Value, typename Compare>
+const unsigned BPlusTree<Key, Value, Compare>::SLOTS;
+
+template<typename Key, typename Value, typename Compare>
+const unsigned BPlusTree<Key, Value, Compare>::MIN_KEYS;
+
+template<typename Key, typename Value, typename Compare>
+const unsigned BPlusTree<Key, Value, Compare>::MAX_DEPTH;
+
+template<typename Key, typename Value, typename Compare>
+BPlusTree<Key, Value, Compare>::BPlusTree() :
+    root_(nullptr),
+    head_(nullptr),
+    tail_(nullptr),
+    size_(0),
+    compare_()
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+BPlusTree<Key, Value, Compare>::BPlusTree(const Compare& comp) :
+    root_(nullptr),
+    head_(nullptr),
+    tail_(nullptr),
+    size_(0),
+    compare_(comp)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+BPlusTree<Key, Value, Compare>::~BPlusTree()
+{
+    clear();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t BPlusTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+Compare BPlusTree<Key, Value, Compare>::key_comp() const
+{
+    return compare_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator
+BPlusTree<Key, Value, Compare>::begin()
+{
+    return iterator(head_, 0, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::const_iterator
+BPlusTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(head_, 0, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator
+BPlusTree<Key, Value, Compare>::end()
+{
+    return iterator(nullptr, 0, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::const_iterator
+BPlusTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(nullptr, 0, this);
+}
+
+/**
+* Returns an iterator to the element with the given key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator
+BPlusTree<Key, Value, Compare>::find(const Key& key)
+{
+    Leaf* leaf;
+    unsigned slot;
+    lowerBoundPos(key, leaf, slot);
+    if(leaf == nullptr || compare_(key, leaf->keys[slot])){
+        return end();
+    }
+    return iterator(leaf, slot, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::const_iterator
+BPlusTree<Key, Value, Compare>::find(const Key& key) const
+{
+    Leaf* leaf;
+    unsigned slot;
+    lowerBoundPos(key, leaf, slot);
+    if(leaf == nullptr || compare_(key, leaf->keys[slot])){
+        return end();
+    }
+    return const_iterator(leaf, slot, this);
+}
+
+/**
+* Returns an iterator to the first element whose key is not less than key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator
+BPlusTree<Key, Value, Compare>::lower_bound(const Key& key)
+{
+    Leaf* leaf;
+    unsigned slot;
+    lowerBoundPos(key, leaf, slot);
+    return iterator(leaf, slot, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::const_iterator
+BPlusTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    Leaf* leaf;
+    unsigned slot;
+    lowerBoundPos(key, leaf, slot);
+    return const_iterator(leaf, slot, this);
+}
+
+/**
+* Returns an iterator to the first element whose key is greater than key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator
+BPlusTree<Key, Value, Compare>::upper_bound(const Key& key)
+{
+    Leaf* leaf;
+    unsigned slot;
+    upperBoundPos(key, leaf, slot);
+    return iterator(leaf, slot, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::const_iterator
+BPlusTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    Leaf* leaf;
+    unsigned slot;
+    upperBoundPos(key, leaf, slot);
+    return const_iterator(leaf, slot, this);
+}
+
+/**
+* Puts keyValuePair into the tree, overwriting the value if the key is already present. A full
+* leaf is split in two and the separator goes up into the parent, which may split in turn;
+* the tree only grows in height when the root splits.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+
+    if(root_ == nullptr){
+        Leaf* leaf = createLeaf();
+        leaf->keys[0] = key;
+        leaf->values[0] = keyValuePair.second;
+        leaf->count = 1;
+        root_ = head_ = tail_ = leaf;
+        size_ = 1;
+        return;
+    }
+
+    // descend, remembering the way back up for the splits
+    Inner* path[MAX_DEPTH];
+    unsigned slots[MAX_DEPTH];
+    unsigned depth = 0;
+    NodeBase* node = root_;
+    while(!node->leaf){
+        Inner* inner = static_cast<Inner*>(node);
+        unsigned i = childIndex(inner, key);
+        path[depth] = inner;
+        slots[depth] = i;
+        ++depth;
+        node = inner->children[i];
+        prefetchKeys(node);
+    }
+
+    Leaf* leaf = static_cast<Leaf*>(node);
+    unsigned pos = KeySearch::countLess(leaf->keys, leaf->count, key, compare_);
+    if(pos < leaf->count && !compare_(key, leaf->keys[pos])){
+        leaf->values[pos] = keyValuePair.second;
+        return;
+    }
+    ++size_;
+
+    if(leaf->count < SLOTS){
+        for(unsigned i = leaf->count; i > pos; --i){
+            leaf->keys[i] = std::move(leaf->keys[i - 1]);
+            leaf->values[i] = std::move(leaf->values[i - 1]);
+        }
+        leaf->keys[pos] = key;
+        leaf->values[pos] = keyValuePair.second;
+        ++leaf->count;
+        return;
+    }
+
+    Key separator;
+    NodeBase* right;
+    splitLeaf(leaf, pos, keyValuePair, separator, right);
+
+    // hand the new right sibling to the parents until one has room for it
+    while(depth > 0){
+        --depth;
+        Inner* parent = path[depth];
+        unsigned i = slots[depth];
+        if(parent->count < SLOTS){
+            for(unsigned j = parent->count; j > i; --j){
+                parent->keys[j] = std::move(parent->keys[j - 1]);
+                parent->children[j + 1] = parent->children[j];
+            }
+            parent->keys[i] = std::move(separator);
+            parent->children[i + 1] = right;
+            ++parent->count;
+            return;
+        }
+        splitInner(parent, i, separator, right);
+    }
+
+    Inner* root = createInner();
+    root->keys[0] = std::move(separator);
+    root->children[0] = root_;
+    root->children[1] = right;
+    root->count = 1;
+    root_ = root;
+}
+
+/**
+* Splits a full leaf while inserting keyValuePair at pos. The upper half moves to a new leaf
+* linked in after it; separator receives that leaf's first key and right the leaf itself.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::splitLeaf(Leaf* leaf, unsigned pos, const std::pair<const Key, Value>& keyValuePair, Key& separator, NodeBase*& right)
+{
+    Leaf* sibling = createLeaf();
+    const unsigned keep = SLOTS / 2;
+    for(unsigned i = keep; i < SLOTS; ++i){
+        sibling->keys[i - keep] = std::move(leaf->keys[i]);
+        sibling->values[i - keep] = std::move(leaf->values[i]);
+    }
+    sibling->count = SLOTS - keep;
+    leaf->count = keep;
+
+    Leaf* target = (pos <= keep) ? leaf : sibling;
+    unsigned at = (pos <= keep) ? pos : pos - keep;
+    for(unsigned i = target->count; i > at; --i){
+        target->keys[i] = std::move(target->keys[i - 1]);
+        target->values[i] = std::move(target->values[i - 1]);
+    }
+    target->keys[at] = keyValuePair.first;
+    target->values[at] = keyValuePair.second;
+    ++target->count;
+
+    sibling->prev = leaf;
+    sibling->next = leaf->next;
+    if(leaf->next != nullptr){
+        leaf->next->prev = sibling;
+    }
+    else{
+        tail_ = sibling;
+    }
+    leaf->next = sibling;
+
+    separator = sibling->keys[0];
+    right = sibling;
+}
+
+/**
+* Splits a full inner node while adding separator/right after child pos. On return separator
+* holds the middle key, which moves up, and right the new node with everything after it.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::splitInner(Inner* node, unsigned pos, Key& separator, NodeBase*& right)
+{
+    // lay the SLOTS + 1 keys and SLOTS + 2 children out in order first
+    Key keys[SLOTS + 1];
+    NodeBase* children[SLOTS + 2];
+    for(unsigned i = 0, j = 0; i <= SLOTS; ++i){
+        keys[i] = (i == pos) ? std::move(separator) : std::move(node->keys[j++]);
+    }
+    for(unsigned i = 0, j = 0; i <= SLOTS + 1; ++i){
+        children[i] = (i == pos + 1) ? right : node->children[j++];
+    }
+
+    const unsigned mid = (SLOTS + 1) / 2;
+    Inner* sibling = createInner();
+    for(unsigned i = 0; i < mid; ++i){
+        node->keys[i] = std::move(keys[i]);
+        node->children[i] = children[i];
+    }
+    node->children[mid] = children[mid];
+    node->count = mid;
+
+    for(unsigned i = mid + 1; i <= SLOTS; ++i){
+        sibling->keys[i - mid - 1] = std::move(keys[i]);
+        sibling->children[i - mid - 1] = children[i];
+    }
+    sibling->children[SLOTS - mid] = children[SLOTS + 1];
+    sibling->count = SLOTS - mid;
+
+    separator = std::move(keys[mid]);
+    right = sibling;
+}
+
+/**
+* Removes the element with the given key, if any. A leaf left with fewer than MIN_KEYS keys
+* borrows one from a sibling that can spare it, or else is merged with one; merges take a
+* separator out of the parent, which may then have to do the same.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if(root_ == nullptr){
+        return;
+    }
+
+    Inner* path[MAX_DEPTH];
+    unsigned slots[MAX_DEPTH];
+    unsigned depth = 0;
+    NodeBase* node = root_;
+    while(!node->leaf){
+        Inner* inner = static_cast<Inner*>(node);
+        unsigned i = childIndex(inner, key);
+        path[depth] = inner;
+        slots[depth] = i;
+        ++depth;
+        node = inner->children[i];
+        prefetchKeys(node);
+    }
+
+    Leaf* leaf = static_cast<Leaf*>(node);
+    unsigned pos = KeySearch::countLess(leaf->keys, leaf->count, key, compare_);
+    if(pos == leaf->count || compare_(key, leaf->keys[pos])){
+        return;
+    }
+    for(unsigned i = pos + 1; i < leaf->count; ++i){
+        leaf->keys[i - 1] = std::move(leaf->keys[i]);
+        leaf->values[i - 1] = std::move(leaf->values[i]);
+    }
+    --leaf->count;
+    --size_;
+
+    if(depth == 0){
+        // the root may shrink to nothing
+        if(leaf->count == 0){
+            destroyNode(leaf);
+            root_ = nullptr;
+            head_ = tail_ = nullptr;
+        }
+        return;
+    }
+    if(leaf->count >= MIN_KEYS){
+        return;
+    }
+
+    --depth;
+    rebalanceLeaf(path[depth], slots[depth]);
+    while(depth > 0 && path[depth]->count < MIN_KEYS){
+        --depth;
+        rebalanceInner(path[depth], slots[depth]);
+    }
+
+    // a root with a single child hands the root over to it
+    if(!root_->leaf && root_->count == 0){
+        Inner* old = static_cast<Inner*>(root_);
+        root_ = old->children[0];
+        destroyNode(old);
+    }
+}
+
+/**
+* Refills the leaf parent->children[index], which is one key short.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::rebalanceLeaf(Inner* parent, unsigned index)
+{
+    Leaf* leaf = static_cast<Leaf*>(parent->children[index]);
+    Leaf* left = (index > 0) ? static_cast<Leaf*>(parent->children[index - 1]) : nullptr;
+    Leaf* right = (index < parent->count) ? static_cast<Leaf*>(parent->children[index + 1]) : nullptr;
+
+    if(left != nullptr && left->count > MIN_KEYS){
+        for(unsigned i = leaf->count; i > 0; --i){
+            leaf->keys[i] = std::move(leaf->keys[i - 1]);
+            leaf->values[i] = std::move(leaf->values[i - 1]);
+        }
+        --left->count;
+        leaf->keys[0] = std::move(left->keys[left->count]);
+        leaf->values[0] = std::move(left->values[left->count]);
+        ++leaf->count;
+        parent->keys[index - 1] = leaf->keys[0];
+        return;
+    }
+    if(right != nullptr && right->count > MIN_KEYS){
+        leaf->keys[leaf->count] = std::move(right->keys[0]);
+        leaf->values[leaf->count] = std::move(right->values[0]);
+        ++leaf->count;
+        for(unsigned i = 1; i < right->count; ++i){
+            right->keys[i - 1] = std::move(right->keys[i]);
+            right->values[i - 1] = std::move(right->values[i]);
+        }
+        --right->count;
+        parent->keys[index] = right->keys[0];
+        return;
+    }
+
+    // neither sibling can spare a key: merge the right one of the pair into the left one
+    if(left == nullptr){
+        left = leaf;
+        leaf = right;
+        ++index;
+    }
+    for(unsigned i = 0; i < leaf->count; ++i){
+        left->keys[left->count + i] = std::move(leaf->keys[i]);
+        left->values[left->count + i] = std::move(leaf->values[i]);
+    }
+    left->count += leaf->count;
+    left->next = leaf->next;
+    if(leaf->next != nullptr){
+        leaf->next->prev = left;
+    }
+    else{
+        tail_ = left;
+    }
+    destroyNode(leaf);
+    eraseFromInner(parent, index - 1);
+}
+
+/**
+* Same as rebalanceLeaf for the inner node parent->children[index]. Separators rotate through
+* the parent when borrowing, and come down into the merged node when merging.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::rebalanceInner(Inner* parent, unsigned index)
+{
+    Inner* node = static_cast<Inner*>(parent->children[index]);
+    Inner* left = (index > 0) ? static_cast<Inner*>(parent->children[index - 1]) : nullptr;
+    Inner* right = (index < parent->count) ? static_cast<Inner*>(parent->children[index + 1]) : nullptr;
+
+    if(left != nullptr && left->count > MIN_KEYS){
+        node->children[node->count + 1] = node->children[node->count];
+        for(unsigned i = node->count; i > 0; --i){
+            node->keys[i] = std::move(node->keys[i - 1]);
+            node->children[i] = node->children[i - 1];
+        }
+        node->keys[0] = std::move(parent->keys[index - 1]);
+        node->children[0] = left->children[left->count];
+        ++node->count;
+        --left->count;
+        parent->keys[index - 1] = std::move(left->keys[left->count]);
+        return;
+    }
+    if(right != nullptr && right->count > MIN_KEYS){
+        node->keys[node->count] = std::move(parent->keys[index]);
+        node->children[node->count + 1] = right->children[0];
+        ++node->count;
+        parent->keys[index] = std::move(right->keys[0]);
+        for(unsigned i = 1; i < right->count; ++i){
+            right->keys[i - 1] = std::move(right->keys[i]);
+        }
+        for(unsigned i = 1; i <= right->count; ++i){
+            right->children[i - 1] = right->children[i];
+        }
+        --right->count;
+        return;
+    }
+
+    if(left == nullptr){
+        left = node;
+        node = right;
+        ++index;
+    }
+    left->keys[left->count] = std::move(parent->keys[index - 1]);
+    for(unsigned i = 0; i < node->count; ++i){
+        left->keys[left->count + 1 + i] = std::move(node->keys[i]);
+    }
+    for(unsigned i = 0; i <= node->count; ++i){
+        left->children[left->count + 1 + i] = node->children[i];
+    }
+    left->count += node->count + 1;
+    destroyNode(node);
+    eraseFromInner(parent, index - 1);
+}
+
+/**
+* Takes keys[keyIndex] and the child to its right out of an inner node.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::eraseFromInner(Inner* node, unsigned keyIndex)
+{
+    for(unsigned i = keyIndex + 1; i < node->count; ++i){
+        node->keys[i - 1] = std::move(node->keys[i]);
+        node->children[i] = node->children[i + 1];
+    }
+    --node->count;
+}
+
+/**
+* Removes every element and hands the node memory back to the arenas in whole blocks.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::clear()
+{
+    if(root_ != nullptr && !(std::is_trivially_destructible<Key>::value && std::is_trivially_destructible<Value>::value)){
+        destroyAll(root_);
+    }
+    leafArena_.release();
+    innerArena_.release();
+    root_ = nullptr;
+    head_ = tail_ = nullptr;
+    size_ = 0;
+}
+
+/**
+* Runs the destructors of node and everything below it. The tree is only O(log n) deep, so
+* recursing is fine here.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::destroyAll(NodeBase* node)
+{
+    if(node->leaf){
+        static_cast<Leaf*>(node)->~Leaf();
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for(unsigned i = 0; i <= inner->count; ++i){
+        destroyAll(inner->children[i]);
+    }
+    inner->~Inner();
+}
+
+/**
+* Checks the B+tree invariants: sorted keys within the separators' bounds, enough keys in
+* every node but the root, all leaves at the same depth, and a leaf chain matching the tree.
+*/
+template<typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::isBalanced() const
+{
+    if(root_ == nullptr){
+        return head_ == nullptr && tail_ == nullptr && size_ == 0;
+    }
+    if(checkNode(root_, nullptr, nullptr, true) < 0){
+        return false;
+    }
+
+    std::size_t count = 0;
+    const Leaf* prev = nullptr;
+    for(const Leaf* leaf = head_; leaf != nullptr; leaf = leaf->next){
+        if(leaf->prev != prev){
+            return false;
+        }
+        count += leaf->count;
+        prev = leaf;
+    }
+    return prev == tail_ && count == size_;
+}
+
+/**
+* Returns the height of node's subtree, or -1 if something is off. low and high, if set, bound
+* the keys from below (inclusive) and above (exclusive).
+*/
+template<typename Key, typename Value, typename Compare>
+int BPlusTree<Key, Value, Compare>::checkNode(const NodeBase* node, const Key* low, const Key* high, bool isRoot) const
+{
+    if(node->count > SLOTS || (!isRoot && node->count < MIN_KEYS) || node->count == 0){
+        return -1;
+    }
+    const Key* keys = node->leaf ? static_cast<const Leaf*>(node)->keys : static_cast<const Inner*>(node)->keys;
+    for(unsigned i = 0; i < node->count; ++i){
+        if((i > 0 && !compare_(keys[i - 1], keys[i])) || (low != nullptr && compare_(keys[i], *low))
+           || (high != nullptr && !compare_(keys[i], *high))){
+            return -1;
+        }
+    }
+    if(node->leaf){
+        return 1;
+    }
+
+    const Inner* inner = static_cast<const Inner*>(node);
+    int height = -1;
+    for(unsigned i = 0; i <= inner->count; ++i){
+        const Key* childLow = (i == 0) ? low : &inner->keys[i - 1];
+        const Key* childHigh = (i == inner->count) ? high : &inner->keys[i];
+        int h = checkNode(inner->children[i], childLow, childHigh, false);
+        if(h < 0 || (height >= 0 && h != height)){
+            return -1;
+        }
+        height = h;
+    }
+    return height + 1;
+}
+
+/**
+* Prints the keys of every node, one level per line, then the elements in order.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::print() const
+{
+    if(root_ == nullptr){
+        std::cout << "<empty tree>" << std::endl;
+        return;
+    }
+    std::vector<const NodeBase*> level(1, root_);
+    while(!level.empty()){
+        std::vector<const NodeBase*> below;
+        for(std::size_t n = 0; n < level.size(); ++n){
+            const NodeBase* node = level[n];
+            const Key* keys = node->leaf ? static_cast<const Leaf*>(node)->keys : static_cast<const Inner*>(node)->keys;
+            std::cout << "[";
+            for(unsigned i = 0; i < node->count; ++i){
+                std::cout << (i > 0 ? " " : "") << keys[i];
+            }
+            std::cout << "] ";
+            if(!node->leaf){
+                const Inner* inner = static_cast<const Inner*>(node);
+                below.insert(below.end(), inner->children, inner->children + inner->count + 1);
+            }
+        }
+        std::cout << std::endl;
+        level.swap(below);
+    }
+    for(const_iterator it = begin(); it != end(); ++it){
+        std::cout << '(' << it->first << ", " << it->second << ") ";
+    }
+    std::cout << std::endl;
+}
+
+/**
+* Position of the first element not less than key, as a leaf and slot (NULL leaf for none).
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::lowerBoundPos(const Key& key, Leaf*& leaf, unsigned& slot) const
+{
+    leaf = findLeaf(key);
+    slot = (leaf == nullptr) ? 0 : KeySearch::countLess(leaf->keys, leaf->count, key, compare_);
+    normalize(leaf, slot);
+}
+
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::upperBoundPos(const Key& key, Leaf*& leaf, unsigned& slot) const
+{
+    leaf = findLeaf(key);
+    slot = (leaf == nullptr) ? 0 : KeySearch::countNotGreater(leaf->keys, leaf->count, key, compare_);
+    normalize(leaf, slot);
+}
+
+/**
+* A position one past the end of a leaf is the start of the next one.
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::normalize(Leaf*& leaf, unsigned& slot)
+{
+    if(leaf != nullptr && slot == leaf->count){
+        leaf = leaf->next;
+        slot = 0;
+    }
+}
+
+/**
+* Descends to the leaf whose key range covers key.
+*/
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Leaf* BPlusTree<Key, Value, Compare>::findLeaf(const Key& key) const
+{
+    NodeBase* node = root_;
+    if(node == nullptr){
+        return nullptr;
+    }
+    while(!node->leaf){
+        const Inner* inner = static_cast<const Inner*>(node);
+        node = inner->children[childIndex(inner, key)];
+        prefetchKeys(node);
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* The child of node to descend into for key: the one after the last separator <= key.
+*/
+template<typename Key, typename Value, typename Compare>
+inline unsigned BPlusTree<Key, Value, Compare>::childIndex(const Inner* node, const Key& key) const
+{
+    return KeySearch::countNotGreater(node->keys, node->count, key, compare_);
+}
+
+/**
+* Starts loading every cache line of node's key array, so the scan of the node does not wait
+* for them one after the other.
+*/
+template<typename Key, typename Value, typename Compare>
+inline void BPlusTree<Key, Value, Compare>::prefetchKeys(const NodeBase* node)
+{
+#if defined(__GNUC__)
+    const char* p = reinterpret_cast<const char*>(node);
+    for(std::size_t line = 0; line <= NODE_KEY_LINES; ++line){
+        __builtin_prefetch(p + line * CACHE_LINE);
+    }
+#else
+    (void)node;
+#endif
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Leaf* BPlusTree<Key, Value, Compare>::createLeaf()
+{
+    Leaf* leaf = new(leafArena_.allocate(sizeof(Leaf))) Leaf();
+    leaf->count = 0;
+    leaf->leaf = true;
+    leaf->prev = nullptr;
+    leaf->next = nullptr;
+    return leaf;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Inner* BPlusTree<Key, Value, Compare>::createInner()
+{
+    Inner* inner = new(innerArena_.allocate(sizeof(Inner))) Inner();
+    inner->count = 0;
+    inner->leaf = false;
+    return inner;
+}
+
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::destroyNode(NodeBase* node)
+{
+    if(node->leaf){
+        static_cast<Leaf*>(node)->~Leaf();
+        leafArena_.deallocate(node);
+    }
+    else{
+        static_cast<Inner*>(node)->~Inner();
+        innerArena_.deallocate(node);
+    }
+}
+
+/*
+---------------------------------------------
+End implementations for the BPlusTree class.
+---------------------------------------------
+*/
+
+#endif
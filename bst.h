@@ -4,21 +4,138 @@
 #include <iostream>
 #include <exception>
 #include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <utility>
+#include <memory>
+#include <new>
+#include <string>
+#include <system_error>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "key_compare.h"
+#include "node_arena.h"
+
+/**
+ * How an insertion builds its item, passed through the
+ * virtual BinarySearchTree::insertItem() so that the
+ * templated insert/emplace family creates the node type
+ * of the tree it is actually called on.
+ *
+ * key() is the key to look for, or NULL when it is only
+ * known once the item exists (emplace). make() builds
+ * the item and is called from the node's constructor, so
+ * the item is still constructed inside the node. assign()
+ * stores the new value into an item that is already
+ * there; it does nothing for insertions that leave
+ * existing values alone.
+ */
+template <typename Key, typename Value>
+class ItemSource
+{
+public:
+    virtual const Key* key() const = 0;
+    virtual std::pair<const Key, Value> make() = 0;
+    virtual void assign(Value& value) = 0;
+
+protected:
+    ~ItemSource() {}
+};
+
+/**
+ * An ItemSource made of two function objects, see
+ * makeItemSource().
+ */
+template <typename Key, typename Value, typename Make, typename Assign>
+class FunctionItemSource : public ItemSource<Key, Value>
+{
+public:
+    FunctionItemSource(const Key* key, Make make, Assign assign);
+
+    const Key* key() const;
+    std::pair<const Key, Value> make();
+    void assign(Value& value);
+
+private:
+    const Key* key_;
+    Make make_;
+    Assign assign_;
+};
+
+template<typename Key, typename Value, typename Make, typename Assign>
+FunctionItemSource<Key, Value, Make, Assign>::FunctionItemSource(const Key* key, Make make, Assign assign) :
+    key_(key),
+    make_(make),
+    assign_(assign)
+{
+
+}
+
+template<typename Key, typename Value, typename Make, typename Assign>
+const Key* FunctionItemSource<Key, Value, Make, Assign>::key() const
+{
+    return key_;
+}
+
+template<typename Key, typename Value, typename Make, typename Assign>
+std::pair<const Key, Value> FunctionItemSource<Key, Value, Make, Assign>::make()
+{
+    return make_();
+}
+
+template<typename Key, typename Value, typename Make, typename Assign>
+void FunctionItemSource<Key, Value, Make, Assign>::assign(Value& value)
+{
+    assign_(value);
+}
+
+/**
+* Wraps make, which returns the new item, and assign, which is called with the value of an
+* existing one, into an ItemSource. Both usually are lambdas capturing the caller's arguments
+* by reference.
+*/
+template<typename Key, typename Value, typename Make, typename Assign>
+FunctionItemSource<Key, Value, Make, Assign> makeItemSource(const Key* key, Make make, Assign assign)
+{
+    return FunctionItemSource<Key, Value, Make, Assign>(key, make, assign);
+}
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are plain inline
+ * loads. Node types for other kinds of search trees,
+ * such as AVL trees, hide them with versions that
+ * return the derived node type instead of overriding
+ * them, so walking the tree never goes through a vtable.
+ * Nodes have no vtable at all: the tree always destroys
+ * a node through its real type.
+ *
+ * If BST_THREADED is defined before this header is
+ * included, every node also links to its in-order
+ * neighbours. The trees keep those links up to date, and
+ * iterators follow them, so ++ and -- are O(1) in the
+ * worst case and a scan is a plain pointer chase.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    // Builds the item in place from any arguments std::pair<const Key, Value> accepts.
+    template<typename... ItemArgs>
+    Node(Node<Key, Value>* parent, ItemArgs&&... itemArgs);
+    Node(Node<Key, Value>* parent, ItemSource<Key, Value>& source);
+    // The destructor does not need to do anything since the pointers inside of a node
+    // are only used as references to existing nodes. It is left implicit so that a node
+    // holding trivially destructible items is itself trivially destructible, which lets
+    // clear() drop whole arena blocks without visiting the nodes.
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,20 +143,40 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
+
+#ifdef BST_THREADED
+    Node<Key, Value>* getPrev() const;
+    Node<Key, Value>* getNext() const;
+    void setPrev(Node<Key, Value>* prev);
+    void setNext(Node<Key, Value>* next);
+#endif
 
 protected:
+    // The two low bits of the parent link are free since nodes are at least pointer aligned.
+    // A plain Node leaves them zero, derived nodes can keep a small tag there (see AVLNode).
+    static const std::uintptr_t TAG_MASK = 3;
+    static_assert(alignof(Node<Key, Value>*) > TAG_MASK, "parent link needs two spare low bits");
+
+    unsigned getTag() const;
+    void setTag(unsigned tag);
+
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
+    std::uintptr_t parent_;
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
+#ifdef BST_THREADED
+    Node<Key, Value>* prev_;   // in-order neighbours, NULL at either end
+    Node<Key, Value>* next_;
+#endif
 };
 
 /*
@@ -54,24 +191,54 @@ protected:
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
     item_(key, value),
-    parent_(parent),
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
+    left_(NULL),
+    right_(NULL)
+#ifdef BST_THREADED
+    , prev_(NULL),
+    next_(NULL)
+#endif
+{
+
+}
+
+/**
+* Constructor that forwards its arguments to the item, so keys and values can be moved or
+* built directly inside the node.
+*/
+template<typename Key, typename Value>
+template<typename... ItemArgs>
+Node<Key, Value>::Node(Node<Key, Value>* parent, ItemArgs&&... itemArgs) :
+    item_(std::forward<ItemArgs>(itemArgs)...),
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
     left_(NULL),
     right_(NULL)
+#ifdef BST_THREADED
+    , prev_(NULL),
+    next_(NULL)
+#endif
 {
 
 }
 
 /**
-* Destructor, which does not need to do anything since the pointers inside of a node
-* are only used as references to existing nodes. The nodes pointed to by parent/left/right
-* are freed within the deleteAll() helper method in the BinarySearchTree.
+* Constructor that has source build the item, see BinarySearchTree::insertItem().
 */
 template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+Node<Key, Value>::Node(Node<Key, Value>* parent, ItemSource<Key, Value>& source) :
+    item_(source.make()),
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
+    left_(NULL),
+    right_(NULL)
+#ifdef BST_THREADED
+    , prev_(NULL),
+    next_(NULL)
+#endif
 {
 
 }
 
+
 /**
 * A const getter for the item.
 */
@@ -118,39 +285,39 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getParent() const
+inline Node<Key, Value>* Node<Key, Value>::getParent() const
 {
-    return parent_;
+    return reinterpret_cast<Node<Key, Value>*>(parent_ & ~TAG_MASK);
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getLeft() const
+inline Node<Key, Value>* Node<Key, Value>::getLeft() const
 {
     return left_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getRight() const
+inline Node<Key, Value>* Node<Key, Value>::getRight() const
 {
     return right_;
 }
 
 /**
-* A setter for setting the parent of a node.
+* A setter for setting the parent of a node. The tag bits stay with the node.
 */
 template<typename Key, typename Value>
-void Node<Key, Value>::setParent(Node<Key, Value>* parent)
+inline void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 {
-    parent_ = parent;
+    parent_ = reinterpret_cast<std::uintptr_t>(parent) | (parent_ & TAG_MASK);
 }
 
 /**
@@ -171,6 +338,24 @@ void Node<Key, Value>::setRight(Node<Key, Value>* right)
     right_ = right;
 }
 
+/**
+* A getter for the two tag bits stored alongside the parent link.
+*/
+template<typename Key, typename Value>
+inline unsigned Node<Key, Value>::getTag() const
+{
+    return static_cast<unsigned>(parent_ & TAG_MASK);
+}
+
+/**
+* A setter for the two tag bits stored alongside the parent link.
+*/
+template<typename Key, typename Value>
+inline void Node<Key, Value>::setTag(unsigned tag)
+{
+    parent_ = (parent_ & ~TAG_MASK) | (static_cast<std::uintptr_t>(tag) & TAG_MASK);
+}
+
 /**
 * A setter for the value of a node.
 */
@@ -180,59 +365,229 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+template<typename Key, typename Value>
+void Node<Key, Value>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
+#ifdef BST_THREADED
+/**
+* Getters and setters for the in-order neighbour links.
+*/
+template<typename Key, typename Value>
+inline Node<Key, Value>* Node<Key, Value>::getPrev() const
+{
+    return prev_;
+}
+
+template<typename Key, typename Value>
+inline Node<Key, Value>* Node<Key, Value>::getNext() const
+{
+    return next_;
+}
+
+template<typename Key, typename Value>
+inline void Node<Key, Value>::setPrev(Node<Key, Value>* prev)
+{
+    prev_ = prev;
+}
+
+template<typename Key, typename Value>
+inline void Node<Key, Value>::setNext(Node<Key, Value>* next)
+{
+    next_ = next;
+}
+#endif
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+template <typename Key, typename Value, typename Compare>
+class FrozenTree;
+
 /**
-* A templated unbalanced binary search tree.
+* A templated unbalanced binary search tree. Keys are ordered by Compare, a strict weak
+* ordering that defaults to operator<; keys are equal if neither is less than the other.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Compare& comp);
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual void insert(std::pair<const Key, Value>&& keyValuePair);
     virtual void remove(const Key& key); //TODO
-    void clear(); //TODO
+    virtual void clear(); //TODO
     bool isBalanced() const; //TODO
     void print() const;
     bool empty() const;
+    std::size_t size() const;
+    Compare key_comp() const;
+    ArenaStats getAllocatorStats() const;
+    // Off by default. When on, clear() and the destructor run the item destructors of large
+    // trees on several threads; see destroyItems().
+    void setParallelTeardown(bool enabled);
+
+    // Read-only copy for lookup-heavy use, laid out for the cache; see FrozenTree.
+    FrozenTree<Key, Value, Compare> freeze() const;
+    // Binary image of the contents for AVLTree::load() or FrozenTree::map().
+    void save(const std::string& path) const;
 public:
     /**
-    * An internal iterator class for traversing the contents of the BST.
+    * An internal iterator class for traversing the contents of the BST in either direction.
+    * iterator gives mutable access to the values and converts to const_iterator, which does
+    * not. end() is one past the last item and --end() is the last item, so both also work
+    * with std::reverse_iterator and the standard algorithms.
     */
-    class iterator  // TODO
+    template<bool IsConst>
+    class basic_iterator  // TODO
     {
     public:
-        iterator();
-
-        std::pair<const Key,Value>& operator*() const;
-        std::pair<const Key,Value>* operator->() const;
-
-        bool operator==(const iterator& rhs) const;
-        bool operator!=(const iterator& rhs) const;
-
-        iterator& operator++();
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<IsConst, const value_type&, value_type&>::type reference;
+
+        basic_iterator();
+        // iterator -> const_iterator only; as a template it leaves the implicit copy operations alone
+        template<bool C, typename = typename std::enable_if<IsConst && !C>::type>
+        basic_iterator(const basic_iterator<C>& other);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        template<bool RhsConst>
+        bool operator==(const basic_iterator<RhsConst>& rhs) const;
+        template<bool RhsConst>
+        bool operator!=(const basic_iterator<RhsConst>& rhs) const;
+
+        basic_iterator& operator++();
+        basic_iterator operator++(int);
+        basic_iterator& operator--();
+        basic_iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class BinarySearchTree<Key, Value, Compare>;
+        template<bool> friend class basic_iterator;
+        basic_iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Compare>* tree);
         Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value, Compare>* tree_;   // lets --end() find the last item
     };
 
+    typedef basic_iterator<false> iterator;
+    typedef basic_iterator<true> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
-    iterator begin() const;
-    iterator end() const;
-    iterator find(const Key& key) const;
+    iterator begin();
+    const_iterator begin() const;
+    const_iterator cbegin() const;
+    iterator end();
+    const_iterator end() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin();
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator crbegin() const;
+    reverse_iterator rend();
+    const_reverse_iterator rend() const;
+    const_reverse_iterator crend() const;
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    std::size_t count(const Key& key) const;
+
+    // Heterogeneous lookups, only there when Compare declares is_transparent (std::less<>
+    // for instance). The key is compared with the stored keys as given, so looking up a
+    // std::string tree by string_view or const char* does not build a temporary Key.
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::size_t count(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator upper_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const K& key);
+
+    // Ordered lookups. floor() is the last element with a key <= key, ceiling() the first one
+    // with a key >= key; both return end() if there is none.
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key);
+    const_iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key);
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key);
+    const_iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key);
+    const_iterator ceiling(const Key& key) const;
+
+    // Calls fn(item) for every item with first <= key < last, in key order.
+    template<typename Function>
+    void for_each_in_range(const Key& first, const Key& last, Function fn);
+    template<typename Function>
+    void for_each_in_range(const Key& first, const Key& last, Function fn) const;
+
+    // Batched find: out[i] = find(first[i]) for every key in [first, last). The lookups are
+    // interleaved so that the cache misses of one overlap with the work of the others; worth
+    // it from a few dozen keys on in trees that do not fit in cache. out must be random access.
+    template<typename RandomIt, typename OutIt>
+    void find_batch(RandomIt first, RandomIt last, OutIt out);
+    template<typename RandomIt, typename OutIt>
+    void find_batch(RandomIt first, RandomIt last, OutIt out) const;
+
+    // In-place insertion. The item is constructed inside the node, so nothing is copied
+    // unless the caller passes an lvalue. emplace and try_emplace leave an existing value
+    // alone, insert_or_assign overwrites it; the bool is true if a new node was linked in.
+    // try_emplace does not touch its arguments when the key is already present, and
+    // operator[] default-constructs the value of a missing key. These and the hinted
+    // inserts below all go through the virtual insertItem(), so derived trees keep their
+    // invariants even when called through a BinarySearchTree reference.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& value);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& value);
+    Value& operator[](const Key& key);
+    Value& operator[](Key&& key);
+
+    // Hinted insertion, same results as insert/emplace. hint is the element the new one is
+    // expected to end up right before, or end() to append. A good hint links the node in
+    // after one or two comparisons instead of a descent from the root; a bad one only costs
+    // those comparisons. Plain inserts already try the end() hint, so sorted input is cheap.
+    iterator insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator insert(const_iterator hint, std::pair<const Key, Value>&& keyValuePair);
+    template<typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args);
 
 protected:
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
     Node<Key, Value> *getSmallestNode() const;  // TODO
+    Node<Key, Value>* getLargestNode() const;
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
@@ -240,15 +595,105 @@ protected:
     // Provided helper functions
     virtual void printRoot (Node<Key, Value> *r) const;
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
+    virtual void eraseNode(Node<Key, Value>* node);
+    virtual Node<Key, Value>* insertItem(Node<Key, Value>* hint, ItemSource<Key, Value>& source, bool& created);
 
     // Add helper functions here
     static Node<Key, Value>* successor(Node<Key, Value>* s);
-    void recursiveClear(Node<Key, Value>* node);
+    static Node<Key, Value>* treeSuccessor(Node<Key, Value>* s);
+    static Node<Key, Value>* treePredecessor(Node<Key, Value>* current);
+
+    // Upkeep of the in-order links of BST_THREADED; all of these do nothing without it.
+    static void threadNode(Node<Key, Value>* node);
+    static void unthreadNode(Node<Key, Value>* node);
+    static void linkThreads(Node<Key, Value>* before, Node<Key, Value>* after);
+    void rethread();
+
+    // Fork/join helpers for the parallel parts of the trees.
+    static unsigned parallelDepth();
+    template<typename LeftTask, typename RightTask>
+    static void forkJoin(bool parallel, LeftTask leftTask, RightTask rightTask);
+
+    // With parallel teardown on, trees with fewer nodes than this are still torn down on the
+    // calling thread alone.
+    static const std::size_t PARALLEL_MIN_TEARDOWN = std::size_t(1) << 16;
+    template<typename NodeType>
+    void clearNodes(NodeType* node);
+    template<typename NodeType>
+    static void destroyItems(NodeType* node, unsigned depth);
+    template<typename NodeType>
+    void clearAs();
     int isBalancedHelper(Node<Key, Value>* temp, bool& flag) const;
+    template<typename NodeType, typename... Args>
+    NodeType* createNode(Args&&... args);
+    template<typename NodeType>
+    void destroyNode(NodeType* node);
+    NodeArena& arena();
+    void absorbArena(BinarySearchTree<Key, Value, Compare>& donor);
+    void addToSize(std::ptrdiff_t delta);
+    template<bool IsConst>
+    static Node<Key, Value>* iteratorNode(const basic_iterator<IsConst>& it);
+    iterator makeIterator(Node<Key, Value>* node);
+    const_iterator makeIterator(Node<Key, Value>* node) const;
+    template<typename Item, typename Function>
+    void forEachInRange(Node<Key, Value>* root, const Key& first, const Key& last, Function& fn) const;
+    template<typename RandomIt, typename Function>
+    void findBatch(RandomIt first, RandomIt last, Function& found) const;
+    static void prefetchNode(const void* node);
+
+    // Lookups find_batch() keeps in flight at once. Enough to cover a memory access with the
+    // work of the others, few enough that their state stays in registers and L1.
+    static const std::size_t BATCH_WIDTH = 16;
+    template<typename K>
+    std::pair<Node<Key, Value>*, Node<Key, Value>*> equalRangeNodes(const K& key) const;
+
+    // Key ordering. compareKeys() returns <0, 0 or >0 with a single threeWayCompare() where
+    // UsesThreeWay allows it, and asks Compare at most twice otherwise.
+    template<typename K1, typename K2>
+    int compareKeys(const K1& a, const K2& b) const;
+    template<typename K1, typename K2>
+    int compareKeys(const K1& a, const K2& b, std::true_type) const;
+    template<typename K1, typename K2>
+    int compareKeys(const K1& a, const K2& b, std::false_type) const;
+
+    // Search/insert/remove engine shared by every tree built on this class. It is
+    // instantiated with the concrete node type so each step is a direct member load.
+    template<typename NodeType, typename K>
+    NodeType* findNode(NodeType* root, const K& key) const;
+    template<typename NodeType, typename K>
+    NodeType* lowerBoundNode(NodeType* root, const K& key) const;
+    template<typename NodeType, typename K>
+    NodeType* upperBoundNode(NodeType* root, const K& key) const;
+    template<typename NodeType, typename K>
+    NodeType* floorNode(NodeType* root, const K& key) const;
+    template<typename NodeType>
+    NodeType* seekNode(NodeType* root, const Key& key, NodeType*& parent, int& direction) const;
+    template<typename NodeType>
+    NodeType* seekNear(NodeType* hint, const Key& key, NodeType*& parent, int& direction) const;
+    template<typename NodeType>
+    void linkNode(NodeType* node, NodeType* parent, int direction);
+    template<typename NodeType, typename K, typename M>
+    NodeType* insertNode(NodeType* hint, K&& key, M&& value, bool& created);
+    template<typename NodeType, typename... Args>
+    NodeType* emplaceNode(NodeType* hint, bool& created, Args&&... args);
+    template<typename NodeType>
+    NodeType* insertItemAs(NodeType* hint, ItemSource<Key, Value>& source, bool& created);
+    template<typename NodeType>
+    NodeType* spliceNode(NodeType* node);
 
 protected:
     Node<Key, Value>* root_;
+    std::shared_ptr<NodeArena> arena_;   // shared with the trees this one exchanges nodes with
+    mutable std::size_t size_;           // number of nodes, or UNKNOWN_SIZE until size() recounts
+    mutable Node<Key, Value>* rightmost_; // largest node, or NULL until getLargestNode() looks again
+    static const std::size_t UNKNOWN_SIZE = static_cast<std::size_t>(-1);
+    Compare compare_;
+    bool parallelTeardown_;               // see setParallelTeardown()
     // You should not need other data members
+
+private:
+    BinarySearchTree(const BinarySearchTree<Key, Value, Compare>&);
+    BinarySearchTree<Key, Value, Compare>& operator=(const BinarySearchTree<Key, Value, Compare>&);
 };
 
 /*
@@ -260,9 +705,10 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
-    : current_(ptr)
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::basic_iterator(Node<Key,Value> *ptr, const BinarySearchTree<Key, Value, Compare>* tree)
+    : current_(ptr), tree_(tree)
 {
     // TODO - DONE
 }
@@ -270,19 +716,33 @@ BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
-    : current_(nullptr)
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::basic_iterator()
+    : current_(nullptr), tree_(nullptr)
 {
     // TODO - DONE
 }
 
+/**
+* Turns an iterator into a const_iterator.
+*/
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+template<bool C, typename>
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::basic_iterator(const basic_iterator<C>& other)
+    : current_(other.current_), tree_(other.tree_)
+{
+
+}
+
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare>::template basic_iterator<IsConst>::reference
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::operator*() const
 {
     return current_->getItem();
 }
@@ -290,9 +750,10 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare>::template basic_iterator<IsConst>::pointer
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::operator->() const
 {
     return &(current_->getItem());
 }
@@ -301,10 +762,12 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+template<bool RhsConst>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::operator==(
+    const basic_iterator<RhsConst>& rhs) const
 {
     // TODO - DONE
     return current_== rhs.current_;
@@ -314,10 +777,12 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+template<bool RhsConst>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::operator!=(
+    const basic_iterator<RhsConst>& rhs) const
 {
     // TODO - DONE
     return !(current_== rhs.current_);
@@ -327,17 +792,74 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++() {
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare>::template basic_iterator<IsConst>&
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::operator++() {
     // TODO - DONE
     current_ = successor(current_);     // sets current_ to its successor 
     return *this;
 }
 
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare>::template basic_iterator<IsConst>
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::operator++(int)
+{
+    basic_iterator<IsConst> old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back to the previous item in order. Stepping back from end() lands on
+* the largest item.
+*/
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare>::template basic_iterator<IsConst>&
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::operator--()
+{
+    if(current_ == nullptr){
+        current_ = tree_->getLargestNode();
+    }
+    else{
+        current_ = predecessor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, Compare>::template basic_iterator<IsConst>
+BinarySearchTree<Key, Value, Compare>::basic_iterator<IsConst>::operator--(int)
+{
+    basic_iterator<IsConst> old(*this);
+    --(*this);
+    return old;
+}
+
+/**
+* Returns the next node in key order, or NULL. O(1) with BST_THREADED, otherwise it may
+* have to climb the tree.
+*/
+template<class Key, class Value, class Compare>
+inline Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare>::successor(Node<Key, Value>* s)
+{
+#ifdef BST_THREADED
+    return s->getNext();
+#else
+    return treeSuccessor(s);
+#endif
+}
+
+/**
+* Finds the next node in key order from the shape of the tree alone.
+*/
+template<class Key, class Value, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::successor(Node<Key, Value>* s)
+BinarySearchTree<Key, Value, Compare>::treeSuccessor(Node<Key, Value>* s)
 {
     // Check for the presence of the right child of the node
     if (s->getRight() != nullptr) {
@@ -381,18 +903,44 @@ Begin implementations for the BinarySearchTree class.
 -----------------------------------------------------
 */
 
+template<class Key, class Value, class Compare>
+const std::size_t BinarySearchTree<Key, Value, Compare>::UNKNOWN_SIZE;
+
+template<class Key, class Value, class Compare>
+const std::size_t BinarySearchTree<Key, Value, Compare>::BATCH_WIDTH;
+
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() :
-    root_(nullptr)
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree() :
+    root_(nullptr),
+    arena_(std::make_shared<NodeArena>()),
+    size_(0),
+    rightmost_(nullptr),
+    compare_(),
+    parallelTeardown_(false)
 {
     // TODO - DONE
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(const Compare& comp) :
+    root_(nullptr),
+    arena_(std::make_shared<NodeArena>()),
+    size_(0),
+    rightmost_(nullptr),
+    compare_(comp),
+    parallelTeardown_(false)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+BinarySearchTree<Key, Value, Compare>::~BinarySearchTree()
 {
     // TODO - DONE
     clear();
@@ -401,207 +949,961 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+* Returns the number of elements in the tree. The count is kept up to date by every
+* operation, except that a tree which took over nodes from another one without learning
+* how many (AVLTree::split without subtree sizes) counts them once on the next call.
+*/
+template<class Key, class Value, class Compare>
+std::size_t BinarySearchTree<Key, Value, Compare>::size() const
 {
-    printRoot(root_);
-    std::cout << "\n";
+    if(size_ == UNKNOWN_SIZE){
+        std::size_t count = 0;
+        for(Node<Key, Value>* n = getSmallestNode(); n != nullptr; n = successor(n)){
+            ++count;
+        }
+        size_ = count;
+    }
+    return size_;
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+* Returns a copy of the comparator that orders the keys.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Compare>
+Compare BinarySearchTree<Key, Value, Compare>::key_comp() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    return compare_;
 }
 
 /**
-* Returns an iterator whose value means INVALID
+* Returns the block, live node and free list counters of the node arena. If the arena is
+* shared with other trees (after split/join) the counters cover all of them.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Compare>
+ArenaStats BinarySearchTree<Key, Value, Compare>::getAllocatorStats() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-
-    return end;
+    return NodeArena::resolve(arena_.get())->stats();
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
+* Lets clear() and the destructor hand the item destructors of trees with at least
+* PARALLEL_MIN_TEARDOWN nodes to other threads. Only worth it for items with expensive
+* destructors, and only safe if those destructors may run concurrently and off the thread
+* that owns the tree (no thread-local state, no locks the owner holds).
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::setParallelTeardown(bool enabled)
 {
-    Node<Key, Value> *curr = internalFind(k);
-
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    parallelTeardown_ = enabled;
+}
 
-    return it;
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
+* Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::begin()
 {
-    // TODO
-
-    // CASE 1: Empty Tree
-    if(root_ == nullptr){
-        root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second ,nullptr);
-        return;
-    }
+    return makeIterator(getSmallestNode());
+}
 
-    // CASE 2: Non-Empty Tree
-    int direction = 0;  // 2 = left child, 1 = right child
-    Node<Key, Value>* temp = root_;
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::begin() const
+{
+    return makeIterator(getSmallestNode());
+}
 
-    Node<Key, Value>* prev;
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::cbegin() const
+{
+    return begin();
+}
 
-    while(temp != nullptr){
-        prev = temp;
+/**
+* Returns an iterator whose value means INVALID, one past the largest item
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::end()
+{
+    return makeIterator(NULL);
+}
 
-        if(keyValuePair.first > temp->getKey()){
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::end() const
+{
+    return makeIterator(NULL);
+}
 
-            direction = 1;
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::cend() const
+{
+    return end();
+}
 
-            temp = temp->getRight();
+/**
+* Reverse iteration, from the largest item down to the smallest.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rbegin()
+{
+    return reverse_iterator(end());
+}
 
-        }
-        else if(keyValuePair.first < temp->getKey()){
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
 
-            direction = 2;
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::crbegin() const
+{
+    return rbegin();
+}
 
-            temp = temp->getLeft();
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rend()
+{
+    return reverse_iterator(begin());
+}
 
-        }
-        else if(keyValuePair.first == temp->getKey()){   // then overwrite value
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
 
-            temp->setValue(keyValuePair.second);
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::crend() const
+{
+    return rend();
+}
 
-            return;
-        }
-    }
-    // create the new node with parent set to prev
-    temp = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, prev);
-    
-    // set parent's child to new node
-    if(direction == 2){
-        prev->setLeft(temp);
-    } 
-    else if(direction == 1){
-        prev->setRight(temp);
-    }
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const Key & k)
+{
+    return makeIterator(internalFind(k));
 }
 
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::find(const Key & k) const
+{
+    return makeIterator(internalFind(k));
+}
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* The tree may not remain balanced after removal.
+* Returns the number of items with key k, which is 0 or 1.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Compare>
+std::size_t BinarySearchTree<Key, Value, Compare>::count(const Key& k) const
 {
-    // TODO - DONE
-
-    Node<Key, Value>* nodeToRemove = internalFind(key);
+    return (internalFind(k) != nullptr) ? 1 : 0;
+}
 
-    // CASE 1: key not in the tree
-    if(nodeToRemove == nullptr) {
+/**
+* Transparent versions of the lookups above. Each takes any key type that Compare can
+* order against Key and searches with it directly.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const K& k)
+{
+    return makeIterator(findNode(root_, k));
+}
 
-        return; // Key not found, nothing to remove
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::find(const K& k) const
+{
+    return makeIterator(findNode(root_, k));
+}
 
-    }
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+std::size_t BinarySearchTree<Key, Value, Compare>::count(const K& k) const
+{
+    return (findNode(root_, k) != nullptr) ? 1 : 0;
+}
 
-    if((nodeToRemove->getLeft() != nullptr) && (nodeToRemove->getRight() != nullptr)){
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const K& k)
+{
+    return makeIterator(lowerBoundNode(root_, k));
+}
 
-        Node<Key, Value>* succ = successor(nodeToRemove);
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const K& k) const
+{
+    return makeIterator(lowerBoundNode(root_, k));
+}
 
-        nodeSwap(succ, nodeToRemove);
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const K& k)
+{
+    return makeIterator(upperBoundNode(root_, k));
+}
 
-    }
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const K& k) const
+{
+    return makeIterator(upperBoundNode(root_, k));
+}
 
-    // CASE 2: nodeToRemove has no children
-    if(nodeToRemove->getLeft()== nullptr && nodeToRemove->getRight()==nullptr){
-        
-        if(nodeToRemove->getParent() != nullptr) {  // if no children + existing parent -> make the the parent's child null
-            if (nodeToRemove->getParent()->getLeft() == nodeToRemove){
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, typename BinarySearchTree<Key, Value, Compare>::iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const K& k)
+{
+    std::pair<Node<Key, Value>*, Node<Key, Value>*> range = equalRangeNodes(k);
+    return std::make_pair(makeIterator(range.first), makeIterator(range.second));
+}
 
-                nodeToRemove->getParent()->setLeft(nullptr);
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::const_iterator, typename BinarySearchTree<Key, Value, Compare>::const_iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const K& k) const
+{
+    std::pair<Node<Key, Value>*, Node<Key, Value>*> range = equalRangeNodes(k);
+    return std::make_pair(makeIterator(range.first), makeIterator(range.second));
+}
 
-            }
-            else if(nodeToRemove->getParent()->getRight() == nodeToRemove){
+/**
+* Returns an iterator to the first item whose key is not less than k, or end().
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const Key& k)
+{
+    return makeIterator(lowerBoundNode(root_, k));
+}
 
-                nodeToRemove->getParent()->setRight(nullptr);
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const Key& k) const
+{
+    return makeIterator(lowerBoundNode(root_, k));
+}
 
-            }
+/**
+* Returns an iterator to the first item whose key is greater than k, or end().
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const Key& k)
+{
+    return makeIterator(upperBoundNode(root_, k));
+}
 
-            delete nodeToRemove;
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const Key& k) const
+{
+    return makeIterator(upperBoundNode(root_, k));
+}
 
-            return;
-        }
-        else{   // if no children + null parent = root node
+/**
+* Returns the range of items with key k: empty, or the one item with that key.
+*/
+template<class Key, class Value, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, typename BinarySearchTree<Key, Value, Compare>::iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const Key& k)
+{
+    std::pair<Node<Key, Value>*, Node<Key, Value>*> range = equalRangeNodes(k);
+    return std::make_pair(makeIterator(range.first), makeIterator(range.second));
+}
 
-            this->root_ = nullptr;
+template<class Key, class Value, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::const_iterator, typename BinarySearchTree<Key, Value, Compare>::const_iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const Key& k) const
+{
+    std::pair<Node<Key, Value>*, Node<Key, Value>*> range = equalRangeNodes(k);
+    return std::make_pair(makeIterator(range.first), makeIterator(range.second));
+}
 
-            delete nodeToRemove;
+/**
+* The nodes bounding the items with key k; both are the same node (or NULL) if there is none.
+*/
+template<class Key, class Value, class Compare>
+template<typename K>
+std::pair<Node<Key, Value>*, Node<Key, Value>*> BinarySearchTree<Key, Value, Compare>::equalRangeNodes(const K& k) const
+{
+    Node<Key, Value>* first = lowerBoundNode(root_, k);
+    Node<Key, Value>* last = first;
+    if(first != nullptr && !compare_(k, first->getKey())){
+        last = successor(first);
+    }
+    return std::make_pair(first, last);
+}
 
-            return;
+/**
+* Returns an iterator to the last item whose key is not greater than k, or end().
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::floor(const Key& k)
+{
+    return makeIterator(floorNode(root_, k));
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::floor(const Key& k) const
+{
+    return makeIterator(floorNode(root_, k));
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than k, or end().
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::ceiling(const Key& k)
+{
+    return makeIterator(lowerBoundNode(root_, k));
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::ceiling(const Key& k) const
+{
+    return makeIterator(lowerBoundNode(root_, k));
+}
+
+/**
+* Descends once to the first key in [first, last) and then walks in order until last, so a
+* scan costs O(log n + k) for k items in the range. The const version hands fn const items.
+*/
+template<class Key, class Value, class Compare>
+template<typename Function>
+void BinarySearchTree<Key, Value, Compare>::for_each_in_range(const Key& first, const Key& last, Function fn)
+{
+    forEachInRange<std::pair<const Key, Value> >(root_, first, last, fn);
+}
+
+template<class Key, class Value, class Compare>
+template<typename Function>
+void BinarySearchTree<Key, Value, Compare>::for_each_in_range(const Key& first, const Key& last, Function fn) const
+{
+    forEachInRange<const std::pair<const Key, Value> >(root_, first, last, fn);
+}
+
+template<class Key, class Value, class Compare>
+template<typename Item, typename Function>
+void BinarySearchTree<Key, Value, Compare>::forEachInRange(Node<Key, Value>* root, const Key& first, const Key& last, Function& fn) const
+{
+    for(Node<Key, Value>* n = lowerBoundNode(root, first); n != nullptr && compare_(n->getKey(), last); n = successor(n)){
+        Item& item = n->getItem();
+        fn(item);
+    }
+}
+
+/**
+* Looks up every key in [first, last) and stores an iterator to its item, or end(), in the
+* matching position of out.
+*/
+template<class Key, class Value, class Compare>
+template<typename RandomIt, typename OutIt>
+void BinarySearchTree<Key, Value, Compare>::find_batch(RandomIt first, RandomIt last, OutIt out)
+{
+    auto found = [this, &out](std::size_t i, Node<Key, Value>* n) { out[i] = makeIterator(n); };
+    findBatch(first, last, found);
+}
+
+template<class Key, class Value, class Compare>
+template<typename RandomIt, typename OutIt>
+void BinarySearchTree<Key, Value, Compare>::find_batch(RandomIt first, RandomIt last, OutIt out) const
+{
+    auto found = [this, &out](std::size_t i, Node<Key, Value>* n) { out[i] = makeIterator(n); };
+    findBatch(first, last, found);
+}
+
+/**
+* Runs up to BATCH_WIDTH searches side by side, round robin, one level per turn (asynchronous
+* memory access chaining). Each turn prefetches the child the search moves to and then leaves
+* it alone until every other search has had its turn, by which time the node has usually
+* arrived. A search that finishes reports found(index, node or NULL) and its place is taken
+* by the next key, so the pipeline stays full however uneven the depths are.
+*/
+template<class Key, class Value, class Compare>
+template<typename RandomIt, typename Function>
+void BinarySearchTree<Key, Value, Compare>::findBatch(RandomIt first, RandomIt last, Function& found) const
+{
+    struct Lookup
+    {
+        Node<Key, Value>* node;
+        std::size_t index;
+    };
+
+    const std::size_t count = static_cast<std::size_t>(last - first);
+    Lookup lookups[BATCH_WIDTH];
+    std::size_t active = 0;
+    std::size_t next = 0;
+    for(; active < BATCH_WIDTH && next < count; ++active, ++next){
+        lookups[active].node = root_;
+        lookups[active].index = next;
+    }
+
+    while(active > 0){
+        for(std::size_t i = 0; i < active; ){
+            Lookup& lookup = lookups[i];
+            Node<Key, Value>* node = lookup.node;
+            int order = 0;
+            if(node != nullptr){
+                order = compareKeys(first[lookup.index], node->getKey());
+            }
+            if(order != 0){
+                node = (order < 0) ? node->getLeft() : node->getRight();
+                prefetchNode(node);
+                lookup.node = node;
+                ++i;
+                continue;
+            }
+
+            // hit, or fell off the tree
+            found(lookup.index, node);
+            if(next < count){
+                lookup.node = root_;
+                lookup.index = next++;
+                ++i;
+            }
+            else{
+                lookup = lookups[--active];
+            }
         }
     }
+}
+
+template<class Key, class Value, class Compare>
+inline void BinarySearchTree<Key, Value, Compare>::prefetchNode(const void* node)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(node);
+#else
+    (void)node;
+#endif
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // TODO - DONE
+    bool created;
+    insertNode<Node<Key, Value> >(nullptr, keyValuePair.first, keyValuePair.second, created);
+}
+
+/**
+* Same as above, but the value is moved into the tree. The key is const inside the pair
+* and therefore still copied; use try_emplace or insert_or_assign to move it as well.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    bool created;
+    insertNode<Node<Key, Value> >(nullptr, keyValuePair.first, std::move(keyValuePair.second), created);
+}
+
+/**
+* Inserts keyValuePair like insert() does, starting the search at hint; see seekNear().
+* Returns an iterator to the item with that key.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(&keyValuePair.first,
+        [&]() { return keyValuePair; },
+        [&](Value& value) { value = keyValuePair.second; });
+    return makeIterator(insertItem(iteratorNode(hint), source, created));
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::insert(const_iterator hint, std::pair<const Key, Value>&& keyValuePair)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(&keyValuePair.first,
+        [&]() { return std::pair<const Key, Value>(keyValuePair.first, std::move(keyValuePair.second)); },
+        [&](Value& value) { value = std::move(keyValuePair.second); });
+    return makeIterator(insertItem(iteratorNode(hint), source, created));
+}
+
+/**
+* emplace() with a hint. Returns an iterator to the new item, or to the one that was
+* already there.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::emplace_hint(const_iterator hint, Args&&... args)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(static_cast<const Key*>(nullptr),
+        [&]() { return std::pair<const Key, Value>(std::forward<Args>(args)...); },
+        [](Value&) {});
+    return makeIterator(insertItem(iteratorNode(hint), source, created));
+}
+
+/**
+* Builds an item from args inside a new node and links it in, unless its key is already
+* present. std::map does the same; the key is only known once the item exists.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool> BinarySearchTree<Key, Value, Compare>::emplace(Args&&... args)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(static_cast<const Key*>(nullptr),
+        [&]() { return std::pair<const Key, Value>(std::forward<Args>(args)...); },
+        [](Value&) {});
+    Node<Key, Value>* node = insertItem(nullptr, source, created);
+    return std::make_pair(makeIterator(node), created);
+}
+
+/**
+* Adds key with a value built from args if key is not in the tree yet.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool> BinarySearchTree<Key, Value, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(&key,
+        [&]() { return std::pair<const Key, Value>(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...)); },
+        [](Value&) {});
+    Node<Key, Value>* node = insertItem(nullptr, source, created);
+    return std::make_pair(makeIterator(node), created);
+}
+
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool> BinarySearchTree<Key, Value, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(&key,
+        [&]() { return std::pair<const Key, Value>(std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...)); },
+        [](Value&) {});
+    Node<Key, Value>* node = insertItem(nullptr, source, created);
+    return std::make_pair(makeIterator(node), created);
+}
+
+/**
+* Adds key with the given value, or assigns the value if key is already present.
+*/
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool> BinarySearchTree<Key, Value, Compare>::insert_or_assign(const Key& key, M&& value)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(&key,
+        [&]() { return std::pair<const Key, Value>(key, std::forward<M>(value)); },
+        [&](Value& existing) { existing = std::forward<M>(value); });
+    Node<Key, Value>* node = insertItem(nullptr, source, created);
+    return std::make_pair(makeIterator(node), created);
+}
+
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool> BinarySearchTree<Key, Value, Compare>::insert_or_assign(Key&& key, M&& value)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(&key,
+        [&]() { return std::pair<const Key, Value>(std::move(key), std::forward<M>(value)); },
+        [&](Value& existing) { existing = std::forward<M>(value); });
+    Node<Key, Value>* node = insertItem(nullptr, source, created);
+    return std::make_pair(makeIterator(node), created);
+}
+
+/**
+* Returns the value stored under key, adding a default-constructed one first if needed.
+*/
+template<class Key, class Value, class Compare>
+Value& BinarySearchTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(&key,
+        [&]() { return std::pair<const Key, Value>(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()); },
+        [](Value&) {});
+    return insertItem(nullptr, source, created)->getValue();
+}
 
-    // CASE 3: nodeToRemove has one child 
-    else if((nodeToRemove->getLeft() != nullptr && nodeToRemove->getRight() == nullptr) || (nodeToRemove->getLeft() == nullptr && nodeToRemove->getRight() != nullptr)){
+template<class Key, class Value, class Compare>
+Value& BinarySearchTree<Key, Value, Compare>::operator[](Key&& key)
+{
+    bool created;
+    auto source = makeItemSource<Key, Value>(&key,
+        [&]() { return std::pair<const Key, Value>(std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::tuple<>()); },
+        [](Value&) {});
+    return insertItem(nullptr, source, created)->getValue();
+}
 
-        Node<Key, Value>* child = (nodeToRemove->getLeft() != nullptr) ? nodeToRemove->getLeft() : nodeToRemove->getRight();
+/**
+* Descends from root looking for key. Returns the node holding it, or NULL; in that case
+* parent and direction tell where a node for key has to be linked in
+* (NULL parent = empty tree, direction 2 = left child, 1 = right child).
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+inline NodeType* BinarySearchTree<Key, Value, Compare>::seekNode(NodeType* root, const Key& key, NodeType*& parent, int& direction) const
+{
+    NodeType* temp = root;
+    parent = nullptr;
+    direction = 0;
 
-        if(nodeToRemove == root_){   // if that node with one child is the root 
-            root_ = child;
+    while(temp != nullptr){
+        parent = temp;
 
-            child->setParent(nullptr);
+        int order = compareKeys(key, temp->getKey());
+        if(order > 0){
 
-            delete nodeToRemove;
+            direction = 1;
 
-        } else{   // if not a root node then it has a parent 
-            Node<Key, Value>* parent = nodeToRemove->getParent();
+            temp = temp->getRight();
 
-            if(nodeToRemove->getParent()->getLeft() == nodeToRemove){   // if nodeToRemove is its parent's left child then 
+        }
+        else if(order < 0){
+
+            direction = 2;
 
-                parent->setLeft(child);
+            temp = temp->getLeft();
 
-            }else{
+        }
+        else{
+
+            return temp;
+        }
+    }
+    return nullptr;
+}
 
-                parent->setRight(child);
-                
+/**
+* Same as seekNode, but looks next to hint first: hint is the node key is expected to go
+* right before, NULL meaning after the largest node. If key does fit between hint and its
+* in-order neighbour, one of those two has a free child slot in between and the position is
+* found with at most two comparisons. Otherwise the search starts over from the root.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+inline NodeType* BinarySearchTree<Key, Value, Compare>::seekNear(NodeType* hint, const Key& key, NodeType*& parent, int& direction) const
+{
+    if(hint == nullptr){
+        // the append path: the largest node is cached, so sorted input never descends
+        NodeType* last = static_cast<NodeType*>(getLargestNode());
+        int order = (last == nullptr) ? 1 : compareKeys(key, last->getKey());
+        if(order > 0){
+            parent = last;
+            direction = 1;
+            return nullptr;
+        }
+        if(order == 0){
+            return last;
+        }
+    }
+    else{
+        int order = compareKeys(key, hint->getKey());
+        if(order == 0){
+            return hint;
+        }
+        if(order < 0){
+            NodeType* before = static_cast<NodeType*>(predecessor(hint));
+            if(before == nullptr || compareKeys(key, before->getKey()) > 0){
+                // if hint has a left subtree, before is its largest node and has no right child
+                parent = (hint->getLeft() == nullptr) ? hint : before;
+                direction = (hint->getLeft() == nullptr) ? 2 : 1;
+                return nullptr;
             }
-            child->setParent(parent);
-            delete nodeToRemove;
         }
-    }    
+        else{
+            NodeType* after = static_cast<NodeType*>(successor(hint));
+            if(after == nullptr || compareKeys(key, after->getKey()) < 0){
+                parent = (hint->getRight() == nullptr) ? hint : after;
+                direction = (hint->getRight() == nullptr) ? 1 : 2;
+                return nullptr;
+            }
+        }
+    }
+    return seekNode(static_cast<NodeType*>(root_), key, parent, direction);
+}
 
+/**
+* Hangs a new leaf under the position found by seekNode and counts it.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare>::linkNode(NodeType* node, NodeType* parent, int direction)
+{
+    node->setParent(parent);
+
+    // set parent's child to new node
+    if(parent == nullptr){
+        root_ = node;
+    }
+    else if(direction == 2){
+        parent->setLeft(node);
+    } 
+    else{
+        parent->setRight(node);
+    }
+    if(parent == nullptr || (parent == rightmost_ && direction == 1)){
+        rightmost_ = node;
+    }
+    threadNode(node);
+    addToSize(1);
 }
 
+/**
+* Puts key/value into the tree without rebalancing. If the key is already present its
+* value is overwritten and created is set to false, otherwise a new leaf of type NodeType
+* is linked in and created is set to true. Key and value are forwarded, so rvalues are
+* moved into the node. The search starts next to hint, see seekNear(). Returns the node
+* holding the key.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K, typename M>
+NodeType* BinarySearchTree<Key, Value, Compare>::insertNode(NodeType* hint, K&& key, M&& value, bool& created)
+{
+    NodeType* parent;
+    int direction;
+    NodeType* temp = seekNear(hint, key, parent, direction);
+
+    // then overwrite value
+    if(temp != nullptr){
+        created = false;
+        temp->getValue() = std::forward<M>(value);
+        return temp;
+    }
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+    // create the new node with parent set to prev
+    temp = createNode<NodeType>(parent, std::forward<K>(key), std::forward<M>(value));
+    linkNode(temp, parent, direction);
+    created = true;
+    return temp;
+}
+
+/**
+* Builds a whole node from args first, then links it in by its key. If the key turns out
+* to be present already the new node is destroyed again and the existing one returned.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename... Args>
+NodeType* BinarySearchTree<Key, Value, Compare>::emplaceNode(NodeType* hint, bool& created, Args&&... args)
+{
+    NodeType* temp = createNode<NodeType>(static_cast<NodeType*>(nullptr), std::forward<Args>(args)...);
+
+    NodeType* parent;
+    int direction;
+    NodeType* existing = seekNear(hint, temp->getKey(), parent, direction);
+    if(existing != nullptr){
+        destroyNode(temp);
+        created = false;
+        return existing;
+    }
+
+    linkNode(temp, parent, direction);
+    created = true;
+    return temp;
+}
+
+/**
+* Inserts the item source describes, starting the search at hint, and returns the node that
+* holds its key. Every templated insert, emplace and operator[] goes through here, so trees
+* that keep extra invariants (balance, augmented data) override this to create their own node
+* type and restore them, just like eraseNode().
+*/
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::insertItem(Node<Key, Value>* hint, ItemSource<Key, Value>& source, bool& created)
+{
+    return insertItemAs(hint, source, created);
+}
+
+/**
+* The engine behind insertItem(): looks for source's key next to hint and either hands the
+* existing value to source.assign() or links in a new NodeType built by source. Without a
+* key the item is built first, as emplaceNode() does. Nothing is built, moved from or
+* allocated if the key is present.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare>::insertItemAs(NodeType* hint, ItemSource<Key, Value>& source, bool& created)
+{
+    const Key* key = source.key();
+    if(key == nullptr){
+        return emplaceNode(hint, created, source);
+    }
+
+    NodeType* parent;
+    int direction;
+    NodeType* temp = seekNear(hint, *key, parent, direction);
+    if(temp != nullptr){
+        created = false;
+        source.assign(temp->getValue());
+        return temp;
+    }
+
+    temp = createNode<NodeType>(parent, source);
+    linkNode(temp, parent, direction);
+    created = true;
+    return temp;
+}
+
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* The tree may not remain balanced after removal.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::remove(const Key& key)
+{
+    // TODO - DONE
+
+    Node<Key, Value>* nodeToRemove = internalFind(key);
+
+    // CASE 1: key not in the tree
+    if(nodeToRemove == nullptr) {
+
+        return; // Key not found, nothing to remove
+
+    }
+
+    eraseNode(nodeToRemove);
+}
+
+/**
+* Transparent remove; see find(const K&).
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+void BinarySearchTree<Key, Value, Compare>::remove(const K& key)
+{
+    Node<Key, Value>* nodeToRemove = findNode(root_, key);
+    if(nodeToRemove != nullptr){
+        eraseNode(nodeToRemove);
+    }
+}
+
+/**
+* Unlinks and destroys a node of this tree. Trees that keep extra invariants (balance,
+* augmented data) override this so that every kind of remove goes through them.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::eraseNode(Node<Key, Value>* nodeToRemove)
+{
+    if((nodeToRemove->getLeft() != nullptr) && (nodeToRemove->getRight() != nullptr)){
+
+        Node<Key, Value>* succ = successor(nodeToRemove);
+
+        nodeSwap(succ, nodeToRemove);
+
+    }
+
+    // nodeSwap leaves the in-order links alone, so they still describe nodeToRemove
+    unthreadNode(nodeToRemove);
+
+    spliceNode(nodeToRemove);
+
+    destroyNode(nodeToRemove);
+
+    addToSize(-1);
+}
+
+/**
+* Unlinks a node that has at most one child by putting that child (or nothing) in its
+* place. The node itself is left alone for the caller to destroy or reuse. Returns the old
+* parent of the node, which is where a balanced tree has to start retracing, or NULL if the
+* node was the root.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare>::spliceNode(NodeType* nodeToRemove)
+{
+    NodeType* parent = nodeToRemove->getParent();
+    NodeType* child = (nodeToRemove->getLeft() != nullptr) ? nodeToRemove->getLeft() : nodeToRemove->getRight();
+
+    if(child != nullptr){
+        child->setParent(parent);
+    }
+    if(nodeToRemove == rightmost_){
+        rightmost_ = nullptr;
+    }
+
+    if(parent == nullptr){   // nodeToRemove is the root
+        root_ = child;
+    }
+    else if(parent->getLeft() == nodeToRemove){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+
+    return parent;
+}
+
+
+template<class Key, class Value, class Compare>
+inline Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare>::predecessor(Node<Key, Value>* current)
 {
     // TODO - DONE
+#ifdef BST_THREADED
+    return (current == nullptr) ? nullptr : current->getPrev();
+#else
+    return treePredecessor(current);
+#endif
+}
+
+/**
+* Finds the previous node in key order from the shape of the tree alone.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare>::treePredecessor(Node<Key, Value>* current)
+{
 
     if(current == nullptr){
 
@@ -644,44 +1946,355 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 
 
 
+/**
+* Links a node that was just hung into the tree as a leaf between its in-order neighbours.
+* A left child comes right before its parent, a right child right after it.
+*/
+template<typename Key, typename Value, typename Compare>
+inline void BinarySearchTree<Key, Value, Compare>::threadNode(Node<Key, Value>* node)
+{
+#ifdef BST_THREADED
+    Node<Key, Value>* parent = node->getParent();
+    if(parent == nullptr){
+        linkThreads(nullptr, node);
+        linkThreads(node, nullptr);
+    }
+    else if(parent->getLeft() == node){
+        linkThreads(parent->getPrev(), node);
+        linkThreads(node, parent);
+    }
+    else{
+        linkThreads(node, parent->getNext());
+        linkThreads(parent, node);
+    }
+#else
+    (void)node;
+#endif
+}
+
+/**
+* Takes a node that is about to leave the tree out of the in-order links.
+*/
+template<typename Key, typename Value, typename Compare>
+inline void BinarySearchTree<Key, Value, Compare>::unthreadNode(Node<Key, Value>* node)
+{
+#ifdef BST_THREADED
+    linkThreads(node->getPrev(), node->getNext());
+    node->setPrev(nullptr);
+    node->setNext(nullptr);
+#else
+    (void)node;
+#endif
+}
+
+/**
+* Makes after follow before in the in-order links; either may be NULL for an end.
+*/
+template<typename Key, typename Value, typename Compare>
+inline void BinarySearchTree<Key, Value, Compare>::linkThreads(Node<Key, Value>* before, Node<Key, Value>* after)
+{
+#ifdef BST_THREADED
+    if(before != nullptr){
+        before->setNext(after);
+    }
+    if(after != nullptr){
+        after->setPrev(before);
+    }
+#else
+    (void)before;
+    (void)after;
+#endif
+}
+
+/**
+* Rebuilds every in-order link from the shape of the tree, for operations that rearrange
+* too much to patch the links as they go. O(n).
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::rethread()
+{
+#ifdef BST_THREADED
+    Node<Key, Value>* prev = nullptr;
+    for(Node<Key, Value>* n = getSmallestNode(); n != nullptr; n = treeSuccessor(n)){
+        linkThreads(prev, n);
+        prev = n;
+    }
+    linkThreads(prev, nullptr);
+#endif
+}
+
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::clear()
 {
     // TODO - DONE
-    // if tree empty then do nothing 
-    if(empty()){
-        return;
+    clearAs<Node<Key, Value> >();
+}
+
+/**
+* Tears the tree down treating every node as a NodeType. If no other tree shares the arena,
+* items that need no destructor call are simply dropped along with the arena blocks, otherwise
+* every node is destroyed first. A shared arena cannot be released, so there each slot goes back
+* to its free list and this tree moves on to a fresh arena.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare>::clearAs()
+{
+    NodeArena::resolve(arena_);
+
+    if(arena_.use_count() == 1){
+        if(!std::is_trivially_destructible<NodeType>::value){
+            destroyItems(static_cast<NodeType*>(root_), (parallelTeardown_ && size_ >= PARALLEL_MIN_TEARDOWN) ? parallelDepth() : 0);
+        }
+        arena_->release();
+    }
+    else{
+        clearNodes(static_cast<NodeType*>(root_));
+        arena_ = std::make_shared<NodeArena>();
     }
-    recursiveClear(root_);
     root_ = nullptr;
+    rightmost_ = nullptr;
+    size_ = 0;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::recursiveClear(Node<Key,Value>* n)
+/**
+* Destroys every node below n and hands the slots back to the arena. Uses no recursion and no
+* stack, so any depth is fine: while the current node has a left child, that child is rotated
+* up in its place, and a node without one is destroyed and its right child taken next.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare>::clearNodes(NodeType* n)
+{
+    while(n != nullptr){
+
+        NodeType* left = n->getLeft();
+
+        if(left != nullptr){
+
+            n->setLeft(left->getRight());
+            left->setRight(n);
+            n = left;
+
+        }
+        else{
+
+            NodeType* right = n->getRight();
+            destroyNode(n);
+            n = right;
+
+        }
+    }
+}
+
+/**
+* Runs the destructor of every node below n without freeing any memory; clearAs() releases
+* the arena blocks afterwards. The top depth levels hand one subtree each to another thread,
+* the rest is the same stackless walk as clearNodes(). clearAs() only passes a depth above 0
+* when setParallelTeardown() asked for it, since the items are then destroyed concurrently.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare>::destroyItems(NodeType* n, unsigned depth)
+{
+    if(n != nullptr && depth > 0){
+        NodeType* left = n->getLeft();
+        NodeType* right = n->getRight();
+        n->~NodeType();
+        forkJoin(true,
+            [=]() { destroyItems(left, depth - 1); },
+            [=]() { destroyItems(right, depth - 1); });
+        return;
+    }
+
+    while(n != nullptr){
+
+        NodeType* left = n->getLeft();
+
+        if(left != nullptr){
+
+            n->setLeft(left->getRight());
+            left->setRight(n);
+            n = left;
+
+        }
+        else{
+
+            NodeType* right = n->getRight();
+            n->~NodeType();
+            n = right;
+
+        }
+    }
+}
+
+/**
+* How many levels of a fork/join recursion should fork: one per halving of the number of
+* hardware threads, so the leaves of the forked part keep every core busy.
+*/
+template<typename Key, typename Value, typename Compare>
+unsigned BinarySearchTree<Key, Value, Compare>::parallelDepth()
+{
+    unsigned depth = 0;
+    for(unsigned threads = std::thread::hardware_concurrency(); threads > 1; threads /= 2){
+        ++depth;
+    }
+    return depth;
+}
+
+/**
+* Runs both tasks, the left one on a new thread if parallel is set, and waits for both. If no
+* thread can be started the left task runs inline instead, so callers such as the destructor
+* (through destroyItems()) never see std::system_error. An exception thrown by either task
+* (a throwing comparator, std::bad_alloc) is held until the other one has finished and the
+* thread is joined, then rethrown here; if both throw, the left task's exception wins.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename LeftTask, typename RightTask>
+void BinarySearchTree<Key, Value, Compare>::forkJoin(bool parallel, LeftTask leftTask, RightTask rightTask)
+{
+    if(parallel){
+        std::exception_ptr leftError;
+        std::thread leftThread;
+        try{
+            leftThread = std::thread([&]() {
+                try{
+                    leftTask();
+                }
+                catch(...){
+                    leftError = std::current_exception();
+                }
+            });
+        }
+        catch(const std::system_error&){
+            parallel = false;
+        }
+        if(parallel){
+            std::exception_ptr rightError;
+            try{
+                rightTask();
+            }
+            catch(...){
+                rightError = std::current_exception();
+            }
+            leftThread.join();
+            if(leftError){
+                std::rethrow_exception(leftError);
+            }
+            if(rightError){
+                std::rethrow_exception(rightError);
+            }
+            return;
+        }
+    }
+    leftTask();
+    rightTask();
+}
+
+/**
+* Builds a node of the requested type in a slot taken from the node arena. The arguments
+* go straight to the node's constructor.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename... Args>
+NodeType* BinarySearchTree<Key, Value, Compare>::createNode(Args&&... args)
 {
-    if(n == nullptr){
+    NodeArena& nodes = arena();
+    void* slot = nodes.allocate(sizeof(NodeType));
+    try{
+        return new (slot) NodeType(std::forward<Args>(args)...);
+    }
+    catch(...){
+        nodes.deallocate(slot);
+        throw;
+    }
+}
+
+/**
+* Destroys a single node through its real type and hands its slot back to the arena's free list.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare>::destroyNode(NodeType* node)
+{
+    node->~NodeType();
+    arena().deallocate(node);
+}
+
+/**
+* Returns the arena that currently owns this tree's nodes.
+*/
+template<typename Key, typename Value, typename Compare>
+inline NodeArena& BinarySearchTree<Key, Value, Compare>::arena()
+{
+    NodeArena::resolve(arena_);
+    return *arena_;
+}
 
+/**
+* Called when nodes of donor are about to become part of this tree: from now on both trees'
+* nodes are owned by one arena, and donor starts over with a fresh one.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::absorbArena(BinarySearchTree<Key, Value, Compare>& donor)
+{
+    if(&donor == this){
         return;
+    }
+    NodeArena::resolve(arena_);
+    NodeArena::resolve(donor.arena_);
+    NodeArena::merge(arena_, donor.arena_);
+    donor.arena_ = std::make_shared<NodeArena>();
+}
+
 
+/**
+* Adjusts the element count, unless it is not known right now.
+*/
+template<typename Key, typename Value, typename Compare>
+inline void BinarySearchTree<Key, Value, Compare>::addToSize(std::ptrdiff_t delta)
+{
+    if(size_ != UNKNOWN_SIZE){
+        size_ += static_cast<std::size_t>(delta);
     }
-    recursiveClear(n->getLeft());
+}
+
+/**
+* Gives trees built on this class access to the node behind an iterator.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+inline Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::iteratorNode(const basic_iterator<IsConst>& it)
+{
+    return it.current_;
+}
 
-    recursiveClear(n->getRight());
+/**
+* Gives trees built on this class a way to hand out iterators to their own nodes.
+*/
+template<typename Key, typename Value, typename Compare>
+inline typename BinarySearchTree<Key, Value, Compare>::iterator BinarySearchTree<Key, Value, Compare>::makeIterator(Node<Key, Value>* node)
+{
+    return iterator(node, this);
+}
 
-    delete n;
+template<typename Key, typename Value, typename Compare>
+inline typename BinarySearchTree<Key, Value, Compare>::const_iterator BinarySearchTree<Key, Value, Compare>::makeIterator(Node<Key, Value>* node) const
+{
+    return const_iterator(node, this);
 }
 
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Compare>::getSmallestNode() const
 {
     // TODO - DONE
     // CASE 1: empty tree
@@ -697,30 +2310,64 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
     return t;
 }
 
+/**
+* A helper function to find the largest node in the tree. The answer is kept in rightmost_
+* until that node leaves the tree, and inserts past it keep it up to date.
+*/
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare>::getLargestNode() const
+{
+    if(rightmost_ != nullptr){
+        return rightmost_;
+    }
+    Node<Key, Value>* t = root_;
+    if(t == nullptr){
+        return nullptr;
+    }
+    while(t->getRight()){
+        t = t->getRight();
+    }
+    rightmost_ = t;
+    return t;
+}
+
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalFind(const Key& key) const
 {
     // TODO - DONE
-    Node<Key, Value>* temp = root_;
+    return findNode(root_, key);
+}
+
+/**
+* The lookup loop behind internalFind(), specialized on the node type so that derived
+* trees can search without converting every child pointer back to their own node type.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K>
+inline NodeType* BinarySearchTree<Key, Value, Compare>::findNode(NodeType* root, const K& key) const
+{
+    NodeType* temp = root;
 
     while(temp != nullptr){
 
-        if(temp->getKey() > key){
+        int order = compareKeys(key, temp->getKey());
+        if(order < 0){
 
             temp = temp->getLeft();
 
         }
-        else if(temp -> getKey() < key){
+        else if(order > 0){
 
             temp = temp->getRight();
 
         }
-        else if(temp->getKey() == key){
+        else{
 
             return temp;
 
@@ -730,11 +2377,119 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
     return temp;
 }
 
+/**
+* Three-way comparison of two keys under the tree's ordering.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K1, typename K2>
+inline int BinarySearchTree<Key, Value, Compare>::compareKeys(const K1& a, const K2& b) const
+{
+    return compareKeys(a, b, UsesThreeWay<Compare, K1, K2>());
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K1, typename K2>
+inline int BinarySearchTree<Key, Value, Compare>::compareKeys(const K1& a, const K2& b, std::true_type) const
+{
+    return threeWayCompare(a, b);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K1, typename K2>
+inline int BinarySearchTree<Key, Value, Compare>::compareKeys(const K1& a, const K2& b, std::false_type) const
+{
+    return compare_(a, b) ? -1 : compare_(b, a) ? 1 : 0;
+}
+
+/**
+* Returns the node with the smallest key that is not less than key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K>
+inline NodeType* BinarySearchTree<Key, Value, Compare>::lowerBoundNode(NodeType* root, const K& key) const
+{
+    NodeType* best = nullptr;
+    NodeType* temp = root;
+
+    while(temp != nullptr){
+
+        if(compare_(temp->getKey(), key)){
+
+            temp = temp->getRight();
+
+        }
+        else{
+
+            best = temp;
+            temp = temp->getLeft();
+
+        }
+    }
+
+    return best;
+}
+
+/**
+* Returns the node with the smallest key greater than key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K>
+inline NodeType* BinarySearchTree<Key, Value, Compare>::upperBoundNode(NodeType* root, const K& key) const
+{
+    NodeType* best = nullptr;
+    NodeType* temp = root;
+
+    while(temp != nullptr){
+
+        if(compare_(key, temp->getKey())){
+
+            best = temp;
+            temp = temp->getLeft();
+
+        }
+        else{
+
+            temp = temp->getRight();
+
+        }
+    }
+
+    return best;
+}
+
+/**
+* Returns the node with the largest key that is not greater than key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K>
+inline NodeType* BinarySearchTree<Key, Value, Compare>::floorNode(NodeType* root, const K& key) const
+{
+    NodeType* best = nullptr;
+    NodeType* temp = root;
+
+    while(temp != nullptr){
+
+        if(compare_(key, temp->getKey())){
+
+            temp = temp->getLeft();
+
+        }
+        else{
+
+            best = temp;
+            temp = temp->getRight();
+
+        }
+    }
+
+    return best;
+}
+
 /**
  * Return true iff the BST is balanced.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Compare>
+bool BinarySearchTree<Key, Value, Compare>::isBalanced() const
 {
     // TODO
     bool isBalanced = true;
@@ -742,39 +2497,65 @@ bool BinarySearchTree<Key, Value>::isBalanced() const
     return isBalanced;
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::isBalancedHelper(Node<Key, Value>* temp, bool& isBalanced) const{   // gives you the height of a particular node
+/**
+* Returns the height of the subtree at root (-1 if empty) and clears isBalanced if the heights
+* of the two children of any node differ by more than one. A post-order walk with an explicit
+* stack, so a degenerate tree of any depth is fine.
+*/
+template<typename Key, typename Value, typename Compare>
+int BinarySearchTree<Key, Value, Compare>::isBalancedHelper(Node<Key, Value>* root, bool& isBalanced) const{   // gives you the height of a particular node
 
-    // if(isBalanced == false){
-    //     return 0;
-    // }
+    const int LEFT_PENDING = -2;
 
-    if(temp == nullptr){ 
+    // each entry is a node on the current path and the height of its left subtree
+    std::vector<std::pair<Node<Key, Value>*, int> > path;
+    int height = -1;    // height of the subtree finished last
+    Node<Key, Value>* temp = root;
 
-        return -1;
+    while(true){
 
-    }
-    int hLeft = isBalancedHelper(temp->getLeft(), isBalanced);
+        while(temp != nullptr){
+            path.push_back(std::make_pair(temp, LEFT_PENDING));
+            temp = temp->getLeft();
+        }
+        height = -1;
+
+        // climb until some node still has its right subtree to do
+        while(!path.empty() && path.back().second != LEFT_PENDING){
 
-    int hRight = isBalancedHelper(temp->getRight(), isBalanced);
+            int hLeft = path.back().second;
+            int hRight = height;
 
-    if(abs(hLeft - hRight) > 1){
+            if(abs(hLeft - hRight) > 1){
 
-        isBalanced = false;
+                isBalanced = false;
+
+            }
 
+            height = std::max(hLeft, hRight) + 1;
+            path.pop_back();
+        }
+
+        if(path.empty()){
+            return height;
+        }
+
+        path.back().second = height;
+        temp = path.back().first->getRight();
     }
-    
-    return std::max(hLeft, hRight) + 1;
 }
 
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
+    if(n1 == rightmost_ || n2 == rightmost_){
+        rightmost_ = nullptr;
+    }
     Node<Key, Value>* n1p = n1->getParent();
     Node<Key, Value>* n1r = n1->getRight();
     Node<Key, Value>* n1lt = n1->getLeft();
@@ -867,6 +2648,9 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
 // include print function (in its own file because it's fairly long)
 #include "print_bst.h"
 
+// the read-only Eytzinger copy made by freeze()
+#include "frozen_bst.h"
+
 /*
 ---------------------------------------------------
 End implementations for the BinarySearchTree class.
@@ -0,0 +1,592 @@
+#ifndef CONCURRENT_AVLBST_H
+#define CONCURRENT_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <utility>
+#include "node_arena.h"
+#include "epoch_reclaim.h"
+
+/**
+* An AVL tree that many threads can read while one thread writes, with no locks on the read
+* path.
+*
+* Published nodes are never modified. A write copies the nodes on its search path, plus any
+* node a rotation touches that is not on the path, builds the new shape out of the copies, and
+* then publishes it with a single atomic store of the root. Readers load the root once and
+* therefore always walk one consistent version of the tree, however many rotations the writer
+* makes meanwhile. The nodes a write replaces are retired and freed through an EpochManager
+* once no reader can still be walking an older version.
+*
+* find() and for_each_in_range() may run on any number of threads. insert(), remove() and
+* clear() serialize on a writer mutex, so any thread may write but only one at a time. Each
+* write allocates O(log n) nodes and copies their items, which is the price of lock-free
+* reads; Key and Value should be cheap to copy. The destructor must not race with readers.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    explicit ConcurrentAVLTree(const Compare& comp);
+    ~ConcurrentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    template<typename Function>
+    void for_each_in_range(const Key& first, const Key& last, Function fn) const;
+
+    std::size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+
+protected:
+    struct Node
+    {
+        Node(const std::pair<const Key, Value>& item, std::size_t stamp);
+
+        std::pair<const Key, Value> item;
+        Node* left;
+        Node* right;
+        int height;
+        std::size_t stamp;   // the write that created the node; it is private to that write
+    };
+
+    struct Retired
+    {
+        std::size_t epoch;
+        Node* node;
+        bool subtree;        // free the whole subtree below node, not just node
+    };
+
+    // An AVL tree of 2^64 nodes is less than 93 levels high.
+    static const int MAX_HEIGHT = 96;
+
+    Node* createNode(const std::pair<const Key, Value>& item);
+    Node* own(Node* node);
+    void retire(Node* node, bool subtree = false);
+    void reclaim();
+    void destroyNode(Node* node);
+    void destroySubtree(Node* node);
+
+    Node* insertAt(Node* node, const std::pair<const Key, Value>& keyValuePair, bool& added);
+    Node* removeAt(Node* node, const Key& key, bool& removed);
+    Node* removeMin(Node* node, Node*& min);
+    Node* rebalance(Node* node);
+    Node* rotateLeft(Node* node);
+    Node* rotateRight(Node* node);
+    static int heightOf(const Node* node);
+    static void updateHeight(Node* node);
+    int checkHeight(const Node* node) const;
+
+    // Writes between two attempts to move the epoch on and free retired nodes.
+    static const std::size_t RECLAIM_INTERVAL = 64;
+
+    std::atomic<Node*> root_;
+    std::atomic<std::size_t> size_;
+    mutable EpochManager epochs_;
+    std::mutex writerMutex_;
+    NodeArena arena_;                // used by the writer only
+    std::deque<Retired> retired_;    // in epoch order
+    std::size_t writeStamp_;
+    Compare compare_;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree<Key, Value, Compare>&);
+    ConcurrentAVLTree<Key, Value, Compare>& operator=(const ConcurrentAVLTree<Key, Value, Compare>&);
+};
+
+/*
+------------------------------------------------------
+Begin implementations for the ConcurrentAVLTree class.
+------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+const int ConcurrentAVLTree<Key, Value, Compare>::MAX_HEIGHT;
+
+template<typename Key, typename Value, typename Compare>
+const std::size_t ConcurrentAVLTree<Key, Value, Compare>::RECLAIM_INTERVAL;
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Node::Node(const std::pair<const Key, Value>& item, std::size_t stamp) :
+    item(item),
+    left(nullptr),
+    right(nullptr),
+    height(1),
+    stamp(stamp)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree() :
+    root_(nullptr),
+    size_(0),
+    writeStamp_(0),
+    compare_()
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const Compare& comp) :
+    root_(nullptr),
+    size_(0),
+    writeStamp_(0),
+    compare_(comp)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    for(std::size_t i = 0; i < retired_.size(); ++i){
+        if(retired_[i].subtree){
+            destroySubtree(retired_[i].node);
+        }
+        else{
+            destroyNode(retired_[i].node);
+        }
+    }
+    destroySubtree(root_.load());
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Copies the value stored under key into value and returns true, or returns false if the key
+* is not in the tree. Takes no locks.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    EpochManager::Guard guard(epochs_);
+    const Node* n = root_.load();
+    while(n != nullptr){
+        if(compare_(key, n->item.first)){
+            n = n->left;
+        }
+        else if(compare_(n->item.first, key)){
+            n = n->right;
+        }
+        else{
+            value = n->item.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    EpochManager::Guard guard(epochs_);
+    const Node* n = root_.load();
+    while(n != nullptr){
+        if(compare_(key, n->item.first)){
+            n = n->left;
+        }
+        else if(compare_(n->item.first, key)){
+            n = n->right;
+        }
+        else{
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Calls fn on every item with a key in [first, last), in key order. The whole scan sees one
+* version of the tree: writes that land meanwhile are either all visible or not at all. fn
+* runs with the epoch pinned, so a long scan holds back reclamation, not the writer.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename Function>
+void ConcurrentAVLTree<Key, Value, Compare>::for_each_in_range(const Key& first, const Key& last, Function fn) const
+{
+    EpochManager::Guard guard(epochs_);
+    // the ancestors still to visit, nearest on top; nodes are immutable, so no parent links
+    const Node* stack[MAX_HEIGHT];
+    int top = 0;
+    const Node* n = root_.load();
+    while(n != nullptr){
+        if(compare_(n->item.first, first)){
+            n = n->right;
+        }
+        else{
+            stack[top++] = n;
+            n = n->left;
+        }
+    }
+    while(top > 0){
+        n = stack[--top];
+        if(!compare_(n->item.first, last)){
+            return;
+        }
+        const std::pair<const Key, Value>& item = n->item;
+        fn(item);
+        for(n = n->right; n != nullptr; n = n->left){
+            stack[top++] = n;
+        }
+    }
+}
+
+/**
+* Puts keyValuePair into the tree, overwriting the value if the key is already present, and
+* publishes the result.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    ++writeStamp_;
+    bool added = false;
+    root_.store(insertAt(root_.load(std::memory_order_relaxed), keyValuePair, added));
+    if(added){
+        size_.fetch_add(1, std::memory_order_relaxed);
+    }
+    reclaim();
+}
+
+/**
+* Removes the item with the given key, if any, and publishes the result.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    ++writeStamp_;
+    bool removed = false;
+    Node* root = removeAt(root_.load(std::memory_order_relaxed), key, removed);
+    if(!removed){
+        return;
+    }
+    root_.store(root);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    reclaim();
+}
+
+/**
+* Empties the tree. Readers already walking the old tree finish undisturbed; its nodes are
+* retired as one unit.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clear()
+{
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    ++writeStamp_;
+    Node* old = root_.load(std::memory_order_relaxed);
+    root_.store(nullptr);
+    size_.store(0, std::memory_order_relaxed);
+    if(old != nullptr){
+        retire(old, true);
+    }
+    reclaim();
+}
+
+/**
+* Checks heights and balance factors of the current version. Meant for tests; takes no locks.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    EpochManager::Guard guard(epochs_);
+    return checkHeight(root_.load()) >= 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::checkHeight(const Node* node) const
+{
+    if(node == nullptr){
+        return 0;
+    }
+    if((node->left != nullptr && !compare_(node->left->item.first, node->item.first))
+       || (node->right != nullptr && !compare_(node->item.first, node->right->item.first))){
+        return -1;
+    }
+    int left = checkHeight(node->left);
+    int right = checkHeight(node->right);
+    if(left < 0 || right < 0 || left - right > 1 || right - left > 1 || node->height != 1 + std::max(left, right)){
+        return -1;
+    }
+    return node->height;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::insertAt(Node* node, const std::pair<const Key, Value>& keyValuePair, bool& added)
+{
+    if(node == nullptr){
+        added = true;
+        return createNode(keyValuePair);
+    }
+    if(compare_(keyValuePair.first, node->item.first)){
+        Node* left = insertAt(node->left, keyValuePair, added);
+        node = own(node);
+        node->left = left;
+    }
+    else if(compare_(node->item.first, keyValuePair.first)){
+        Node* right = insertAt(node->right, keyValuePair, added);
+        node = own(node);
+        node->right = right;
+    }
+    else{
+        node = own(node);
+        node->item.second = keyValuePair.second;
+        return node;
+    }
+    return rebalance(node);
+}
+
+/**
+* Returns node's subtree without key. The path down is only copied once the key is known to
+* be there, so removing a missing key allocates nothing.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::removeAt(Node* node, const Key& key, bool& removed)
+{
+    if(node == nullptr){
+        return nullptr;
+    }
+    if(compare_(key, node->item.first)){
+        Node* left = removeAt(node->left, key, removed);
+        if(!removed){
+            return node;
+        }
+        node = own(node);
+        node->left = left;
+    }
+    else if(compare_(node->item.first, key)){
+        Node* right = removeAt(node->right, key, removed);
+        if(!removed){
+            return node;
+        }
+        node = own(node);
+        node->right = right;
+    }
+    else{
+        removed = true;
+        if(node->left == nullptr || node->right == nullptr){
+            Node* child = (node->left != nullptr) ? node->left : node->right;
+            retire(node);
+            return child;
+        }
+        // two children: the successor's item takes node's place
+        Node* min;
+        Node* right = removeMin(node->right, min);
+        Node* replacement = createNode(min->item);
+        replacement->left = node->left;
+        replacement->right = right;
+        retire(min);
+        retire(node);
+        node = replacement;
+    }
+    return rebalance(node);
+}
+
+/**
+* Returns node's subtree without its smallest node, which is handed back through min
+* untouched.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::removeMin(Node* node, Node*& min)
+{
+    if(node->left == nullptr){
+        min = node;
+        return node->right;
+    }
+    Node* left = removeMin(node->left, min);
+    node = own(node);
+    node->left = left;
+    return rebalance(node);
+}
+
+/**
+* Restores the AVL property at node, which must belong to the current write. Children that a
+* rotation rearranges are copied first if they are still published.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rebalance(Node* node)
+{
+    int balance = heightOf(node->left) - heightOf(node->right);
+    if(balance > 1){
+        Node* left = own(node->left);
+        if(heightOf(left->left) < heightOf(left->right)){
+            left = rotateLeft(left);
+        }
+        node->left = left;
+        return rotateRight(node);
+    }
+    if(balance < -1){
+        Node* right = own(node->right);
+        if(heightOf(right->right) < heightOf(right->left)){
+            right = rotateRight(right);
+        }
+        node->right = right;
+        return rotateLeft(node);
+    }
+    updateHeight(node);
+    return node;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeft(Node* node)
+{
+    Node* right = own(node->right);
+    node->right = right->left;
+    right->left = node;
+    updateHeight(node);
+    updateHeight(right);
+    return right;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRight(Node* node)
+{
+    Node* left = own(node->left);
+    node->left = left->right;
+    left->right = node;
+    updateHeight(node);
+    updateHeight(left);
+    return left;
+}
+
+template<typename Key, typename Value, typename Compare>
+inline int ConcurrentAVLTree<Key, Value, Compare>::heightOf(const Node* node)
+{
+    return (node == nullptr) ? 0 : node->height;
+}
+
+template<typename Key, typename Value, typename Compare>
+inline void ConcurrentAVLTree<Key, Value, Compare>::updateHeight(Node* node)
+{
+    node->height = 1 + std::max(heightOf(node->left), heightOf(node->right));
+}
+
+/**
+* Returns a node the current write may modify: node itself if this write created it,
+* otherwise a copy, with the published original retired.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::own(Node* node)
+{
+    if(node->stamp == writeStamp_){
+        return node;
+    }
+    Node* copy = createNode(node->item);
+    copy->left = node->left;
+    copy->right = node->right;
+    copy->height = node->height;
+    retire(node);
+    return copy;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::createNode(const std::pair<const Key, Value>& item)
+{
+    return new(arena_.allocate(sizeof(Node))) Node(item, writeStamp_);
+}
+
+/**
+* Hands a node that is no longer part of the tree to reclamation. Nodes the current write
+* created were never published and go straight back to the arena.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::retire(Node* node, bool subtree)
+{
+    if(!subtree && node->stamp == writeStamp_){
+        destroyNode(node);
+        return;
+    }
+    Retired r = { epochs_.epoch(), node, subtree };
+    retired_.push_back(r);
+}
+
+/**
+* Every RECLAIM_INTERVAL writes, tries to move the epoch on and frees the retired nodes no
+* reader can reach any more.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::reclaim()
+{
+    if(writeStamp_ % RECLAIM_INTERVAL != 0 || retired_.empty()){
+        return;
+    }
+    std::size_t safe = epochs_.reclaimableBefore();
+    while(!retired_.empty() && retired_.front().epoch < safe){
+        if(retired_.front().subtree){
+            destroySubtree(retired_.front().node);
+        }
+        else{
+            destroyNode(retired_.front().node);
+        }
+        retired_.pop_front();
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::destroyNode(Node* node)
+{
+    node->~Node();
+    arena_.deallocate(node);
+}
+
+/**
+* Frees node and everything below it without recursion, reusing the freed nodes' left links
+* as the to-do list.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::destroySubtree(Node* node)
+{
+    while(node != nullptr){
+        if(node->left != nullptr){
+            // rotate the left child up so node is reached again with one less left descendant
+            Node* left = node->left;
+            node->left = left->right;
+            left->right = node;
+            node = left;
+        }
+        else{
+            Node* right = node->right;
+            destroyNode(node);
+            node = right;
+        }
+    }
+}
+
+/*
+----------------------------------------------------
+End implementations for the ConcurrentAVLTree class.
+----------------------------------------------------
+*/
+
+#endif
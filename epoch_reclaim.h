@@ -0,0 +1,166 @@
+#ifndef EPOCH_RECLAIM_H
+#define EPOCH_RECLAIM_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+
+/**
+* Epoch-based reclamation for structures whose readers take no locks.
+*
+* A reader pins the current global epoch in one of a fixed set of slots for as long as it
+* holds pointers into the structure (enter()/exit(), or a Guard). The writer tags memory it
+* unlinks with the epoch current at that time, and asks reclaimableBefore() which tags are
+* now safe: the global epoch only moves from e to e + 1 once every pinned slot shows e, so
+* by the time it reaches e + 2 no reader can still be looking at anything unlinked during e.
+*
+* Slots are picked by hashing the thread id, so a thread keeps landing on the same cache line
+* and readers on different cores do not share one. With more concurrent readers than SLOTS,
+* enter() waits for a slot to come free.
+*
+* The manager does not own any memory itself; the structure keeps its own retire lists. A
+* guard owns its slot until it ends, so structures with many writers can keep one list per
+* slot and retire without sharing a lock.
+*/
+class EpochManager
+{
+public:
+    /**
+    * Pins the epoch for the lifetime of the guard.
+    */
+    class Guard
+    {
+    public:
+        explicit Guard(EpochManager& manager);
+        ~Guard();
+
+        std::size_t slot() const;
+
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+
+        EpochManager& manager_;
+        std::size_t slot_;
+    };
+
+    EpochManager();
+
+    std::size_t enter();
+    void exit(std::size_t slot);
+    std::size_t epoch() const;
+    std::size_t reclaimableBefore();
+
+    static const std::size_t SLOTS = 128;
+
+private:
+    EpochManager(const EpochManager&);
+    EpochManager& operator=(const EpochManager&);
+
+    static const std::size_t IDLE = 0;
+
+    // One slot per cache line so readers on different cores do not false-share.
+    struct alignas(64) Slot
+    {
+        std::atomic<std::size_t> epoch;
+    };
+
+    Slot slots_[SLOTS];
+    std::atomic<std::size_t> epoch_;
+};
+
+/*
+--------------------------------------------------
+Begin implementations for the EpochManager class.
+--------------------------------------------------
+*/
+
+inline EpochManager::Guard::Guard(EpochManager& manager) :
+    manager_(manager),
+    slot_(manager.enter())
+{
+
+}
+
+inline EpochManager::Guard::~Guard()
+{
+    manager_.exit(slot_);
+}
+
+/**
+* The slot this guard pinned, which no other guard uses until this one ends.
+*/
+inline std::size_t EpochManager::Guard::slot() const
+{
+    return slot_;
+}
+
+inline EpochManager::EpochManager() :
+    epoch_(IDLE + 1)
+{
+    for(std::size_t i = 0; i < SLOTS; ++i){
+        slots_[i].epoch.store(IDLE, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Claims a free slot and pins the current epoch in it. Returns the slot for exit().
+*
+* Everything is sequentially consistent, so a reader whose claim the writer did not see
+* while advancing is ordered after that check, and its loads see what the writer published
+* before it.
+*/
+inline std::size_t EpochManager::enter()
+{
+    static thread_local std::size_t home = std::hash<std::thread::id>()(std::this_thread::get_id()) % SLOTS;
+    for(std::size_t i = 0; ; ++i){
+        Slot& slot = slots_[(home + i) % SLOTS];
+        std::size_t idle = IDLE;
+        if(slot.epoch.load(std::memory_order_relaxed) == IDLE
+           && slot.epoch.compare_exchange_strong(idle, epoch_.load())){
+            return (home + i) % SLOTS;
+        }
+        if(i % SLOTS == SLOTS - 1){
+            std::this_thread::yield();
+        }
+    }
+}
+
+inline void EpochManager::exit(std::size_t slot)
+{
+    slots_[slot].epoch.store(IDLE, std::memory_order_release);
+}
+
+inline std::size_t EpochManager::epoch() const
+{
+    return epoch_.load();
+}
+
+/**
+* Moves the global epoch on if every pinned reader has caught up with it, and returns the
+* epoch e such that anything retired in an epoch before e can no longer be reached by any
+* reader. Any thread may call this; the epoch only ever moves on by one from a value every
+* pinned slot was seen at.
+*/
+inline std::size_t EpochManager::reclaimableBefore()
+{
+    std::size_t current = epoch_.load();
+    bool caughtUp = true;
+    for(std::size_t i = 0; i < SLOTS && caughtUp; ++i){
+        std::size_t pinned = slots_[i].epoch.load();
+        caughtUp = (pinned == IDLE || pinned == current);
+    }
+    if(caughtUp){
+        epoch_.compare_exchange_strong(current, current + 1);
+    }
+    return epoch_.load() - 1;
+}
+
+/*
+------------------------------------------------
+End implementations for the EpochManager class.
+------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,639 @@
+#ifndef FROZEN_BST_H
+#define FROZEN_BST_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "tree_image.h"
+
+/**
+* A read-only copy of a tree's contents, made by BinarySearchTree::freeze(). The keys sit in
+* one array in Eytzinger (breadth-first) order: slot 1 is the root and slot k has its children
+* in slots 2k and 2k+1. The values are kept in a parallel array at the same positions. A lookup
+* therefore walks one contiguous array instead of chasing node pointers, the top levels of
+* every search share the same few cache lines, and the grandchildren several levels down are
+* prefetched while the current key is compared. The step to the next level is computed from
+* the comparison instead of branched on, so there are no mispredictions to pay for either.
+*
+* Lookups have the tree's semantics: find() returns end() for a missing key, lower_bound() and
+* upper_bound() the first element not less / greater than the key. The contents never change;
+* freeze the tree again to pick up later updates.
+*
+* The two arrays are also the on-disk format: save() writes them out as a tree image (see
+* TreeImageHeader), and map() serves lookups straight from a memory mapping of such a file
+* without copying or rebuilding anything. Copies of a FrozenTree share its arrays.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    /**
+    * Iterates over the elements in key order. Keys and values live in different arrays, so
+    * dereferencing yields a pair of references rather than a reference to a stored pair.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key&, const Value&> reference;
+
+        // operator-> has to return something that outlives the call, so it hands out a copy
+        // of the reference pair
+        struct pointer
+        {
+            reference ref;
+            const reference* operator->() const { return &ref; }
+        };
+
+        const_iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+        const Key& key() const;
+        const Value& value() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class FrozenTree<Key, Value, Compare>;
+        const_iterator(std::size_t slot, const FrozenTree<Key, Value, Compare>* tree);
+        std::size_t slot_;   // Eytzinger slot, 0 for end()
+        const FrozenTree<Key, Value, Compare>* tree_;
+    };
+    typedef const_iterator iterator;
+
+    FrozenTree();
+    explicit FrozenTree(const Compare& comp);
+
+    // Takes count elements in ascending key order, without duplicates, from first.
+    template<typename InputIt>
+    void assign(InputIt first, std::size_t count);
+
+    // Tree images, for trivially copyable Key and Value only.
+    void save(const std::string& path) const;
+    void map(const std::string& path, bool verify = true);
+
+    bool empty() const;
+    std::size_t size() const;
+    Compare key_comp() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    std::size_t count(const Key& key) const;
+
+    // Heterogeneous versions, only there if Compare declares is_transparent.
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator upper_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::size_t count(const K& key) const;
+
+protected:
+    template<typename K>
+    std::size_t lowerBoundSlot(const K& key) const;
+    template<typename K>
+    std::size_t upperBoundSlot(const K& key) const;
+    template<typename K>
+    std::size_t findSlot(const K& key) const;
+    static std::size_t climbRightEdge(std::size_t k);
+    static std::size_t climbLeftEdge(std::size_t k);
+    static std::size_t firstSlot(std::size_t n);
+    static std::size_t lastSlot(std::size_t n);
+    static std::size_t nextSlot(std::size_t k, std::size_t n);
+    static std::size_t prevSlot(std::size_t k, std::size_t n);
+    static void prefetch(const void* address);
+
+    // How far ahead the search prefetches: the descendants PREFETCH_SPAN levels down are
+    // PREFETCH_SPAN slots next to each other, which is sized to fit a 64-byte cache line.
+    static const std::size_t PREFETCH_SPAN = (sizeof(Key) <= 4) ? 16 : (sizeof(Key) <= 8) ? 8 : (sizeof(Key) <= 16) ? 4 : 2;
+
+    // The arrays assign() fills; a mapped image keeps its TreeImageFile instead.
+    struct Arrays
+    {
+        std::vector<Key> keys;
+        std::vector<Value> values;
+    };
+
+    const Key* keys_;                      // slot 0 is unused, so the root is slot 1
+    const Value* values_;
+    std::shared_ptr<const void> storage_;  // owns what keys_ and values_ point into
+    std::size_t size_;
+    Compare compare_;
+};
+
+/*
+------------------------------------------------------------------
+Begin implementations for the FrozenTree::const_iterator class.
+------------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    slot_(0),
+    tree_(nullptr)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::const_iterator::const_iterator(std::size_t slot, const FrozenTree<Key, Value, Compare>* tree) :
+    slot_(slot),
+    tree_(tree)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator::reference
+FrozenTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return reference(tree_->keys_[slot_], tree_->values_[slot_]);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator::pointer
+FrozenTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    pointer p = { **this };
+    return p;
+}
+
+template<typename Key, typename Value, typename Compare>
+const Key& FrozenTree<Key, Value, Compare>::const_iterator::key() const
+{
+    return tree_->keys_[slot_];
+}
+
+template<typename Key, typename Value, typename Compare>
+const Value& FrozenTree<Key, Value, Compare>::const_iterator::value() const
+{
+    return tree_->values_[slot_];
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return slot_ == rhs.slot_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return slot_ != rhs.slot_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator&
+FrozenTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    slot_ = tree_->nextSlot(slot_, tree_->size_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back; --end() is the last element.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator&
+FrozenTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    slot_ = (slot_ == 0) ? tree_->lastSlot(tree_->size_) : tree_->prevSlot(slot_, tree_->size_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old = *this;
+    --(*this);
+    return old;
+}
+
+/*
+----------------------------------------------------------------
+End implementations for the FrozenTree::const_iterator class.
+----------------------------------------------------------------
+*/
+
+/*
+---------------------------------------------
+Begin implementations for the FrozenTree class.
+---------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+const std::size_t FrozenTree<Key, Value, Compare>::PREFETCH_SPAN;
+
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree() :
+    keys_(nullptr),
+    values_(nullptr),
+    size_(0),
+    compare_()
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree(const Compare& comp) :
+    keys_(nullptr),
+    values_(nullptr),
+    size_(0),
+    compare_(comp)
+{
+
+}
+
+/**
+* Replaces the contents with count elements read from first, which must come in ascending key
+* order without duplicates. Walking the implicit tree in order while reading the input puts
+* every element straight into its slot, so this is O(n) with no sorting. Key and Value have
+* to be default constructible and copy assignable.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename InputIt>
+void FrozenTree<Key, Value, Compare>::assign(InputIt first, std::size_t count)
+{
+    std::shared_ptr<Arrays> arrays = std::make_shared<Arrays>();
+    std::vector<Key>& keys = arrays->keys;
+    std::vector<Value>& values = arrays->values;
+    keys.resize(count + 1);
+    values.resize(count + 1);
+
+    std::size_t slot = firstSlot(count);
+    for(std::size_t i = 0; i < count; ++i, ++first){
+        keys[slot] = first->first;
+        values[slot] = first->second;
+        slot = nextSlot(slot, count);
+    }
+
+    keys_ = keys.data();
+    values_ = values.data();
+    storage_ = arrays;
+    size_ = count;
+}
+
+/**
+* Writes the contents to path as a tree image. The file is written under a temporary name,
+* synced and then renamed, and the directory is synced after the rename, so a crash or power
+* loss leaves either the earlier image or the complete new one at path. On platforms without
+* fsync only the rename is atomic. Throws std::runtime_error if the file cannot be written.
+*/
+template<typename Key, typename Value, typename Compare>
+void FrozenTree<Key, Value, Compare>::save(const std::string& path) const
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "tree images need trivially copyable keys and values");
+
+    // a tree that was never assigned has no slot 0 to write, so write zeros instead
+    const unsigned char zeros[TREE_IMAGE_ALIGNMENT + sizeof(Key) + sizeof(Value)] = { };
+    const void* keys = (keys_ != nullptr) ? static_cast<const void*>(keys_) : zeros;
+    const void* values = (values_ != nullptr) ? static_cast<const void*>(values_) : zeros;
+    std::size_t keyBytes = (size_ + 1) * sizeof(Key);
+    std::size_t valueBytes = (size_ + 1) * sizeof(Value);
+
+    TreeImageHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, TREE_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = TREE_IMAGE_VERSION;
+    header.byteOrder = TREE_IMAGE_BYTE_ORDER;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.count = size_;
+    header.keysOffset = (sizeof(TreeImageHeader) + TREE_IMAGE_ALIGNMENT - 1) / TREE_IMAGE_ALIGNMENT * TREE_IMAGE_ALIGNMENT;
+    header.valuesOffset = (header.keysOffset + keyBytes + TREE_IMAGE_ALIGNMENT - 1) / TREE_IMAGE_ALIGNMENT * TREE_IMAGE_ALIGNMENT;
+    header.fileSize = header.valuesOffset + valueBytes;
+    header.checksum = treeImageChecksum(header, keys, values);
+
+    std::string temporary = path + ".tmp";
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if(file == nullptr){
+        throw std::runtime_error("cannot create tree image " + temporary);
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+              && std::fwrite(zeros, 1, header.keysOffset - sizeof(header), file) == header.keysOffset - sizeof(header)
+              && std::fwrite(keys, 1, keyBytes, file) == keyBytes
+              && std::fwrite(zeros, 1, header.valuesOffset - header.keysOffset - keyBytes, file)
+                 == header.valuesOffset - header.keysOffset - keyBytes
+              && std::fwrite(values, 1, valueBytes, file) == valueBytes
+              && syncTreeImageFile(file);
+    ok = (std::fclose(file) == 0) && ok;
+    if(!ok || std::rename(temporary.c_str(), path.c_str()) != 0){
+        std::remove(temporary.c_str());
+        throw std::runtime_error("cannot write tree image " + path);
+    }
+    if(!syncTreeImageDirectory(path)){
+        throw std::runtime_error("cannot sync the directory of tree image " + path);
+    }
+}
+
+/**
+* Replaces the contents with the tree image at path, which stays mapped and is searched in
+* place: nothing is copied or rebuilt, so this takes as long as checking the image. With
+* verify set that includes comparing the checksum, which reads the whole file once; without
+* it only the header is checked and pages are read in as lookups reach them. The image must
+* have been saved with the same Key, Value and ordering. Throws std::runtime_error if the
+* file cannot be read or is not such an image.
+*/
+template<typename Key, typename Value, typename Compare>
+void FrozenTree<Key, Value, Compare>::map(const std::string& path, bool verify)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "tree images need trivially copyable keys and values");
+
+    std::shared_ptr<TreeImageFile> file = std::make_shared<TreeImageFile>(path);
+    const TreeImageHeader& header = file->check(sizeof(Key), sizeof(Value), verify);
+    keys_ = reinterpret_cast<const Key*>(file->data() + header.keysOffset);
+    values_ = reinterpret_cast<const Value*>(file->data() + header.valuesOffset);
+    size_ = static_cast<std::size_t>(header.count);
+    storage_ = file;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+Compare FrozenTree<Key, Value, Compare>::key_comp() const
+{
+    return compare_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(firstSlot(size_), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(0, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return const_iterator(findSlot(key), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(lowerBoundSlot(key), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(upperBoundSlot(key), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::count(const Key& key) const
+{
+    return (findSlot(key) != 0) ? 1 : 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::find(const K& key) const
+{
+    return const_iterator(findSlot(key), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::lower_bound(const K& key) const
+{
+    return const_iterator(lowerBoundSlot(key), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::upper_bound(const K& key) const
+{
+    return const_iterator(upperBoundSlot(key), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+std::size_t FrozenTree<Key, Value, Compare>::count(const K& key) const
+{
+    return (findSlot(key) != 0) ? 1 : 0;
+}
+
+/**
+* The search loop. Every level adds one bit to k: 0 to go left, 1 to go right, taken straight
+* from the comparison. Once k runs off the bottom, the last left turn marks the answer, and
+* dropping the trailing right turns plus that one bit gives its slot (0 if there is none).
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+inline std::size_t FrozenTree<Key, Value, Compare>::lowerBoundSlot(const K& key) const
+{
+    const Key* keys = keys_;
+    std::size_t k = 1;
+    while(k <= size_){
+        if(k * PREFETCH_SPAN <= size_){
+            prefetch(keys + k * PREFETCH_SPAN);
+        }
+        k = 2 * k + static_cast<std::size_t>(compare_(keys[k], key));
+    }
+    return climbRightEdge(k);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+inline std::size_t FrozenTree<Key, Value, Compare>::upperBoundSlot(const K& key) const
+{
+    const Key* keys = keys_;
+    std::size_t k = 1;
+    while(k <= size_){
+        if(k * PREFETCH_SPAN <= size_){
+            prefetch(keys + k * PREFETCH_SPAN);
+        }
+        k = 2 * k + static_cast<std::size_t>(!compare_(key, keys[k]));
+    }
+    return climbRightEdge(k);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+inline std::size_t FrozenTree<Key, Value, Compare>::findSlot(const K& key) const
+{
+    std::size_t k = lowerBoundSlot(key);
+    return (k != 0 && !compare_(key, keys_[k])) ? k : 0;
+}
+
+/**
+* Goes up from k past every step that came from a right child, then one more step: the slot
+* whose left subtree k is the in-order successor position of, or 0 past the right edge.
+*/
+template<typename Key, typename Value, typename Compare>
+inline std::size_t FrozenTree<Key, Value, Compare>::climbRightEdge(std::size_t k)
+{
+#if defined(__GNUC__)
+    return k >> __builtin_ffsll(static_cast<long long>(~k));
+#else
+    while(k & 1){
+        k >>= 1;
+    }
+    return k >> 1;
+#endif
+}
+
+/**
+* The mirror image: past every step that came from a left child, then one more.
+*/
+template<typename Key, typename Value, typename Compare>
+inline std::size_t FrozenTree<Key, Value, Compare>::climbLeftEdge(std::size_t k)
+{
+    while(k != 0 && !(k & 1)){
+        k >>= 1;
+    }
+    return k >> 1;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::firstSlot(std::size_t n)
+{
+    if(n == 0){
+        return 0;
+    }
+    std::size_t k = 1;
+    while(2 * k <= n){
+        k = 2 * k;
+    }
+    return k;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::lastSlot(std::size_t n)
+{
+    if(n == 0){
+        return 0;
+    }
+    std::size_t k = 1;
+    while(2 * k + 1 <= n){
+        k = 2 * k + 1;
+    }
+    return k;
+}
+
+/**
+* The slot after k in key order, in a tree of n slots: the leftmost slot of its right
+* subtree if it has one, otherwise the nearest ancestor it is left of.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::nextSlot(std::size_t k, std::size_t n)
+{
+    if(2 * k + 1 <= n){
+        k = 2 * k + 1;
+        while(2 * k <= n){
+            k = 2 * k;
+        }
+        return k;
+    }
+    return climbRightEdge(k);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::prevSlot(std::size_t k, std::size_t n)
+{
+    if(2 * k <= n){
+        k = 2 * k;
+        while(2 * k + 1 <= n){
+            k = 2 * k + 1;
+        }
+        return k;
+    }
+    return climbLeftEdge(k);
+}
+
+template<typename Key, typename Value, typename Compare>
+inline void FrozenTree<Key, Value, Compare>::prefetch(const void* address)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+}
+
+/*
+-------------------------------------------
+End implementations for the FrozenTree class.
+-------------------------------------------
+*/
+
+/**
+* Copies the tree into a FrozenTree, see there. O(n); the tree itself is not changed.
+*/
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare> BinarySearchTree<Key, Value, Compare>::freeze() const
+{
+    FrozenTree<Key, Value, Compare> frozen(compare_);
+    frozen.assign(begin(), size());
+    return frozen;
+}
+
+/**
+* Writes the tree to path as a tree image, see FrozenTree::save(). Key and Value must be
+* trivially copyable. O(n).
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::save(const std::string& path) const
+{
+    freeze().save(path);
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef KEY_COMPARE_H
+#define KEY_COMPARE_H
+
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if __cplusplus >= 202002L
+#include <compare>
+#include <concepts>
+#endif
+
+/**
+* Returns <0, 0 or >0 as a is less than, equal to or greater than b, with a single
+* comparison of the two keys. Provided for strings (and string views, for heterogeneous
+* lookups) in every language version, and in C++20 for anything with operator<=>.
+*/
+template<typename CharT, typename Traits, typename Alloc>
+inline int threeWayCompare(const std::basic_string<CharT, Traits, Alloc>& a, const std::basic_string<CharT, Traits, Alloc>& b)
+{
+    return a.compare(b);
+}
+
+#if __cplusplus >= 201703L
+template<typename CharT, typename Traits, typename Alloc>
+inline int threeWayCompare(const std::basic_string_view<CharT, Traits>& a, const std::basic_string<CharT, Traits, Alloc>& b)
+{
+    return a.compare(b);
+}
+
+template<typename CharT, typename Traits, typename Alloc>
+inline int threeWayCompare(const std::basic_string<CharT, Traits, Alloc>& a, const std::basic_string_view<CharT, Traits>& b)
+{
+    return a.compare(b);
+}
+#endif
+
+#if __cplusplus >= 202002L
+template<typename A, typename B>
+    requires std::three_way_comparable_with<A, B>
+inline int threeWayCompare(const A& a, const B& b)
+{
+    auto order = a <=> b;
+    return (order < 0) ? -1 : (order > 0) ? 1 : 0;
+}
+#endif
+
+template<typename A, typename B, typename = void>
+struct HasThreeWayCompare : std::false_type
+{
+};
+
+template<typename A, typename B>
+struct HasThreeWayCompare<A, B, decltype(void(threeWayCompare(std::declval<const A&>(), std::declval<const B&>())))> : std::true_type
+{
+};
+
+template<typename Compare>
+struct IsStdLess : std::false_type
+{
+};
+
+template<typename T>
+struct IsStdLess<std::less<T> > : std::true_type
+{
+};
+
+/**
+* Tells whether a tree ordered by Compare can compare a lookup key of type A with a stored
+* key of type B by one threeWayCompare() per node instead of asking Compare up to twice.
+* That needs Compare to be std::less, so the two agree on the order.
+*/
+template<typename Compare, typename A, typename B>
+struct UsesThreeWay : std::integral_constant<bool, IsStdLess<Compare>::value && HasThreeWayCompare<A, B>::value>
+{
+};
+
+#endif
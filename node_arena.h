@@ -0,0 +1,265 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+/**
+* Counters describing the current state of a NodeArena.
+*/
+struct ArenaStats
+{
+    std::size_t blocks;          // blocks obtained from the heap
+    std::size_t liveNodes;       // slots currently handed out to the tree
+    std::size_t freeListLength;  // slots returned by deallocate() and waiting to be reused
+};
+
+/**
+* A slab allocator for tree nodes. Every slot has the same size, which is fixed by the
+* first call to allocate(). Slots are carved out of large contiguous blocks; slots given
+* back with deallocate() go onto an intrusive free list and are reused before the current
+* block is touched again. release() hands all blocks back to the heap at once, so tearing
+* down a tree costs O(blocks) instead of one free() per node.
+*
+* The arena never runs constructors or destructors, that is up to the tree.
+*
+* Trees that hand nodes to each other (split, join) share an arena through a shared_ptr.
+* When two arenas have to become one, merge() moves every block and free slot of one into
+* the other and leaves it behind as a forwarder; holders of the forwarder find the live
+* arena with resolve(). The counters then cover every tree using the arena.
+*/
+class NodeArena
+{
+public:
+    NodeArena();
+    ~NodeArena();
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* slot);
+    void release();
+    ArenaStats stats() const;
+
+    static void merge(const std::shared_ptr<NodeArena>& into, const std::shared_ptr<NodeArena>& from);
+    static const NodeArena* resolve(const NodeArena* arena);
+    static void resolve(std::shared_ptr<NodeArena>& arena);
+
+private:
+    NodeArena(const NodeArena&);
+    NodeArena& operator=(const NodeArena&);
+
+    void grow();
+
+    // Blocks start small so that tiny trees stay tiny, then double up to this many slots.
+    static const std::size_t MIN_BLOCK_SLOTS = 32;
+    static const std::size_t MAX_BLOCK_SLOTS = 8192;
+
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    std::vector<void*> blocks_;
+    std::size_t slotSize_;
+    std::size_t nextBlockSlots_;
+    char* bump_;             // next never-used slot in the newest block
+    std::size_t bumpLeft_;   // never-used slots left in the newest block
+    FreeSlot* freeList_;
+    FreeSlot* freeTail_;
+    std::size_t freeCount_;
+    std::size_t liveCount_;
+    std::shared_ptr<NodeArena> forward_;   // set once this arena has been merged into another
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the NodeArena class.
+  -----------------------------------------------
+*/
+
+inline NodeArena::NodeArena() :
+    slotSize_(0),
+    nextBlockSlots_(MIN_BLOCK_SLOTS),
+    bump_(nullptr),
+    bumpLeft_(0),
+    freeList_(nullptr),
+    freeTail_(nullptr),
+    freeCount_(0),
+    liveCount_(0),
+    forward_()
+{
+
+}
+
+inline NodeArena::~NodeArena()
+{
+    release();
+}
+
+/**
+* Returns uninitialized storage for one node of the given size. The first call decides
+* the slot size for the lifetime of the arena's blocks.
+*/
+inline void* NodeArena::allocate(std::size_t bytes)
+{
+    if(slotSize_ == 0){
+        // round up so every slot stays suitably aligned inside a block
+        const std::size_t align = alignof(std::max_align_t);
+        slotSize_ = ((std::max(bytes, sizeof(FreeSlot)) + align - 1) / align) * align;
+    }
+    else if(bytes > slotSize_){
+        throw std::invalid_argument("NodeArena: allocation larger than the slot size");
+    }
+
+    ++liveCount_;
+
+    // reuse a slot freed by a previous remove before touching fresh memory
+    if(freeList_ != nullptr){
+        FreeSlot* slot = freeList_;
+        freeList_ = slot->next;
+        if(freeList_ == nullptr){
+            freeTail_ = nullptr;
+        }
+        --freeCount_;
+        return slot;
+    }
+
+    if(bumpLeft_ == 0){
+        grow();
+    }
+    void* slot = bump_;
+    bump_ += slotSize_;
+    --bumpLeft_;
+    return slot;
+}
+
+/**
+* Puts a slot back on the free list. The memory is not returned to the heap until release().
+*/
+inline void NodeArena::deallocate(void* slot)
+{
+    if(slot == nullptr){
+        return;
+    }
+    FreeSlot* freed = static_cast<FreeSlot*>(slot);
+    freed->next = freeList_;
+    freeList_ = freed;
+    if(freeTail_ == nullptr){
+        freeTail_ = freed;
+    }
+    ++freeCount_;
+    --liveCount_;
+}
+
+/**
+* Returns every block to the heap. Any node still living in the arena is gone afterwards,
+* so the caller must already have destroyed (or must not care about) its contents.
+*/
+inline void NodeArena::release()
+{
+    for(std::size_t i = 0; i < blocks_.size(); ++i){
+        ::operator delete(blocks_[i]);
+    }
+    blocks_.clear();
+    slotSize_ = 0;
+    nextBlockSlots_ = MIN_BLOCK_SLOTS;
+    bump_ = nullptr;
+    bumpLeft_ = 0;
+    freeList_ = nullptr;
+    freeTail_ = nullptr;
+    freeCount_ = 0;
+    liveCount_ = 0;
+}
+
+inline ArenaStats NodeArena::stats() const
+{
+    ArenaStats s;
+    s.blocks = blocks_.size();
+    s.liveNodes = liveCount_;
+    s.freeListLength = freeCount_;
+    return s;
+}
+
+/**
+* Moves all blocks, free slots and counters of from into into, then turns from into a
+* forwarder to into. Both must already be resolved and hold slots of the same size.
+*/
+inline void NodeArena::merge(const std::shared_ptr<NodeArena>& into, const std::shared_ptr<NodeArena>& from)
+{
+    if(into == from){
+        return;
+    }
+    if(into->slotSize_ == 0){
+        into->slotSize_ = from->slotSize_;
+    }
+    else if(from->slotSize_ != 0 && from->slotSize_ != into->slotSize_){
+        throw std::invalid_argument("NodeArena: cannot merge arenas with different slot sizes");
+    }
+
+    into->blocks_.insert(into->blocks_.end(), from->blocks_.begin(), from->blocks_.end());
+    if(from->freeList_ != nullptr){
+        from->freeTail_->next = into->freeList_;
+        if(into->freeList_ == nullptr){
+            into->freeTail_ = from->freeTail_;
+        }
+        into->freeList_ = from->freeList_;
+    }
+    into->freeCount_ += from->freeCount_;
+    into->liveCount_ += from->liveCount_;
+
+    // the never-used tail of from's newest block is simply left unused
+    from->blocks_.clear();
+    from->slotSize_ = 0;
+    from->bump_ = nullptr;
+    from->bumpLeft_ = 0;
+    from->freeList_ = nullptr;
+    from->freeTail_ = nullptr;
+    from->freeCount_ = 0;
+    from->liveCount_ = 0;
+    from->forward_ = into;
+}
+
+/**
+* Follows forwarders to the arena that actually owns the blocks.
+*/
+inline const NodeArena* NodeArena::resolve(const NodeArena* arena)
+{
+    while(arena->forward_){
+        arena = arena->forward_.get();
+    }
+    return arena;
+}
+
+/**
+* Same as above, but also points the caller's handle straight at the live arena so the
+* forwarders it went through can go away.
+*/
+inline void NodeArena::resolve(std::shared_ptr<NodeArena>& arena)
+{
+    while(arena->forward_){
+        std::shared_ptr<NodeArena> next = arena->forward_;
+        arena = next;
+    }
+}
+
+inline void NodeArena::grow()
+{
+    void* block = ::operator new(slotSize_ * nextBlockSlots_);
+    blocks_.push_back(block);
+    bump_ = static_cast<char*>(block);
+    bumpLeft_ = nextBlockSlots_;
+    if(nextBlockSlots_ < MAX_BLOCK_SLOTS){
+        nextBlockSlots_ *= 2;
+    }
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the NodeArena class.
+  ---------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,1119 @@
+#ifndef OPTIMISTIC_AVLBST_H
+#define OPTIMISTIC_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "epoch_reclaim.h"
+
+/**
+* An AVL tree that any number of threads can insert into, remove from and search at the same
+* time, after Bronson, Casper, Chafi and Olukotun, "A Practical Concurrent Binary Search Tree"
+* (PPoPP 2010).
+*
+* Searches take no locks. Every node carries a version number that a rotation bumps when the
+* node moves down and its subtree loses keys; a search descending from a node rereads that
+* version after reading the child pointer and retries from the parent if it changed. Writers
+* lock only the one or two nodes they change, parent before child. Rebalancing is relaxed: it
+* runs after the update, walking up and fixing heights and rotating one node at a time under
+* the locks of that node, its parent and the child being rotated up, so concurrent writers in
+* different parts of the tree do not wait for each other.
+*
+* Removing a key whose node has two children only clears the node's value and leaves it in
+* place as a routing node; rebalancing unlinks routing nodes once they are down to one child.
+* Values live behind atomic pointers so a search always reads a whole value. Unlinked nodes
+* and replaced values go through an EpochManager and are freed once no operation can still
+* see them.
+*
+* insert(), remove(), find() and contains() are linearizable. size() is only exact when no
+* update is in flight, and isBalanced() is meant for quiescent trees. Key must be default
+* constructible (for the sentinel above the root); nodes come from the heap, since the
+* NodeArena is single threaded.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class OptimisticAVLTree
+{
+public:
+    OptimisticAVLTree();
+    explicit OptimisticAVLTree(const Compare& comp);
+    ~OptimisticAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    std::size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+
+protected:
+    struct Node
+    {
+        Node(const Key& key, Value* value, Node* parent);
+
+        std::atomic<Node*>& child(int dir);
+        void lock();
+        void unlock();
+
+        // what a search reads comes first, to share as few cache lines as possible
+        const Key key;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        std::atomic<std::uint64_t> version;
+        std::atomic<Value*> value;          // NULL for a routing node, whose key is not present
+        std::atomic<Node*> parent;
+        std::atomic<int> height;
+        std::atomic<bool> locked;
+    };
+
+    // Holds a node's lock for the lifetime of the guard.
+    class NodeLock
+    {
+    public:
+        explicit NodeLock(Node* node);
+        ~NodeLock();
+
+    private:
+        NodeLock(const NodeLock&);
+        NodeLock& operator=(const NodeLock&);
+
+        Node* node_;
+    };
+
+    struct Retired
+    {
+        std::size_t epoch;
+        Node* node;
+        Value* value;
+    };
+
+    // What the guards on one epoch slot have retired, in epoch order. Only the thread whose
+    // guard owns the slot touches it, so retiring takes no lock.
+    struct alignas(64) RetireList
+    {
+        std::vector<Retired> items;
+    };
+
+    enum Outcome { RETRY, DONE };
+
+    // Version bits. A node being rotated down is SHRINKING until the rotation is over, and
+    // its version ends up SHRINK_STEP higher; an unlinked node's version is UNLINKED forever.
+    static const std::uint64_t UNLINKED = 1;
+    static const std::uint64_t SHRINKING = 2;
+    static const std::uint64_t SHRINK_STEP = 4;
+
+    // What nodeCondition() can ask for besides a new height.
+    static const int UNLINK_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int NOTHING_REQUIRED = -3;
+
+    // Spins on a changing node before waiting on its lock instead.
+    static const int SPIN_COUNT = 100;
+    // Retirements on one slot between two attempts to free them.
+    static const std::size_t RECLAIM_INTERVAL = 128;
+    // Parents fixHeightAndRebalance() comes back to; more are dropped, which leaves heights
+    // stale (never wrong searches) until a later update passes by.
+    static const std::size_t PENDING_LIMIT = 16;
+
+    int direction(const Key& key, const Node* node) const;
+    static bool isShrinkingOrUnlinked(std::uint64_t version);
+    static bool isUnlinked(std::uint64_t version);
+    static void waitUntilNotChanging(Node* node, std::uint64_t version);
+    static int heightOf(const Node* node);
+
+    Value* lookup(const Key& key) const;
+    Outcome attemptGet(const Key& key, Node* node, int dir, std::uint64_t nodeVersion, Value*& value) const;
+    void update(const Key& key, Value* newValue);
+    Outcome attemptUpdate(std::size_t slot, const Key& key, Value* newValue, Node* parent, Node* node, std::uint64_t nodeVersion, int& sizeDelta);
+    Outcome attemptNodeUpdate(std::size_t slot, Value* newValue, Node* parent, Node* node, int& sizeDelta);
+    bool attemptUnlink(std::size_t slot, Node* parent, Node* node);
+
+    int nodeCondition(Node* node) const;
+    void fixHeightAndRebalance(std::size_t slot, Node* node);
+    Node* fixHeight(Node* node);
+    Node* rebalanceNode(std::size_t slot, Node* parent, Node* node);
+    Node* rebalanceToRight(Node* parent, Node* node, Node* left, int hR0);
+    Node* rebalanceToLeft(Node* parent, Node* node, Node* right, int hL0);
+    Node* rotateRight(Node* parent, Node* node, Node* left, int hR, int hLL, Node* leftRight, int hLR);
+    Node* rotateLeft(Node* parent, Node* node, Node* right, int hL, int hRR, Node* rightLeft, int hRL);
+    Node* rotateRightOverLeft(Node* parent, Node* node, Node* left, int hR, int hLL, Node* leftRight, int hLRL);
+    Node* rotateLeftOverRight(Node* parent, Node* node, Node* right, int hL, int hRR, Node* rightLeft, int hRLR);
+
+    void retire(std::size_t slot, Node* node, Value* value);
+    int checkHeight(const Node* node) const;
+
+    Node holder_;                       // sentinel; the root is its right child
+    std::atomic<std::size_t> size_;
+    mutable EpochManager epochs_;
+    RetireList retired_[EpochManager::SLOTS];
+    Compare compare_;
+
+private:
+    OptimisticAVLTree(const OptimisticAVLTree<Key, Value, Compare>&);
+    OptimisticAVLTree<Key, Value, Compare>& operator=(const OptimisticAVLTree<Key, Value, Compare>&);
+};
+
+/*
+------------------------------------------------------
+Begin implementations for the OptimisticAVLTree class.
+------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+const std::uint64_t OptimisticAVLTree<Key, Value, Compare>::UNLINKED;
+
+template<typename Key, typename Value, typename Compare>
+const std::uint64_t OptimisticAVLTree<Key, Value, Compare>::SHRINKING;
+
+template<typename Key, typename Value, typename Compare>
+const std::uint64_t OptimisticAVLTree<Key, Value, Compare>::SHRINK_STEP;
+
+template<typename Key, typename Value, typename Compare>
+const int OptimisticAVLTree<Key, Value, Compare>::UNLINK_REQUIRED;
+
+template<typename Key, typename Value, typename Compare>
+const int OptimisticAVLTree<Key, Value, Compare>::REBALANCE_REQUIRED;
+
+template<typename Key, typename Value, typename Compare>
+const int OptimisticAVLTree<Key, Value, Compare>::NOTHING_REQUIRED;
+
+template<typename Key, typename Value, typename Compare>
+const int OptimisticAVLTree<Key, Value, Compare>::SPIN_COUNT;
+
+template<typename Key, typename Value, typename Compare>
+const std::size_t OptimisticAVLTree<Key, Value, Compare>::RECLAIM_INTERVAL;
+
+template<typename Key, typename Value, typename Compare>
+const std::size_t OptimisticAVLTree<Key, Value, Compare>::PENDING_LIMIT;
+
+template<typename Key, typename Value, typename Compare>
+OptimisticAVLTree<Key, Value, Compare>::Node::Node(const Key& key, Value* value, Node* parent) :
+    key(key),
+    left(nullptr),
+    right(nullptr),
+    version(0),
+    value(value),
+    parent(parent),
+    height(1),
+    locked(false)
+{
+
+}
+
+/**
+* The left child for negative dir, the right child otherwise.
+*/
+template<typename Key, typename Value, typename Compare>
+inline std::atomic<typename OptimisticAVLTree<Key, Value, Compare>::Node*>&
+OptimisticAVLTree<Key, Value, Compare>::Node::child(int dir)
+{
+    return (dir < 0) ? left : right;
+}
+
+/**
+* A test-and-test-and-set spin lock. Critical sections are a handful of stores, so spinning
+* beats sleeping, but the waiter yields so an oversubscribed machine still makes progress.
+*/
+template<typename Key, typename Value, typename Compare>
+inline void OptimisticAVLTree<Key, Value, Compare>::Node::lock()
+{
+    while(locked.exchange(true, std::memory_order_acquire)){
+        while(locked.load(std::memory_order_relaxed)){
+            std::this_thread::yield();
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+inline void OptimisticAVLTree<Key, Value, Compare>::Node::unlock()
+{
+    locked.store(false, std::memory_order_release);
+}
+
+template<typename Key, typename Value, typename Compare>
+inline OptimisticAVLTree<Key, Value, Compare>::NodeLock::NodeLock(Node* node) :
+    node_(node)
+{
+    node_->lock();
+}
+
+template<typename Key, typename Value, typename Compare>
+inline OptimisticAVLTree<Key, Value, Compare>::NodeLock::~NodeLock()
+{
+    node_->unlock();
+}
+
+template<typename Key, typename Value, typename Compare>
+OptimisticAVLTree<Key, Value, Compare>::OptimisticAVLTree() :
+    holder_(Key(), nullptr, nullptr),
+    size_(0),
+    compare_()
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+OptimisticAVLTree<Key, Value, Compare>::OptimisticAVLTree(const Compare& comp) :
+    holder_(Key(), nullptr, nullptr),
+    size_(0),
+    compare_(comp)
+{
+
+}
+
+/**
+* Frees the tree and everything still waiting for reclamation. No other thread may be using
+* the tree any more.
+*/
+template<typename Key, typename Value, typename Compare>
+OptimisticAVLTree<Key, Value, Compare>::~OptimisticAVLTree()
+{
+    for(std::size_t slot = 0; slot < EpochManager::SLOTS; ++slot){
+        std::vector<Retired>& items = retired_[slot].items;
+        for(std::size_t i = 0; i < items.size(); ++i){
+            delete items[i].node;
+            delete items[i].value;
+        }
+    }
+    std::vector<Node*> pending(1, holder_.right.load());
+    while(!pending.empty()){
+        Node* node = pending.back();
+        pending.pop_back();
+        if(node != nullptr){
+            pending.push_back(node->left.load());
+            pending.push_back(node->right.load());
+            delete node->value.load();
+            delete node;
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t OptimisticAVLTree<Key, Value, Compare>::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Copies the value stored under key into value and returns true, or returns false if the key
+* is not present. Takes no locks.
+*/
+template<typename Key, typename Value, typename Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    EpochManager::Guard guard(epochs_);
+    const Value* found = lookup(key);
+    if(found == nullptr){
+        return false;
+    }
+    value = *found;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    EpochManager::Guard guard(epochs_);
+    return lookup(key) != nullptr;
+}
+
+/**
+* The value stored under key, or NULL. The caller holds an epoch guard for as long as it uses
+* the result.
+*/
+template<typename Key, typename Value, typename Compare>
+Value* OptimisticAVLTree<Key, Value, Compare>::lookup(const Key& key) const
+{
+    Node* holder = const_cast<Node*>(&holder_);
+    while(true){
+        Node* root = holder->right.load();
+        if(root == nullptr){
+            return nullptr;
+        }
+        int dir = direction(key, root);
+        if(dir == 0){
+            return root->value.load();
+        }
+        std::uint64_t version = root->version.load();
+        if(isShrinkingOrUnlinked(version)){
+            waitUntilNotChanging(root, version);
+        }
+        else if(root == holder->right.load()){
+            Value* found;
+            if(attemptGet(key, root, dir, version, found) == DONE){
+                return found;
+            }
+        }
+    }
+}
+
+/**
+* Searches node's subtree in direction dir for key. node was seen at nodeVersion; if that
+* changes, the subtree may no longer hold key's position and the caller has to retry.
+*/
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Outcome
+OptimisticAVLTree<Key, Value, Compare>::attemptGet(const Key& key, Node* node, int dir, std::uint64_t nodeVersion, Value*& value) const
+{
+    while(true){
+        Node* child = node->child(dir).load();
+        if(child == nullptr){
+            if(node->version.load() != nodeVersion){
+                return RETRY;
+            }
+            value = nullptr;
+            return DONE;
+        }
+        int childDir = direction(key, child);
+        if(childDir == 0){
+            value = child->value.load();
+            return DONE;
+        }
+        std::uint64_t childVersion = child->version.load();
+        if(isShrinkingOrUnlinked(childVersion)){
+            waitUntilNotChanging(child, childVersion);
+            if(node->version.load() != nodeVersion){
+                return RETRY;
+            }
+        }
+        else if(child != node->child(dir).load()){
+            if(node->version.load() != nodeVersion){
+                return RETRY;
+            }
+        }
+        else{
+            if(node->version.load() != nodeVersion){
+                return RETRY;
+            }
+            if(attemptGet(key, child, childDir, childVersion, value) == DONE){
+                return DONE;
+            }
+        }
+    }
+}
+
+/**
+* Puts keyValuePair into the tree, overwriting the value if the key is already present.
+*/
+template<typename Key, typename Value, typename Compare>
+void OptimisticAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    update(keyValuePair.first, new Value(keyValuePair.second));
+}
+
+/**
+* Removes the key, if present.
+*/
+template<typename Key, typename Value, typename Compare>
+void OptimisticAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    update(key, nullptr);
+}
+
+/**
+* Stores newValue under key, or removes key if newValue is NULL.
+*/
+template<typename Key, typename Value, typename Compare>
+void OptimisticAVLTree<Key, Value, Compare>::update(const Key& key, Value* newValue)
+{
+    EpochManager::Guard guard(epochs_);
+    int sizeDelta = 0;
+    while(true){
+        Node* root = holder_.right.load();
+        if(root == nullptr){
+            if(newValue == nullptr){
+                break;
+            }
+            NodeLock lock(&holder_);
+            if(holder_.right.load() == nullptr){
+                holder_.right.store(new Node(key, newValue, &holder_));
+                sizeDelta = 1;
+                break;
+            }
+        }
+        else{
+            std::uint64_t version = root->version.load();
+            if(isShrinkingOrUnlinked(version)){
+                waitUntilNotChanging(root, version);
+            }
+            else if(root == holder_.right.load()
+                    && attemptUpdate(guard.slot(), key, newValue, &holder_, root, version, sizeDelta) == DONE){
+                break;
+            }
+        }
+    }
+    if(sizeDelta > 0){
+        size_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if(sizeDelta < 0){
+        size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Continues an update below node, which was seen at nodeVersion as parent's child. New keys
+* are linked in as leaves under the lock of their parent alone.
+*/
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Outcome
+OptimisticAVLTree<Key, Value, Compare>::attemptUpdate(std::size_t slot, const Key& key, Value* newValue, Node* parent, Node* node, std::uint64_t nodeVersion, int& sizeDelta)
+{
+    int dir = direction(key, node);
+    if(dir == 0){
+        return attemptNodeUpdate(slot, newValue, parent, node, sizeDelta);
+    }
+    while(true){
+        Node* child = node->child(dir).load();
+        if(node->version.load() != nodeVersion){
+            return RETRY;
+        }
+        if(child == nullptr){
+            if(newValue == nullptr){
+                return DONE;
+            }
+            Node* damaged;
+            {
+                NodeLock lock(node);
+                if(node->version.load() != nodeVersion){
+                    return RETRY;
+                }
+                if(node->child(dir).load() != nullptr){
+                    // someone else linked a node here first
+                    continue;
+                }
+                node->child(dir).store(new Node(key, newValue, node));
+                sizeDelta = 1;
+                damaged = fixHeight(node);
+            }
+            fixHeightAndRebalance(slot, damaged);
+            return DONE;
+        }
+        std::uint64_t childVersion = child->version.load();
+        if(isShrinkingOrUnlinked(childVersion)){
+            waitUntilNotChanging(child, childVersion);
+        }
+        else if(child == node->child(dir).load()){
+            if(node->version.load() != nodeVersion){
+                return RETRY;
+            }
+            if(attemptUpdate(slot, key, newValue, node, child, childVersion, sizeDelta) == DONE){
+                return DONE;
+            }
+        }
+    }
+}
+
+/**
+* Updates the node holding the key. A removal unlinks the node if it has at most one child,
+* which needs the parent's lock too; otherwise the node just loses its value and stays as a
+* routing node.
+*/
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Outcome
+OptimisticAVLTree<Key, Value, Compare>::attemptNodeUpdate(std::size_t slot, Value* newValue, Node* parent, Node* node, int& sizeDelta)
+{
+    if(newValue == nullptr){
+        if(node->value.load() == nullptr){
+            return DONE;
+        }
+        if(node->left.load() == nullptr || node->right.load() == nullptr){
+            Node* damaged;
+            {
+                NodeLock parentLock(parent);
+                if(isUnlinked(parent->version.load()) || node->parent.load() != parent){
+                    return RETRY;
+                }
+                {
+                    NodeLock nodeLock(node);
+                    Value* previous = node->value.load();
+                    if(previous == nullptr){
+                        return DONE;
+                    }
+                    if(!attemptUnlink(slot, parent, node)){
+                        return RETRY;
+                    }
+                    retire(slot, nullptr, previous);
+                    sizeDelta = -1;
+                }
+                damaged = fixHeight(parent);
+            }
+            fixHeightAndRebalance(slot, damaged);
+            return DONE;
+        }
+    }
+
+    NodeLock lock(node);
+    if(isUnlinked(node->version.load())){
+        return RETRY;
+    }
+    Value* previous = node->value.load();
+    if(newValue == nullptr){
+        if(previous == nullptr){
+            return DONE;
+        }
+        if(node->left.load() == nullptr || node->right.load() == nullptr){
+            // lost a child meanwhile, so it has to be unlinked after all
+            return RETRY;
+        }
+        sizeDelta = -1;
+    }
+    else if(previous == nullptr){
+        sizeDelta = 1;
+    }
+    node->value.store(newValue);
+    if(previous != nullptr){
+        retire(slot, nullptr, previous);
+    }
+    return DONE;
+}
+
+/**
+* Splices node, which has at most one child, out from under parent. Both are locked. Returns
+* false if the shape changed and the caller has to start over.
+*/
+template<typename Key, typename Value, typename Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::attemptUnlink(std::size_t slot, Node* parent, Node* node)
+{
+    Node* parentLeft = parent->left.load();
+    Node* parentRight = parent->right.load();
+    if(parentLeft != node && parentRight != node){
+        return false;
+    }
+    Node* left = node->left.load();
+    Node* right = node->right.load();
+    if(left != nullptr && right != nullptr){
+        return false;
+    }
+    Node* splice = (left != nullptr) ? left : right;
+    if(parentLeft == node){
+        parent->left.store(splice);
+    }
+    else{
+        parent->right.store(splice);
+    }
+    if(splice != nullptr){
+        splice->parent.store(parent);
+    }
+    node->version.store(UNLINKED);
+    node->value.store(nullptr);
+    retire(slot, node, nullptr);
+    return true;
+}
+
+/**
+* Classifies node from an unlocked, possibly inconsistent look at it: a routing node with at
+* most one child should be unlinked, a node out of balance rotated, and a node with a stale
+* height gets the height to store. The answer is only a hint; it is rechecked under locks.
+*/
+template<typename Key, typename Value, typename Compare>
+int OptimisticAVLTree<Key, Value, Compare>::nodeCondition(Node* node) const
+{
+    Node* left = node->left.load();
+    Node* right = node->right.load();
+    if((left == nullptr || right == nullptr) && node->value.load() == nullptr){
+        return UNLINK_REQUIRED;
+    }
+    int height = node->height.load();
+    int hL = heightOf(left);
+    int hR = heightOf(right);
+    int balance = hL - hR;
+    if(balance < -1 || balance > 1){
+        return REBALANCE_REQUIRED;
+    }
+    int repaired = 1 + std::max(hL, hR);
+    return (height != repaired) ? repaired : NOTHING_REQUIRED;
+}
+
+/**
+* Walks up from node repairing heights, rotating and unlinking routing nodes until nothing
+* is left to do. Each step locks only the node (and its parent, for structural changes).
+*
+* A rotation that leaves work below itself (a routing node to unlink, a child still out of
+* balance) carries on down there, but the rotated subtree may have changed height as well, so
+* the parent above the rotation is remembered and revisited once the work below is done.
+*/
+template<typename Key, typename Value, typename Compare>
+void OptimisticAVLTree<Key, Value, Compare>::fixHeightAndRebalance(std::size_t slot, Node* node)
+{
+    Node* pending[PENDING_LIMIT];
+    std::size_t pendingCount = 0;
+    while(true){
+        if(node == nullptr || node->parent.load() == nullptr){
+            if(pendingCount == 0){
+                return;
+            }
+            node = pending[--pendingCount];
+            continue;
+        }
+        int condition = nodeCondition(node);
+        if(condition == NOTHING_REQUIRED || isUnlinked(node->version.load())){
+            node = nullptr;
+            continue;
+        }
+        if(condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED){
+            NodeLock lock(node);
+            node = fixHeight(node);
+        }
+        else{
+            Node* parent = node->parent.load();
+            NodeLock parentLock(parent);
+            if(!isUnlinked(parent->version.load()) && node->parent.load() == parent){
+                NodeLock nodeLock(node);
+                Node* next = rebalanceNode(slot, parent, node);
+                if(next != nullptr && next != parent && next != parent->parent.load() && pendingCount < PENDING_LIMIT){
+                    pending[pendingCount++] = parent;
+                }
+                node = next;
+            }
+        }
+    }
+}
+
+/**
+* Stores node's height if that is all it needs (node is locked). Returns the node that needs
+* attention next: node itself if it needs more, its parent if the height changed, or NULL.
+*/
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Node*
+OptimisticAVLTree<Key, Value, Compare>::fixHeight(Node* node)
+{
+    int condition = nodeCondition(node);
+    if(condition == REBALANCE_REQUIRED || condition == UNLINK_REQUIRED){
+        return node;
+    }
+    if(condition == NOTHING_REQUIRED){
+        return nullptr;
+    }
+    node->height.store(condition);
+    return node->parent.load();
+}
+
+/**
+* Unlinks, rotates or re-heights node under the locks of parent and node. Returns the node
+* that needs attention next, like fixHeight().
+*/
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Node*
+OptimisticAVLTree<Key, Value, Compare>::rebalanceNode(std::size_t slot, Node* parent, Node* node)
+{
+    Node* left = node->left.load();
+    Node* right = node->right.load();
+    if((left == nullptr || right == nullptr) && node->value.load() == nullptr){
+        return attemptUnlink(slot, parent, node) ? fixHeight(parent) : node;
+    }
+    int height = node->height.load();
+    int hL0 = heightOf(left);
+    int hR0 = heightOf(right);
+    int repaired = 1 + std::max(hL0, hR0);
+    int balance = hL0 - hR0;
+    if(balance > 1){
+        return rebalanceToRight(parent, node, left, hR0);
+    }
+    if(balance < -1){
+        return rebalanceToLeft(parent, node, right, hL0);
+    }
+    if(repaired != height){
+        node->height.store(repaired);
+        return fixHeight(parent);
+    }
+    return nullptr;
+}
+
+/**
+* node is left heavy: rotates right, or left-right if left leans the other way.
+*/
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Node*
+OptimisticAVLTree<Key, Value, Compare>::rebalanceToRight(Node* parent, Node* node, Node* left, int hR0)
+{
+    NodeLock leftLock(left);
+    int hL = left->height.load();
+    if(hL - hR0 <= 1){
+        return node;
+    }
+    Node* leftRight = left->right.load();
+    int hLL0 = heightOf(left->left.load());
+    int hLR0 = heightOf(leftRight);
+    if(hLL0 >= hLR0){
+        return rotateRight(parent, node, left, hR0, hLL0, leftRight, hLR0);
+    }
+    {
+        NodeLock leftRightLock(leftRight);
+        int hLR = leftRight->height.load();
+        if(hLL0 >= hLR){
+            return rotateRight(parent, node, left, hR0, hLL0, leftRight, hLR);
+        }
+        int hLRL = heightOf(leftRight->left.load());
+        int balance = hLL0 - hLRL;
+        if(balance >= -1 && balance <= 1){
+            return rotateRightOverLeft(parent, node, left, hR0, hLL0, leftRight, hLRL);
+        }
+    }
+    // the double rotation would leave left unbalanced: straighten left out first
+    return rebalanceToLeft(node, left, leftRight, hLL0);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Node*
+OptimisticAVLTree<Key, Value, Compare>::rebalanceToLeft(Node* parent, Node* node, Node* right, int hL0)
+{
+    NodeLock rightLock(right);
+    int hR = right->height.load();
+    if(hL0 - hR >= -1){
+        return node;
+    }
+    Node* rightLeft = right->left.load();
+    int hRL0 = heightOf(rightLeft);
+    int hRR0 = heightOf(right->right.load());
+    if(hRR0 >= hRL0){
+        return rotateLeft(parent, node, right, hL0, hRR0, rightLeft, hRL0);
+    }
+    {
+        NodeLock rightLeftLock(rightLeft);
+        int hRL = rightLeft->height.load();
+        if(hRR0 >= hRL){
+            return rotateLeft(parent, node, right, hL0, hRR0, rightLeft, hRL);
+        }
+        int hRLR = heightOf(rightLeft->right.load());
+        int balance = hRR0 - hRLR;
+        if(balance >= -1 && balance <= 1){
+            return rotateLeftOverRight(parent, node, right, hL0, hRR0, rightLeft, hRLR);
+        }
+    }
+    return rebalanceToRight(node, right, rightLeft, hRR0);
+}
+
+/**
+* Rotates left up over node; parent, node and left are locked. node is marked as shrinking
+* for the duration, since keys leave its subtree; left only gains keys, so searches passing
+* through it stay valid. Returns the node to look at next.
+*/
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Node*
+OptimisticAVLTree<Key, Value, Compare>::rotateRight(Node* parent, Node* node, Node* left, int hR, int hLL, Node* leftRight, int hLR)
+{
+    std::uint64_t nodeVersion = node->version.load();
+    Node* parentLeft = parent->left.load();
+    node->version.store(nodeVersion | SHRINKING);
+
+    node->left.store(leftRight);
+    left->right.store(node);
+    if(parentLeft == node){
+        parent->left.store(left);
+    }
+    else{
+        parent->right.store(left);
+    }
+    left->parent.store(parent);
+    node->parent.store(left);
+    if(leftRight != nullptr){
+        leftRight->parent.store(node);
+    }
+
+    int hNode = 1 + std::max(hLR, hR);
+    node->height.store(hNode);
+    left->height.store(1 + std::max(hLL, hNode));
+    node->version.store(nodeVersion + SHRINK_STEP);
+
+    int balanceNode = hLR - hR;
+    if(balanceNode < -1 || balanceNode > 1){
+        return node;
+    }
+    if((leftRight == nullptr || hR == 0) && node->value.load() == nullptr){
+        return node;
+    }
+    int balanceLeft = hLL - hNode;
+    if(balanceLeft < -1 || balanceLeft > 1){
+        return left;
+    }
+    if(hLL == 0 && left->value.load() == nullptr){
+        return left;
+    }
+    return fixHeight(parent);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Node*
+OptimisticAVLTree<Key, Value, Compare>::rotateLeft(Node* parent, Node* node, Node* right, int hL, int hRR, Node* rightLeft, int hRL)
+{
+    std::uint64_t nodeVersion = node->version.load();
+    Node* parentLeft = parent->left.load();
+    node->version.store(nodeVersion | SHRINKING);
+
+    node->right.store(rightLeft);
+    right->left.store(node);
+    if(parentLeft == node){
+        parent->left.store(right);
+    }
+    else{
+        parent->right.store(right);
+    }
+    right->parent.store(parent);
+    node->parent.store(right);
+    if(rightLeft != nullptr){
+        rightLeft->parent.store(node);
+    }
+
+    int hNode = 1 + std::max(hL, hRL);
+    node->height.store(hNode);
+    right->height.store(1 + std::max(hNode, hRR));
+    node->version.store(nodeVersion + SHRINK_STEP);
+
+    int balanceNode = hRL - hL;
+    if(balanceNode < -1 || balanceNode > 1){
+        return node;
+    }
+    if((rightLeft == nullptr || hL == 0) && node->value.load() == nullptr){
+        return node;
+    }
+    int balanceRight = hRR - hNode;
+    if(balanceRight < -1 || balanceRight > 1){
+        return right;
+    }
+    if(hRR == 0 && right->value.load() == nullptr){
+        return right;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Rotates leftRight up over left and then over node in one step; parent, node, left and
+* leftRight are locked. node and left both shrink. Either may come out of it as a routing
+* node with one child, which is handed back to be unlinked.
+*/
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Node*
+OptimisticAVLTree<Key, Value, Compare>::rotateRightOverLeft(Node* parent, Node* node, Node* left, int hR, int hLL, Node* leftRight, int hLRL)
+{
+    std::uint64_t nodeVersion = node->version.load();
+    std::uint64_t leftVersion = left->version.load();
+    Node* parentLeft = parent->left.load();
+    Node* leftRightLeft = leftRight->left.load();
+    Node* leftRightRight = leftRight->right.load();
+    int hLRR = heightOf(leftRightRight);
+    node->version.store(nodeVersion | SHRINKING);
+    left->version.store(leftVersion | SHRINKING);
+
+    node->left.store(leftRightRight);
+    left->right.store(leftRightLeft);
+    leftRight->left.store(left);
+    leftRight->right.store(node);
+    if(parentLeft == node){
+        parent->left.store(leftRight);
+    }
+    else{
+        parent->right.store(leftRight);
+    }
+    leftRight->parent.store(parent);
+    left->parent.store(leftRight);
+    node->parent.store(leftRight);
+    if(leftRightRight != nullptr){
+        leftRightRight->parent.store(node);
+    }
+    if(leftRightLeft != nullptr){
+        leftRightLeft->parent.store(left);
+    }
+
+    int hNode = 1 + std::max(hLRR, hR);
+    node->height.store(hNode);
+    int hLeft = 1 + std::max(hLL, hLRL);
+    left->height.store(hLeft);
+    leftRight->height.store(1 + std::max(hLeft, hNode));
+    left->version.store(leftVersion + SHRINK_STEP);
+    node->version.store(nodeVersion + SHRINK_STEP);
+
+    int balanceNode = hLRR - hR;
+    if(balanceNode < -1 || balanceNode > 1){
+        return node;
+    }
+    if((leftRightRight == nullptr || hR == 0) && node->value.load() == nullptr){
+        return node;
+    }
+    if((hLL == 0 || hLRL == 0) && left->value.load() == nullptr){
+        return left;
+    }
+    int balanceTop = hLeft - hNode;
+    if(balanceTop < -1 || balanceTop > 1){
+        return leftRight;
+    }
+    return fixHeight(parent);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Node*
+OptimisticAVLTree<Key, Value, Compare>::rotateLeftOverRight(Node* parent, Node* node, Node* right, int hL, int hRR, Node* rightLeft, int hRLR)
+{
+    std::uint64_t nodeVersion = node->version.load();
+    std::uint64_t rightVersion = right->version.load();
+    Node* parentLeft = parent->left.load();
+    Node* rightLeftLeft = rightLeft->left.load();
+    Node* rightLeftRight = rightLeft->right.load();
+    int hRLL = heightOf(rightLeftLeft);
+    node->version.store(nodeVersion | SHRINKING);
+    right->version.store(rightVersion | SHRINKING);
+
+    node->right.store(rightLeftLeft);
+    right->left.store(rightLeftRight);
+    rightLeft->right.store(right);
+    rightLeft->left.store(node);
+    if(parentLeft == node){
+        parent->left.store(rightLeft);
+    }
+    else{
+        parent->right.store(rightLeft);
+    }
+    rightLeft->parent.store(parent);
+    right->parent.store(rightLeft);
+    node->parent.store(rightLeft);
+    if(rightLeftLeft != nullptr){
+        rightLeftLeft->parent.store(node);
+    }
+    if(rightLeftRight != nullptr){
+        rightLeftRight->parent.store(right);
+    }
+
+    int hNode = 1 + std::max(hL, hRLL);
+    node->height.store(hNode);
+    int hRight = 1 + std::max(hRLR, hRR);
+    right->height.store(hRight);
+    rightLeft->height.store(1 + std::max(hNode, hRight));
+    right->version.store(rightVersion + SHRINK_STEP);
+    node->version.store(nodeVersion + SHRINK_STEP);
+
+    int balanceNode = hRLL - hL;
+    if(balanceNode < -1 || balanceNode > 1){
+        return node;
+    }
+    if((rightLeftLeft == nullptr || hL == 0) && node->value.load() == nullptr){
+        return node;
+    }
+    if((hRR == 0 || hRLR == 0) && right->value.load() == nullptr){
+        return right;
+    }
+    int balanceTop = hRight - hNode;
+    if(balanceTop < -1 || balanceTop > 1){
+        return rightLeft;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* -1, 0 or 1 as key sorts before, with or after node's key.
+*/
+template<typename Key, typename Value, typename Compare>
+inline int OptimisticAVLTree<Key, Value, Compare>::direction(const Key& key, const Node* node) const
+{
+    if(compare_(key, node->key)){
+        return -1;
+    }
+    return compare_(node->key, key) ? 1 : 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+inline bool OptimisticAVLTree<Key, Value, Compare>::isShrinkingOrUnlinked(std::uint64_t version)
+{
+    return (version & (SHRINKING | UNLINKED)) != 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+inline bool OptimisticAVLTree<Key, Value, Compare>::isUnlinked(std::uint64_t version)
+{
+    return (version & UNLINKED) != 0;
+}
+
+/**
+* Waits for a rotation that is shrinking node to finish. The rotation holds node's lock, so
+* after a short spin the wait simply takes the lock. Unlinked nodes never change back; the
+* caller rereads the link that led to them.
+*/
+template<typename Key, typename Value, typename Compare>
+void OptimisticAVLTree<Key, Value, Compare>::waitUntilNotChanging(Node* node, std::uint64_t version)
+{
+    if((version & SHRINKING) == 0){
+        return;
+    }
+    for(int i = 0; i < SPIN_COUNT; ++i){
+        if(node->version.load() != version){
+            return;
+        }
+    }
+    NodeLock lock(node);
+}
+
+template<typename Key, typename Value, typename Compare>
+inline int OptimisticAVLTree<Key, Value, Compare>::heightOf(const Node* node)
+{
+    return (node == nullptr) ? 0 : node->height.load();
+}
+
+/**
+* Queues an unlinked node or a replaced value for freeing on the calling guard's slot, and
+* every RECLAIM_INTERVAL retirements there frees what no operation can reach any more.
+*/
+template<typename Key, typename Value, typename Compare>
+void OptimisticAVLTree<Key, Value, Compare>::retire(std::size_t slot, Node* node, Value* value)
+{
+    std::vector<Retired>& items = retired_[slot].items;
+    Retired r = { epochs_.epoch(), node, value };
+    items.push_back(r);
+    if(items.size() % RECLAIM_INTERVAL != 0){
+        return;
+    }
+    std::size_t safe = epochs_.reclaimableBefore();
+    std::size_t done = 0;
+    while(done < items.size() && items[done].epoch < safe){
+        delete items[done].node;
+        delete items[done].value;
+        ++done;
+    }
+    items.erase(items.begin(), items.begin() + done);
+}
+
+/**
+* Checks order, heights and balance factors. Only meaningful while no update is running.
+*/
+template<typename Key, typename Value, typename Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkHeight(holder_.right.load()) >= 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+int OptimisticAVLTree<Key, Value, Compare>::checkHeight(const Node* node) const
+{
+    if(node == nullptr){
+        return 0;
+    }
+    const Node* left = node->left.load();
+    const Node* right = node->right.load();
+    if((left != nullptr && (!compare_(left->key, node->key) || left->parent.load() != node))
+       || (right != nullptr && (!compare_(node->key, right->key) || right->parent.load() != node))){
+        return -1;
+    }
+    int hL = checkHeight(left);
+    int hR = checkHeight(right);
+    if(hL < 0 || hR < 0 || hL - hR > 1 || hR - hL > 1 || node->height.load() != 1 + std::max(hL, hR)){
+        return -1;
+    }
+    return node->height.load();
+}
+
+/*
+----------------------------------------------------
+End implementations for the OptimisticAVLTree class.
+----------------------------------------------------
+*/
+
+#endif
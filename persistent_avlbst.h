@@ -0,0 +1,628 @@
+#ifndef PERSISTENT_AVLBST_H
+#define PERSISTENT_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+/**
+* An AVL tree whose snapshot() is O(1): it returns a read-only view of the current contents
+* that stays valid, and unchanged, however the tree is modified afterwards.
+*
+* Nodes carry a reference count instead of a parent pointer, so one node can sit in the tree
+* and in any number of snapshots at once. A write walks down its path and copies each node
+* that is shared, rewiring the copy to the children the original had; everything off the path
+* stays shared. A node referenced only once, through a path of such nodes, cannot be seen by
+* any snapshot and is modified in place, so a tree without live snapshots writes like an
+* ordinary AVL tree and one snapshot costs at most one copy of each node the following writes
+* touch. A node is freed when the last tree or snapshot referring to it lets go.
+*
+* The tree itself is not thread-safe; insert(), remove(), clear() and snapshot() belong to one
+* thread at a time. A Snapshot may be read, copied and destroyed on any thread while the tree
+* keeps changing, so a long scan can run against a snapshot without holding up the writer or
+* copying the tree. Reference counts are atomic, and nodes are allocated with new rather than
+* from a NodeArena because the last snapshot to let go of a node frees it on its own thread.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class PersistentAVLTree
+{
+protected:
+    struct Node;
+
+public:
+    /**
+    * A consistent, read-only version of a PersistentAVLTree. Copying a snapshot is O(1).
+    */
+    class Snapshot
+    {
+    public:
+        Snapshot();
+        Snapshot(const Snapshot& other);
+        Snapshot& operator=(const Snapshot& other);
+        ~Snapshot();
+
+        bool find(const Key& key, Value& value) const;
+        bool contains(const Key& key) const;
+        template<typename Function>
+        void for_each_in_range(const Key& first, const Key& last, Function fn) const;
+        template<typename Function>
+        void for_each(Function fn) const;
+
+        std::size_t size() const;
+        bool empty() const;
+
+    private:
+        friend class PersistentAVLTree<Key, Value, Compare>;
+        Snapshot(Node* root, std::size_t size, const Compare& comp);
+
+        Node* root_;
+        std::size_t size_;
+        Compare compare_;
+    };
+
+    PersistentAVLTree();
+    explicit PersistentAVLTree(const Compare& comp);
+    ~PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    Snapshot snapshot() const;
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    template<typename Function>
+    void for_each_in_range(const Key& first, const Key& last, Function fn) const;
+
+    std::size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+
+protected:
+    struct Node
+    {
+        explicit Node(const std::pair<const Key, Value>& item);
+
+        std::pair<const Key, Value> item;
+        Node* left;
+        Node* right;
+        int height;
+        std::atomic<std::size_t> refs;   // trees, snapshots and parents pointing here
+    };
+
+    // An AVL tree of 2^64 nodes is less than 93 levels high.
+    static const int MAX_HEIGHT = 96;
+
+    static Node* retain(Node* node);
+    static void release(Node* node);
+    static const Node* lookup(const Node* node, const Key& key, const Compare& compare);
+    template<typename Function>
+    static void visitRange(const Node* root, const Key& first, const Key& last, Function& fn, const Compare& compare);
+
+    Node* own(Node* node);
+    Node* insertAt(Node* node, const std::pair<const Key, Value>& keyValuePair, bool& added);
+    Node* removeAt(Node* node, const Key& key);
+    Node* removeMin(Node* node, Node*& min);
+    Node* rebalance(Node* node);
+    Node* rotateLeft(Node* node);
+    Node* rotateRight(Node* node);
+    static int heightOf(const Node* node);
+    static void updateHeight(Node* node);
+    int checkHeight(const Node* node) const;
+
+    Node* root_;
+    std::size_t size_;
+    Compare compare_;
+
+private:
+    PersistentAVLTree(const PersistentAVLTree<Key, Value, Compare>&);
+    PersistentAVLTree<Key, Value, Compare>& operator=(const PersistentAVLTree<Key, Value, Compare>&);
+};
+
+/*
+------------------------------------------------------
+Begin implementations for the PersistentAVLTree class.
+------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+const int PersistentAVLTree<Key, Value, Compare>::MAX_HEIGHT;
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::Node::Node(const std::pair<const Key, Value>& item) :
+    item(item),
+    left(nullptr),
+    right(nullptr),
+    height(1),
+    refs(1)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot() :
+    root_(nullptr),
+    size_(0),
+    compare_()
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(Node* root, std::size_t size, const Compare& comp) :
+    root_(retain(root)),
+    size_(size),
+    compare_(comp)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(const Snapshot& other) :
+    root_(retain(other.root_)),
+    size_(other.size_),
+    compare_(other.compare_)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot&
+PersistentAVLTree<Key, Value, Compare>::Snapshot::operator=(const Snapshot& other)
+{
+    // retain first, so assigning a snapshot to itself does not free its nodes
+    Node* root = retain(other.root_);
+    release(root_);
+    root_ = root;
+    size_ = other.size_;
+    compare_ = other.compare_;
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::~Snapshot()
+{
+    release(root_);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::find(const Key& key, Value& value) const
+{
+    const Node* n = lookup(root_, key, compare_);
+    if(n == nullptr){
+        return false;
+    }
+    value = n->item.second;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::contains(const Key& key) const
+{
+    return lookup(root_, key, compare_) != nullptr;
+}
+
+/**
+* Calls fn on every item of the snapshot with a key in [first, last), in key order.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename Function>
+void PersistentAVLTree<Key, Value, Compare>::Snapshot::for_each_in_range(const Key& first, const Key& last, Function fn) const
+{
+    visitRange(root_, first, last, fn, compare_);
+}
+
+/**
+* Calls fn on every item of the snapshot, in key order.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename Function>
+void PersistentAVLTree<Key, Value, Compare>::Snapshot::for_each(Function fn) const
+{
+    const Node* stack[MAX_HEIGHT];
+    int top = 0;
+    for(const Node* n = root_; n != nullptr; n = n->left){
+        stack[top++] = n;
+    }
+    while(top > 0){
+        const Node* n = stack[--top];
+        const std::pair<const Key, Value>& item = n->item;
+        fn(item);
+        for(n = n->right; n != nullptr; n = n->left){
+            stack[top++] = n;
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::Snapshot::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree() :
+    root_(nullptr),
+    size_(0),
+    compare_()
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    root_(nullptr),
+    size_(0),
+    compare_(comp)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns a view of the current contents in O(1). Later writes to the tree do not show in it.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    return Snapshot(root_, size_, compare_);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    const Node* n = lookup(root_, key, compare_);
+    if(n == nullptr){
+        return false;
+    }
+    value = n->item.second;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    return lookup(root_, key, compare_) != nullptr;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename Function>
+void PersistentAVLTree<Key, Value, Compare>::for_each_in_range(const Key& first, const Key& last, Function fn) const
+{
+    visitRange(root_, first, last, fn, compare_);
+}
+
+/**
+* Puts keyValuePair into the tree, overwriting the value if the key is already present.
+* Snapshots taken earlier keep the old contents.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool added = false;
+    root_ = insertAt(root_, keyValuePair, added);
+    if(added){
+        ++size_;
+    }
+}
+
+/**
+* Removes the item with the given key, if any. Snapshots taken earlier keep it.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    // the path is only copied once the key is known to be there
+    if(lookup(root_, key, compare_) == nullptr){
+        return;
+    }
+    root_ = removeAt(root_, key);
+    --size_;
+}
+
+/**
+* Empties the tree. Nodes still held by snapshots stay alive with them.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    release(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+/**
+* Checks heights and balance factors of the current contents. Meant for tests.
+*/
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkHeight(root_) >= 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+int PersistentAVLTree<Key, Value, Compare>::checkHeight(const Node* node) const
+{
+    if(node == nullptr){
+        return 0;
+    }
+    if((node->left != nullptr && !compare_(node->left->item.first, node->item.first))
+       || (node->right != nullptr && !compare_(node->item.first, node->right->item.first))){
+        return -1;
+    }
+    int left = checkHeight(node->left);
+    int right = checkHeight(node->right);
+    if(left < 0 || right < 0 || left - right > 1 || right - left > 1 || node->height != 1 + std::max(left, right)){
+        return -1;
+    }
+    return node->height;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::retain(Node* node)
+{
+    if(node != nullptr){
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+* Drops one reference to node, freeing it, and in turn dropping its references to its
+* children, if it was the last. The recursion only goes as deep as the tree is high.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::release(Node* node)
+{
+    // acq_rel: whoever frees the node, or takes it over in own(), sees every earlier read of it
+    if(node == nullptr || node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1){
+        return;
+    }
+    release(node->left);
+    release(node->right);
+    delete node;
+}
+
+template<typename Key, typename Value, typename Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::lookup(const Node* node, const Key& key, const Compare& compare)
+{
+    while(node != nullptr){
+        if(compare(key, node->item.first)){
+            node = node->left;
+        }
+        else if(compare(node->item.first, key)){
+            node = node->right;
+        }
+        else{
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename Function>
+void PersistentAVLTree<Key, Value, Compare>::visitRange(const Node* root, const Key& first, const Key& last, Function& fn, const Compare& compare)
+{
+    // the ancestors still to visit, nearest on top
+    const Node* stack[MAX_HEIGHT];
+    int top = 0;
+    const Node* n = root;
+    while(n != nullptr){
+        if(compare(n->item.first, first)){
+            n = n->right;
+        }
+        else{
+            stack[top++] = n;
+            n = n->left;
+        }
+    }
+    while(top > 0){
+        n = stack[--top];
+        if(!compare(n->item.first, last)){
+            return;
+        }
+        const std::pair<const Key, Value>& item = n->item;
+        fn(item);
+        for(n = n->right; n != nullptr; n = n->left){
+            stack[top++] = n;
+        }
+    }
+}
+
+/**
+* Returns a node the current write may modify in place of node, taking over the reference the
+* caller held to node. node itself qualifies if that reference is its only one: the caller
+* reached it through nodes it owns, so no snapshot can see it. Otherwise node is copied, and
+* the copy shares node's children.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::own(Node* node)
+{
+    if(node->refs.load(std::memory_order_acquire) == 1){
+        return node;
+    }
+    Node* copy = new Node(node->item);
+    copy->left = retain(node->left);
+    copy->right = retain(node->right);
+    copy->height = node->height;
+    release(node);
+    return copy;
+}
+
+/**
+* Returns node's subtree with keyValuePair in it. Takes over the caller's reference to node
+* and hands back one to the result, like every function below that rewrites a subtree.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::insertAt(Node* node, const std::pair<const Key, Value>& keyValuePair, bool& added)
+{
+    if(node == nullptr){
+        added = true;
+        return new Node(keyValuePair);
+    }
+    node = own(node);
+    if(compare_(keyValuePair.first, node->item.first)){
+        node->left = insertAt(node->left, keyValuePair, added);
+    }
+    else if(compare_(node->item.first, keyValuePair.first)){
+        node->right = insertAt(node->right, keyValuePair, added);
+    }
+    else{
+        node->item.second = keyValuePair.second;
+        return node;
+    }
+    return rebalance(node);
+}
+
+/**
+* Returns node's subtree without key, which must be in it.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeAt(Node* node, const Key& key)
+{
+    if(compare_(key, node->item.first)){
+        node = own(node);
+        node->left = removeAt(node->left, key);
+    }
+    else if(compare_(node->item.first, key)){
+        node = own(node);
+        node->right = removeAt(node->right, key);
+    }
+    else{
+        // keep the children and let go of node, which a snapshot may still hold
+        Node* left = retain(node->left);
+        Node* right = retain(node->right);
+        release(node);
+        if(left == nullptr || right == nullptr){
+            return (left != nullptr) ? left : right;
+        }
+        // two children: the successor node, already owned, takes node's place
+        Node* min;
+        right = removeMin(right, min);
+        min->left = left;
+        min->right = right;
+        node = min;
+    }
+    return rebalance(node);
+}
+
+/**
+* Returns node's subtree without its smallest node, which is handed back through min, owned
+* by the caller and with its children cut off.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeMin(Node* node, Node*& min)
+{
+    node = own(node);
+    if(node->left == nullptr){
+        Node* right = node->right;
+        node->right = nullptr;
+        min = node;
+        return right;
+    }
+    node->left = removeMin(node->left, min);
+    return rebalance(node);
+}
+
+/**
+* Restores the AVL property at node, which the current write owns. Children that a rotation
+* rearranges are owned first.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rebalance(Node* node)
+{
+    int balance = heightOf(node->left) - heightOf(node->right);
+    if(balance > 1){
+        node->left = own(node->left);
+        if(heightOf(node->left->left) < heightOf(node->left->right)){
+            node->left = rotateLeft(node->left);
+        }
+        return rotateRight(node);
+    }
+    if(balance < -1){
+        node->right = own(node->right);
+        if(heightOf(node->right->right) < heightOf(node->right->left)){
+            node->right = rotateRight(node->right);
+        }
+        return rotateLeft(node);
+    }
+    updateHeight(node);
+    return node;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateLeft(Node* node)
+{
+    Node* right = own(node->right);
+    node->right = right->left;
+    right->left = node;
+    updateHeight(node);
+    updateHeight(right);
+    return right;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateRight(Node* node)
+{
+    Node* left = own(node->left);
+    node->left = left->right;
+    left->right = node;
+    updateHeight(node);
+    updateHeight(left);
+    return left;
+}
+
+template<typename Key, typename Value, typename Compare>
+inline int PersistentAVLTree<Key, Value, Compare>::heightOf(const Node* node)
+{
+    return (node == nullptr) ? 0 : node->height;
+}
+
+template<typename Key, typename Value, typename Compare>
+inline void PersistentAVLTree<Key, Value, Compare>::updateHeight(Node* node)
+{
+    node->height = 1 + std::max(heightOf(node->left), heightOf(node->right));
+}
+
+/*
+----------------------------------------------------
+End implementations for the PersistentAVLTree class.
+----------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,976 @@
+#ifndef POOLED_AVLBST_H
+#define POOLED_AVLBST_H
+
+#include <iostream>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "key_compare.h"
+
+/**
+* A node of a PooledAVLTree. Nodes live side by side in one contiguous pool and refer to each
+* other by their uint32_t position in it instead of by address, so the three links take 12 bytes
+* instead of 24 and the pool can be moved, copied or mapped as a whole.
+*/
+template <typename Key, typename Value>
+class PooledAVLNode
+{
+public:
+    static const uint32_t NIL = 0xFFFFFFFFu;
+
+    PooledAVLNode(const Key& key, const Value& value, uint32_t parent);
+
+    const std::pair<const Key, Value>& getItem() const;
+    std::pair<const Key, Value>& getItem();
+    const Key& getKey() const;
+    const Value& getValue() const;
+    Value& getValue();
+
+    uint32_t getParent() const;
+    uint32_t getLeft() const;
+    uint32_t getRight() const;
+    int getBalance() const;
+
+    void setParent(uint32_t parent);
+    void setLeft(uint32_t left);
+    void setRight(uint32_t right);
+    void setBalance(int balance);
+    void setValue(const Value& value);
+
+protected:
+    std::pair<const Key, Value> item_;
+    uint32_t parent_;
+    uint32_t left_;
+    uint32_t right_;
+    int8_t balance_;
+};
+
+/**
+* Describes the state of a PooledAVLTree's pool so that it can be written out with its raw
+* node bytes and loaded back later, possibly at a different address.
+*/
+struct PoolHeader
+{
+    uint32_t count;     // slots in use or on the free list, i.e. the length of the node array
+    uint32_t live;      // slots holding an element
+    uint32_t root;      // index of the root, or NIL
+    uint32_t freeHead;  // first free slot, or NIL; a free slot keeps the next one in its first 4 bytes
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the PooledAVLNode class.
+  -----------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+const uint32_t PooledAVLNode<Key, Value>::NIL;
+
+/**
+* An explicit constructor for a leaf node.
+*/
+template<typename Key, typename Value>
+PooledAVLNode<Key, Value>::PooledAVLNode(const Key& key, const Value& value, uint32_t parent) :
+    item_(key, value),
+    parent_(parent),
+    left_(NIL),
+    right_(NIL),
+    balance_(0)
+{
+
+}
+
+template<typename Key, typename Value>
+inline const std::pair<const Key, Value>& PooledAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+inline std::pair<const Key, Value>& PooledAVLNode<Key, Value>::getItem()
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+inline const Key& PooledAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<typename Key, typename Value>
+inline const Value& PooledAVLNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+template<typename Key, typename Value>
+inline Value& PooledAVLNode<Key, Value>::getValue()
+{
+    return item_.second;
+}
+
+template<typename Key, typename Value>
+inline uint32_t PooledAVLNode<Key, Value>::getParent() const
+{
+    return parent_;
+}
+
+template<typename Key, typename Value>
+inline uint32_t PooledAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+template<typename Key, typename Value>
+inline uint32_t PooledAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+template<typename Key, typename Value>
+inline int PooledAVLNode<Key, Value>::getBalance() const
+{
+    return balance_;
+}
+
+template<typename Key, typename Value>
+inline void PooledAVLNode<Key, Value>::setParent(uint32_t parent)
+{
+    parent_ = parent;
+}
+
+template<typename Key, typename Value>
+inline void PooledAVLNode<Key, Value>::setLeft(uint32_t left)
+{
+    left_ = left;
+}
+
+template<typename Key, typename Value>
+inline void PooledAVLNode<Key, Value>::setRight(uint32_t right)
+{
+    right_ = right;
+}
+
+template<typename Key, typename Value>
+inline void PooledAVLNode<Key, Value>::setBalance(int balance)
+{
+    balance_ = static_cast<int8_t>(balance);
+}
+
+template<typename Key, typename Value>
+inline void PooledAVLNode<Key, Value>::setValue(const Value& value)
+{
+    item_.second = value;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the PooledAVLNode class.
+  ---------------------------------------------------
+*/
+
+/**
+* An AVL tree whose nodes are stored in a single contiguous pool and linked by 32-bit indices.
+* It holds at most 2^32 - 1 elements. Since no link is an address the whole tree is
+* relocatable: for trivially copyable keys and values the pool can be saved with
+* poolHeader()/poolData() and restored with loadPool().
+*
+* Its interface is the core of AVLTree's, not all of it: insert, remove, find, clear, empty,
+* size, key_comp, forward iteration and print. There is no const_iterator or operator--, no
+* emplace family or hinted insert, no bound or range queries, and none of AVLTree's
+* augmentation, split/join, set algebra or bulk loading. begin(), end() and find() hand out
+* iterators with mutable access to the values even on a const tree.
+*
+* The balancing follows AVLTree's step for step but is written again on indices, because
+* every link, and the pool itself, can move on any insertion; the two have to be changed
+* together.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class PooledAVLTree
+{
+public:
+    typedef PooledAVLNode<Key, Value> NodeType;
+    static const uint32_t NIL = NodeType::NIL;
+
+    PooledAVLTree();
+    explicit PooledAVLTree(const Compare& comp);
+    ~PooledAVLTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    void print() const;
+    bool empty() const;
+    std::size_t size() const;
+    Compare key_comp() const;
+
+    PoolHeader poolHeader() const;
+    const void* poolData() const;
+    void loadPool(const PoolHeader& header, const void* data);
+
+public:
+    /**
+    * An iterator that remembers its tree and a pool index, so it stays meaningful even
+    * when the pool is moved by a later insertion.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class PooledAVLTree<Key, Value, Compare>;
+        iterator(const PooledAVLTree<Key, Value, Compare>* tree, uint32_t index);
+        const PooledAVLTree<Key, Value, Compare>* tree_;
+        uint32_t current_;
+    };
+
+public:
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+
+protected:
+    NodeType& node(uint32_t index) const;
+    // <0, 0 or >0 with one threeWayCompare() where UsesThreeWay allows it, see BinarySearchTree.
+    int compareKeys(const Key& a, const Key& b) const;
+    int compareKeys(const Key& a, const Key& b, std::true_type) const;
+    int compareKeys(const Key& a, const Key& b, std::false_type) const;
+    uint32_t internalFind(const Key& key) const;
+    uint32_t successor(uint32_t index) const;
+    uint32_t allocateNode(const Key& key, const Value& value, uint32_t parent);
+    void freeNode(uint32_t index);
+    uint32_t nextFree(uint32_t index) const;
+    void reserve(uint32_t capacity);
+    void destroyAll();
+
+    void insertFix(uint32_t parent, uint32_t child);
+    void removeFix(uint32_t n, int diff);
+    uint32_t rebalance(uint32_t z, int balance, bool& heightDropped);
+    void leftRotate(uint32_t z);
+    void rightRotate(uint32_t z);
+    void replaceChild(uint32_t parent, uint32_t oldChild, uint32_t newChild);
+    int isBalancedHelper(uint32_t index, bool& isBalanced) const;
+
+protected:
+    NodeType* pool_;      // raw storage for capacity_ nodes, the first count_ of them handed out
+    uint32_t capacity_;
+    uint32_t count_;
+    uint32_t live_;
+    uint32_t root_;
+    uint32_t freeHead_;
+    Compare compare_;
+
+private:
+    PooledAVLTree(const PooledAVLTree&);
+    PooledAVLTree& operator=(const PooledAVLTree&);
+};
+
+/*
+--------------------------------------------------------------
+Begin implementations for the PooledAVLTree::iterator class.
+--------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PooledAVLTree<Key, Value, Compare>::iterator::iterator(const PooledAVLTree<Key, Value, Compare>* tree, uint32_t index)
+    : tree_(tree), current_(index)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+PooledAVLTree<Key, Value, Compare>::iterator::iterator()
+    : tree_(nullptr), current_(NIL)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value>&
+PooledAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return tree_->node(current_).getItem();
+}
+
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value>*
+PooledAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &(tree_->node(current_).getItem());
+}
+
+/**
+* Two iterators are equal when they point at the same slot; all end iterators are equal.
+*/
+template<class Key, class Value, class Compare>
+bool PooledAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_ && (current_ == NIL || tree_ == rhs.tree_);
+}
+
+template<class Key, class Value, class Compare>
+bool PooledAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value, class Compare>
+typename PooledAVLTree<Key, Value, Compare>::iterator&
+PooledAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    current_ = tree_->successor(current_);
+    return *this;
+}
+
+/*
+------------------------------------------------------------
+End implementations for the PooledAVLTree::iterator class.
+------------------------------------------------------------
+*/
+
+/*
+---------------------------------------------------
+Begin implementations for the PooledAVLTree class.
+---------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+const uint32_t PooledAVLTree<Key, Value, Compare>::NIL;
+
+template<class Key, class Value, class Compare>
+PooledAVLTree<Key, Value, Compare>::PooledAVLTree() :
+    pool_(nullptr),
+    capacity_(0),
+    count_(0),
+    live_(0),
+    root_(NIL),
+    freeHead_(NIL),
+    compare_()
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+PooledAVLTree<Key, Value, Compare>::PooledAVLTree(const Compare& comp) :
+    pool_(nullptr),
+    capacity_(0),
+    count_(0),
+    live_(0),
+    root_(NIL),
+    freeHead_(NIL),
+    compare_(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+PooledAVLTree<Key, Value, Compare>::~PooledAVLTree()
+{
+    clear();
+}
+
+template<class Key, class Value, class Compare>
+bool PooledAVLTree<Key, Value, Compare>::empty() const
+{
+    return root_ == NIL;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t PooledAVLTree<Key, Value, Compare>::size() const
+{
+    return live_;
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare PooledAVLTree<Key, Value, Compare>::key_comp() const
+{
+    return compare_;
+}
+
+template<class Key, class Value, class Compare>
+inline typename PooledAVLTree<Key, Value, Compare>::NodeType& PooledAVLTree<Key, Value, Compare>::node(uint32_t index) const
+{
+    return pool_[index];
+}
+
+template<class Key, class Value, class Compare>
+inline int PooledAVLTree<Key, Value, Compare>::compareKeys(const Key& a, const Key& b) const
+{
+    return compareKeys(a, b, UsesThreeWay<Compare, Key, Key>());
+}
+
+template<class Key, class Value, class Compare>
+inline int PooledAVLTree<Key, Value, Compare>::compareKeys(const Key& a, const Key& b, std::true_type) const
+{
+    return threeWayCompare(a, b);
+}
+
+template<class Key, class Value, class Compare>
+inline int PooledAVLTree<Key, Value, Compare>::compareKeys(const Key& a, const Key& b, std::false_type) const
+{
+    return compare_(a, b) ? -1 : compare_(b, a) ? 1 : 0;
+}
+
+template<class Key, class Value, class Compare>
+typename PooledAVLTree<Key, Value, Compare>::iterator PooledAVLTree<Key, Value, Compare>::begin() const
+{
+    uint32_t t = root_;
+    if(t != NIL){
+        while(node(t).getLeft() != NIL){
+            t = node(t).getLeft();
+        }
+    }
+    return iterator(this, t);
+}
+
+template<class Key, class Value, class Compare>
+typename PooledAVLTree<Key, Value, Compare>::iterator PooledAVLTree<Key, Value, Compare>::end() const
+{
+    return iterator(this, NIL);
+}
+
+template<class Key, class Value, class Compare>
+typename PooledAVLTree<Key, Value, Compare>::iterator PooledAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return iterator(this, internalFind(key));
+}
+
+template<class Key, class Value, class Compare>
+uint32_t PooledAVLTree<Key, Value, Compare>::internalFind(const Key& key) const
+{
+    uint32_t temp = root_;
+
+    while(temp != NIL){
+        const NodeType& n = node(temp);
+        int c = compareKeys(key, n.getKey());
+        if(c < 0){
+            temp = n.getLeft();
+        }
+        else if(c > 0){
+            temp = n.getRight();
+        }
+        else{
+            return temp;
+        }
+    }
+    return NIL;
+}
+
+template<class Key, class Value, class Compare>
+uint32_t PooledAVLTree<Key, Value, Compare>::successor(uint32_t s) const
+{
+    if(node(s).getRight() != NIL){
+        uint32_t smallest = node(s).getRight();
+        while(node(smallest).getLeft() != NIL){
+            smallest = node(smallest).getLeft();
+        }
+        return smallest;
+    }
+
+    uint32_t upper = node(s).getParent();
+    while(upper != NIL && s == node(upper).getRight()){
+        s = upper;
+        upper = node(upper).getParent();
+    }
+    return upper;
+}
+
+/**
+* Makes room for at least capacity nodes. Trivially copyable nodes are moved with one memcpy,
+* others are move constructed one by one; free slots hold no object and are copied as bytes.
+*/
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::reserve(uint32_t capacity)
+{
+    if(capacity <= capacity_){
+        return;
+    }
+    NodeType* grown = static_cast<NodeType*>(::operator new(sizeof(NodeType) * static_cast<std::size_t>(capacity)));
+
+    if(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value){
+        if(count_ != 0){
+            std::memcpy(static_cast<void*>(grown), static_cast<const void*>(pool_), sizeof(NodeType) * count_);
+        }
+    }
+    else{
+        // mark the free slots first so we know which ones hold objects
+        bool* isFree = new bool[count_ == 0 ? 1 : count_]();
+        for(uint32_t f = freeHead_; f != NIL; f = nextFree(f)){
+            isFree[f] = true;
+        }
+        for(uint32_t i = 0; i < count_; ++i){
+            if(isFree[i]){
+                std::memcpy(static_cast<void*>(grown + i), static_cast<const void*>(pool_ + i), sizeof(NodeType));
+            }
+            else{
+                new (grown + i) NodeType(std::move(pool_[i]));
+                pool_[i].~NodeType();
+            }
+        }
+        delete [] isFree;
+    }
+
+    ::operator delete(pool_);
+    pool_ = grown;
+    capacity_ = capacity;
+}
+
+/**
+* Builds a node in a free slot (or a fresh one at the end of the pool) and returns its index.
+*/
+template<class Key, class Value, class Compare>
+uint32_t PooledAVLTree<Key, Value, Compare>::allocateNode(const Key& key, const Value& value, uint32_t parent)
+{
+    uint32_t index;
+    if(freeHead_ != NIL){
+        index = freeHead_;
+        freeHead_ = nextFree(index);
+    }
+    else{
+        if(count_ == NIL){
+            throw std::length_error("PooledAVLTree: pool is full");
+        }
+        if(count_ == capacity_){
+            uint32_t grown = capacity_ < 16 ? 16 : (capacity_ > NIL / 2 ? NIL : capacity_ * 2);
+            reserve(grown);
+        }
+        index = count_++;
+    }
+    new (pool_ + index) NodeType(key, value, parent);
+    ++live_;
+    return index;
+}
+
+/**
+* Destroys a node and threads its slot onto the free list.
+*/
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::freeNode(uint32_t index)
+{
+    pool_[index].~NodeType();
+    // the slot holds no object anymore, its first bytes now link to the next free slot
+    std::memcpy(static_cast<void*>(pool_ + index), &freeHead_, sizeof(uint32_t));
+    freeHead_ = index;
+    --live_;
+}
+
+template<class Key, class Value, class Compare>
+inline uint32_t PooledAVLTree<Key, Value, Compare>::nextFree(uint32_t index) const
+{
+    uint32_t next;
+    std::memcpy(&next, static_cast<const void*>(pool_ + index), sizeof(uint32_t));
+    return next;
+}
+
+/**
+* Runs the destructor of every live node and gives the pool back to the heap.
+*/
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::destroyAll()
+{
+    if(!std::is_trivially_destructible<NodeType>::value && count_ != 0){
+        bool* isFree = new bool[count_]();
+        for(uint32_t f = freeHead_; f != NIL; f = nextFree(f)){
+            isFree[f] = true;
+        }
+        for(uint32_t i = 0; i < count_; ++i){
+            if(!isFree[i]){
+                pool_[i].~NodeType();
+            }
+        }
+        delete [] isFree;
+    }
+    ::operator delete(pool_);
+    pool_ = nullptr;
+    capacity_ = count_ = live_ = 0;
+    root_ = freeHead_ = NIL;
+}
+
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::clear()
+{
+    destroyAll();
+}
+
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    // CASE 1: Empty Tree
+    if(root_ == NIL){
+        root_ = allocateNode(keyValuePair.first, keyValuePair.second, NIL);
+        return;
+    }
+
+    // CASE 2: Non-Empty Tree
+    uint32_t temp = root_;
+    uint32_t prev = NIL;
+    bool goLeft = false;
+
+    while(temp != NIL){
+        prev = temp;
+        NodeType& n = node(temp);
+        int c = compareKeys(keyValuePair.first, n.getKey());
+
+        if(c > 0){
+            goLeft = false;
+            temp = n.getRight();
+        }
+        else if(c < 0){
+            goLeft = true;
+            temp = n.getLeft();
+        }
+        else{   // then overwrite value
+            n.setValue(keyValuePair.second);
+            return;
+        }
+    }
+
+    // allocating may move the pool, so only hold indices across it
+    temp = allocateNode(keyValuePair.first, keyValuePair.second, prev);
+    if(goLeft){
+        node(prev).setLeft(temp);
+    }
+    else{
+        node(prev).setRight(temp);
+    }
+    insertFix(prev, temp);
+}
+
+/**
+* Same retracing as AVLTree::insertFix, on indices.
+*/
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::insertFix(uint32_t parent, uint32_t child)
+{
+    while(parent != NIL){
+        int balance = node(parent).getBalance() + ((node(parent).getLeft() == child) ? -1 : 1);
+
+        if(balance == 0){
+            node(parent).setBalance(0);
+            return;
+        }
+        else if(balance == 1 || balance == -1){
+            node(parent).setBalance(balance);
+            child = parent;
+            parent = node(parent).getParent();
+        }
+        else{
+            bool heightDropped;
+            rebalance(parent, balance, heightDropped);
+            return;
+        }
+    }
+}
+
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    uint32_t target = internalFind(key);
+
+    // CASE 1: key not in the tree
+    if(target == NIL){
+        return;
+    }
+
+    // CASE 2: two children, unlink the successor instead and move it into target's place
+    uint32_t victim = target;
+    if(node(target).getLeft() != NIL && node(target).getRight() != NIL){
+        victim = node(target).getRight();
+        while(node(victim).getLeft() != NIL){
+            victim = node(victim).getLeft();
+        }
+    }
+
+    uint32_t p = node(victim).getParent();
+    int diff = (p != NIL && node(p).getLeft() == victim) ? 1 : -1;
+    uint32_t child = (node(victim).getLeft() != NIL) ? node(victim).getLeft() : node(victim).getRight();
+
+    if(child != NIL){
+        node(child).setParent(p);
+    }
+    replaceChild(p, victim, child);
+
+    if(victim != target){
+        // victim takes over target's position, links and balance
+        NodeType& v = node(victim);
+        NodeType& t = node(target);
+        if(p == target){
+            p = victim;
+        }
+        v.setParent(t.getParent());
+        v.setLeft(t.getLeft());
+        v.setRight(t.getRight());
+        v.setBalance(t.getBalance());
+        if(v.getLeft() != NIL){
+            node(v.getLeft()).setParent(victim);
+        }
+        if(v.getRight() != NIL){
+            node(v.getRight()).setParent(victim);
+        }
+        replaceChild(v.getParent(), target, victim);
+    }
+
+    freeNode(target);
+    removeFix(p, diff);
+}
+
+/**
+* Same retracing as AVLTree::removeFix, on indices.
+*/
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::removeFix(uint32_t n, int diff)
+{
+    while(n != NIL){
+        uint32_t p = node(n).getParent();
+        int nextDiff = (p != NIL && node(p).getLeft() == n) ? 1 : -1;
+        int balance = node(n).getBalance() + diff;
+
+        if(balance == 1 || balance == -1){
+            node(n).setBalance(balance);
+            return;
+        }
+        else if(balance == 0){
+            node(n).setBalance(0);
+        }
+        else{
+            bool heightDropped;
+            rebalance(n, balance, heightDropped);
+            if(!heightDropped){
+                return;
+            }
+        }
+
+        n = p;
+        diff = nextDiff;
+    }
+}
+
+/**
+* Points parent's link at oldChild to newChild, or moves the root if parent is NIL.
+*/
+template<class Key, class Value, class Compare>
+inline void PooledAVLTree<Key, Value, Compare>::replaceChild(uint32_t parent, uint32_t oldChild, uint32_t newChild)
+{
+    if(parent == NIL){
+        root_ = newChild;
+    }
+    else if(node(parent).getLeft() == oldChild){
+        node(parent).setLeft(newChild);
+    }
+    else{
+        node(parent).setRight(newChild);
+    }
+}
+
+/**
+* Same as AVLTree::rebalance, on indices.
+*/
+template<class Key, class Value, class Compare>
+uint32_t PooledAVLTree<Key, Value, Compare>::rebalance(uint32_t z, int balance, bool& heightDropped)
+{
+    if(balance > 0){
+        uint32_t y = node(z).getRight();
+        int yBalance = node(y).getBalance();
+
+        if(yBalance >= 0){
+            leftRotate(z);
+            heightDropped = (yBalance != 0);
+            node(z).setBalance(yBalance == 0 ? 1 : 0);
+            node(y).setBalance(yBalance == 0 ? -1 : 0);
+            return y;
+        }
+
+        uint32_t x = node(y).getLeft();
+        int xBalance = node(x).getBalance();
+        rightRotate(y);
+        leftRotate(z);
+        heightDropped = true;
+        node(z).setBalance(xBalance == 1 ? -1 : 0);
+        node(y).setBalance(xBalance == -1 ? 1 : 0);
+        node(x).setBalance(0);
+        return x;
+    }
+    else{
+        uint32_t y = node(z).getLeft();
+        int yBalance = node(y).getBalance();
+
+        if(yBalance <= 0){
+            rightRotate(z);
+            heightDropped = (yBalance != 0);
+            node(z).setBalance(yBalance == 0 ? -1 : 0);
+            node(y).setBalance(yBalance == 0 ? 1 : 0);
+            return y;
+        }
+
+        uint32_t x = node(y).getRight();
+        int xBalance = node(x).getBalance();
+        leftRotate(y);
+        rightRotate(z);
+        heightDropped = true;
+        node(z).setBalance(xBalance == -1 ? 1 : 0);
+        node(y).setBalance(xBalance == 1 ? -1 : 0);
+        node(x).setBalance(0);
+        return x;
+    }
+}
+
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::leftRotate(uint32_t z)
+{
+    uint32_t y = node(z).getRight();
+    uint32_t p = node(z).getParent();
+
+    replaceChild(p, z, y);
+    node(y).setParent(p);
+
+    uint32_t oldYLeftChild = node(y).getLeft();
+    node(y).setLeft(z);
+    node(z).setParent(y);
+    node(z).setRight(oldYLeftChild);
+    if(oldYLeftChild != NIL){
+        node(oldYLeftChild).setParent(z);
+    }
+}
+
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::rightRotate(uint32_t z)
+{
+    uint32_t y = node(z).getLeft();
+    uint32_t p = node(z).getParent();
+
+    replaceChild(p, z, y);
+    node(y).setParent(p);
+
+    uint32_t oldYRightChild = node(y).getRight();
+    node(y).setRight(z);
+    node(z).setParent(y);
+    node(z).setLeft(oldYRightChild);
+    if(oldYRightChild != NIL){
+        node(oldYRightChild).setParent(z);
+    }
+}
+
+/**
+* Return true iff every node's subtrees differ in height by at most one.
+*/
+template<class Key, class Value, class Compare>
+bool PooledAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    bool isBalanced = true;
+    isBalancedHelper(root_, isBalanced);
+    return isBalanced;
+}
+
+template<class Key, class Value, class Compare>
+int PooledAVLTree<Key, Value, Compare>::isBalancedHelper(uint32_t index, bool& isBalanced) const
+{
+    if(index == NIL){
+        return -1;
+    }
+    int hLeft = isBalancedHelper(node(index).getLeft(), isBalanced);
+    int hRight = isBalancedHelper(node(index).getRight(), isBalanced);
+    if(std::abs(hLeft - hRight) > 1){
+        isBalanced = false;
+    }
+    return std::max(hLeft, hRight) + 1;
+}
+
+/**
+* Prints the contents in key order. The ASCII drawing in print_bst.h works on Node pointers,
+* so the pooled tree lists its elements instead.
+*/
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::print() const
+{
+    if(empty()){
+        std::cout << "<empty tree>" << std::endl;
+        return;
+    }
+    for(iterator it = begin(); it != end(); ++it){
+        std::cout << '(' << it->first << ", " << it->second << ')' << std::endl;
+    }
+    std::cout << "\n";
+}
+
+/**
+* Returns the bookkeeping needed to restore the pool from the bytes at poolData().
+*/
+template<class Key, class Value, class Compare>
+PoolHeader PooledAVLTree<Key, Value, Compare>::poolHeader() const
+{
+    PoolHeader header;
+    header.count = count_;
+    header.live = live_;
+    header.root = root_;
+    header.freeHead = freeHead_;
+    return header;
+}
+
+/**
+* Returns the node array; it is poolHeader().count * sizeof(NodeType) bytes long.
+*/
+template<class Key, class Value, class Compare>
+const void* PooledAVLTree<Key, Value, Compare>::poolData() const
+{
+    return pool_;
+}
+
+/**
+* Replaces the contents of the tree with a pool previously obtained from poolHeader() and
+* poolData(), e.g. read back from a file or a memory mapping. This is a single memcpy; only
+* trivially copyable keys and values can be restored this way. Throws std::invalid_argument,
+* leaving the tree as it was, if root or freeHead point past the node array or more nodes are
+* live than it holds. The node bytes themselves are trusted.
+*/
+template<class Key, class Value, class Compare>
+void PooledAVLTree<Key, Value, Compare>::loadPool(const PoolHeader& header, const void* data)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "loadPool needs trivially copyable keys and values");
+    if((header.root != NIL && header.root >= header.count)
+       || (header.freeHead != NIL && header.freeHead >= header.count)
+       || header.live > header.count
+       || (header.root == NIL) != (header.live == 0)){
+        throw std::invalid_argument("PooledAVLTree::loadPool: inconsistent pool header");
+    }
+    clear();
+    reserve(header.count);
+    if(header.count != 0){
+        std::memcpy(static_cast<void*>(pool_), data, sizeof(NodeType) * header.count);
+    }
+    count_ = header.count;
+    live_ = header.live;
+    root_ = header.root;
+    freeHead_ = header.freeHead;
+}
+
+/*
+-------------------------------------------------
+End implementations for the PooledAVLTree class.
+-------------------------------------------------
+*/
+
+#endif
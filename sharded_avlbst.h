@@ -0,0 +1,545 @@
+#ifndef SHARDED_AVLBST_H
+#define SHARDED_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+#include "epoch_reclaim.h"
+
+/**
+* A map that splits its key space into contiguous ranges, each held by an ordinary AVLTree
+* behind its own mutex, so threads working on different ranges do not contend.
+*
+* The shard boundaries live in an immutable directory that is swapped with one atomic store.
+* An operation pins the epoch, looks its key up in the current directory and locks that one
+* shard. If the shard was replaced while the operation waited for its lock, it is marked
+* retired and the operation retries against the new directory. Retired directories and
+* shards are freed through an EpochManager once no operation can still hold them.
+*
+* Shards are kept near size() / shardCount each. One that grows past twice that is split at
+* its median, and neighbours that together hold less than half of it are merged. The target
+* is recomputed whenever shards are split or merged and cached in between, so writers share
+* no counter; size() adds up the shards' counts instead.
+*
+* Splitting copies the shard into two fresh trees rather than using AVLTree::split(), because
+* split halves share one NodeArena and the arena is not safe to use from two shard locks at
+* once; a shard only splits after doubling, so the copy costs O(1) per insert amortized.
+* Merging uses AVLTree::join() and moves no elements. Splits and merges serialize on a mutex
+* of their own and hold only the shards involved.
+*
+* Every operation may run on any thread. for_each_in_range() crosses shard boundaries in key
+* order and holds one shard at a time, so each shard's part of the scan is consistent but the
+* scan as a whole is not a snapshot. The destructor must not race with other calls.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ShardedAVLTree
+{
+public:
+    explicit ShardedAVLTree(std::size_t shardCount = DEFAULT_SHARDS, const Compare& comp = Compare());
+    ~ShardedAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    template<typename Function>
+    void for_each_in_range(const Key& first, const Key& last, Function fn) const;
+
+    std::size_t size() const;
+    bool empty() const;
+    std::size_t shards() const;
+    bool isBalanced() const;
+
+    static const std::size_t DEFAULT_SHARDS = 16;
+
+protected:
+    typedef AVLTree<Key, Value, NoAugment, Compare> Tree;
+
+    struct Shard
+    {
+        explicit Shard(const Compare& comp);
+
+        Tree tree;
+        std::mutex mutex;
+        std::atomic<std::size_t> count;   // tree.size(), readable without the lock
+        bool retired;                     // replaced in the directory; guarded by mutex
+    };
+
+    struct Directory
+    {
+        std::vector<Shard*> shards;
+        std::vector<Key> bounds;          // bounds[i] is the smallest key shards[i + 1] may hold
+    };
+
+    struct Retired
+    {
+        std::size_t epoch;
+        Directory* directory;
+        std::vector<Shard*> shards;
+    };
+
+    std::size_t shardIndex(const Directory* directory, const Key& key) const;
+    Shard* lockShard(const Key& key, std::unique_lock<std::mutex>& lock) const;
+    std::size_t refreshIdealSize();
+
+    void maintain(const Key& key);
+    bool splitShard(std::size_t index, std::size_t ideal);
+    bool mergeShards(std::size_t index, std::size_t ideal);
+    void publish(Directory* directory, const std::vector<Shard*>& replaced);
+    void reclaim();
+    void destroy(Retired& retired);
+
+    // Below this many elements per shard, splitting costs more than the contention it saves.
+    static const std::size_t MIN_SHARD_SIZE = 1024;
+
+    std::atomic<Directory*> directory_;
+    std::atomic<std::size_t> idealSize_;  // written under directoryMutex_, read by every write
+    mutable EpochManager epochs_;
+    std::mutex directoryMutex_;          // taken before any shard mutex
+    std::vector<Retired> retired_;       // guarded by directoryMutex_
+    std::size_t shardCount_;
+    Compare compare_;
+
+private:
+    ShardedAVLTree(const ShardedAVLTree<Key, Value, Compare>&);
+    ShardedAVLTree<Key, Value, Compare>& operator=(const ShardedAVLTree<Key, Value, Compare>&);
+};
+
+/*
+---------------------------------------------------
+Begin implementations for the ShardedAVLTree class.
+---------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+const std::size_t ShardedAVLTree<Key, Value, Compare>::DEFAULT_SHARDS;
+
+template<typename Key, typename Value, typename Compare>
+const std::size_t ShardedAVLTree<Key, Value, Compare>::MIN_SHARD_SIZE;
+
+template<typename Key, typename Value, typename Compare>
+ShardedAVLTree<Key, Value, Compare>::Shard::Shard(const Compare& comp) :
+    tree(comp),
+    count(0),
+    retired(false)
+{
+
+}
+
+/**
+* Starts out with a single shard; splits follow the data as it arrives, so the boundaries
+* need not be known up front. shardCount is the number of shards to aim for once the tree
+* is large enough to be worth dividing.
+*/
+template<typename Key, typename Value, typename Compare>
+ShardedAVLTree<Key, Value, Compare>::ShardedAVLTree(std::size_t shardCount, const Compare& comp) :
+    directory_(nullptr),
+    idealSize_(MIN_SHARD_SIZE),
+    shardCount_(std::max<std::size_t>(shardCount, 1)),
+    compare_(comp)
+{
+    Directory* directory = new Directory();
+    directory->shards.push_back(new Shard(compare_));
+    directory_.store(directory);
+}
+
+template<typename Key, typename Value, typename Compare>
+ShardedAVLTree<Key, Value, Compare>::~ShardedAVLTree()
+{
+    for(std::size_t i = 0; i < retired_.size(); ++i){
+        destroy(retired_[i]);
+    }
+    Retired current = { 0, directory_.load(), directory_.load()->shards };
+    destroy(current);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t ShardedAVLTree<Key, Value, Compare>::size() const
+{
+    EpochManager::Guard guard(epochs_);
+    const Directory* directory = directory_.load();
+    std::size_t total = 0;
+    for(std::size_t i = 0; i < directory->shards.size(); ++i){
+        total += directory->shards[i]->count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Returns the number of shards the key space is currently divided into.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t ShardedAVLTree<Key, Value, Compare>::shards() const
+{
+    EpochManager::Guard guard(epochs_);
+    return directory_.load()->shards.size();
+}
+
+/**
+* Puts keyValuePair into its shard, overwriting the value if the key is already present.
+*/
+template<typename Key, typename Value, typename Compare>
+void ShardedAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::size_t count;
+    {
+        EpochManager::Guard guard(epochs_);
+        std::unique_lock<std::mutex> lock;
+        Shard* shard = lockShard(keyValuePair.first, lock);
+        std::size_t before = shard->tree.size();
+        shard->tree.insert(keyValuePair);
+        count = shard->tree.size();
+        if(count == before){
+            return;
+        }
+        shard->count.store(count, std::memory_order_relaxed);
+    }
+    if(count > 2 * idealSize_.load(std::memory_order_relaxed)){
+        maintain(keyValuePair.first);
+    }
+}
+
+/**
+* Removes the item with the given key, if any. A shard left small enough to share with a
+* neighbour is merged with it.
+*/
+template<typename Key, typename Value, typename Compare>
+void ShardedAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    bool merge;
+    {
+        EpochManager::Guard guard(epochs_);
+        std::unique_lock<std::mutex> lock;
+        Shard* shard = lockShard(key, lock);
+        std::size_t before = shard->tree.size();
+        shard->tree.remove(key);
+        std::size_t count = shard->tree.size();
+        if(count == before){
+            return;
+        }
+        shard->count.store(count, std::memory_order_relaxed);
+
+        // only a hint: the neighbours' counts are read without their locks
+        const Directory* directory = directory_.load();
+        std::size_t i = shardIndex(directory, key);
+        std::size_t limit = idealSize_.load(std::memory_order_relaxed) / 2;
+        merge = (i > 0 && count + directory->shards[i - 1]->count.load(std::memory_order_relaxed) <= limit)
+                || (i + 1 < directory->shards.size() && count + directory->shards[i + 1]->count.load(std::memory_order_relaxed) <= limit);
+    }
+    if(merge){
+        maintain(key);
+    }
+}
+
+/**
+* Empties the tree by swapping in a directory with one empty shard. Operations waiting on
+* the old shards retry against the new one.
+*/
+template<typename Key, typename Value, typename Compare>
+void ShardedAVLTree<Key, Value, Compare>::clear()
+{
+    std::lock_guard<std::mutex> directoryLock(directoryMutex_);
+    Directory* old = directory_.load();
+    std::vector<std::unique_lock<std::mutex> > locks;
+    for(std::size_t i = 0; i < old->shards.size(); ++i){
+        locks.push_back(std::unique_lock<std::mutex>(old->shards[i]->mutex));
+    }
+    Directory* directory = new Directory();
+    directory->shards.push_back(new Shard(compare_));
+    publish(directory, old->shards);
+    for(std::size_t i = 0; i < old->shards.size(); ++i){
+        old->shards[i]->tree.clear();
+    }
+    reclaim();
+}
+
+/**
+* Copies the value stored under key into value and returns true, or returns false if the key
+* is not in the tree. Locks only the shard that would hold key.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    EpochManager::Guard guard(epochs_);
+    std::unique_lock<std::mutex> lock;
+    const Shard* shard = lockShard(key, lock);
+    typename Tree::const_iterator it = shard->tree.find(key);
+    if(it == shard->tree.end()){
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    EpochManager::Guard guard(epochs_);
+    std::unique_lock<std::mutex> lock;
+    const Shard* shard = lockShard(key, lock);
+    return shard->tree.find(key) != shard->tree.end();
+}
+
+/**
+* Calls fn on every item with a key in [first, last), in key order, walking from shard to
+* shard. fn runs under the lock of the shard the item is in, so it must not call back into
+* this tree. A shard split or merged while the scan is under way is picked up again from the
+* first key not yet visited.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename Function>
+void ShardedAVLTree<Key, Value, Compare>::for_each_in_range(const Key& first, const Key& last, Function fn) const
+{
+    if(!compare_(first, last)){
+        return;
+    }
+    EpochManager::Guard guard(epochs_);
+    Key from = first;
+    while(true){
+        const Directory* directory = directory_.load();
+        for(std::size_t i = shardIndex(directory, from); ; ++i){
+            Shard* shard = directory->shards[i];
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            if(shard->retired){
+                break;
+            }
+            const Tree& tree = shard->tree;
+            tree.for_each_in_range(from, last, [&fn](const std::pair<const Key, Value>& item) { fn(item); });
+            if(i + 1 == directory->shards.size() || !compare_(directory->bounds[i], last)){
+                return;
+            }
+            from = directory->bounds[i];
+        }
+    }
+}
+
+/**
+* Checks that every shard is a valid AVL tree holding only keys inside its range. Meant for
+* tests; takes each shard's lock in turn.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    EpochManager::Guard guard(epochs_);
+    const Directory* directory = directory_.load();
+    for(std::size_t i = 0; i < directory->shards.size(); ++i){
+        Shard* shard = directory->shards[i];
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        const Tree& tree = shard->tree;
+        if(!tree.isBalanced()){
+            return false;
+        }
+        if(tree.empty()){
+            continue;
+        }
+        typename Tree::const_iterator smallest = tree.begin();
+        typename Tree::const_iterator largest = tree.end();
+        --largest;
+        if((i > 0 && compare_(smallest->first, directory->bounds[i - 1]))
+           || (i + 1 < directory->shards.size() && !compare_(largest->first, directory->bounds[i]))){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* Returns the position of the shard whose range holds key.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t ShardedAVLTree<Key, Value, Compare>::shardIndex(const Directory* directory, const Key& key) const
+{
+    return static_cast<std::size_t>(std::upper_bound(directory->bounds.begin(), directory->bounds.end(), key, compare_)
+                                    - directory->bounds.begin());
+}
+
+/**
+* Locks the live shard that holds key and returns it, retrying if the shard is split or merged
+* while waiting for its lock. The caller must have the epoch pinned.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ShardedAVLTree<Key, Value, Compare>::Shard*
+ShardedAVLTree<Key, Value, Compare>::lockShard(const Key& key, std::unique_lock<std::mutex>& lock) const
+{
+    while(true){
+        const Directory* directory = directory_.load();
+        Shard* shard = directory->shards[shardIndex(directory, key)];
+        lock = std::unique_lock<std::mutex>(shard->mutex);
+        if(!shard->retired){
+            return shard;
+        }
+        lock.unlock();
+    }
+}
+
+/**
+* Recomputes and caches the shard size to aim for: an even share of the elements, but never
+* so little that the shards are not worth their locks. The caller holds the directory mutex.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t ShardedAVLTree<Key, Value, Compare>::refreshIdealSize()
+{
+    std::size_t ideal = std::max(size() / shardCount_, MIN_SHARD_SIZE);
+    idealSize_.store(ideal, std::memory_order_relaxed);
+    return ideal;
+}
+
+/**
+* Splits the shard holding key if it is still too large, then merges every run of neighbours
+* that have become small enough to share a shard. Holds the directory mutex throughout, so the
+* directory cannot change under it. Writers whose shard merely outgrew a stale target stop
+* coming here once the target is refreshed.
+*/
+template<typename Key, typename Value, typename Compare>
+void ShardedAVLTree<Key, Value, Compare>::maintain(const Key& key)
+{
+    std::lock_guard<std::mutex> directoryLock(directoryMutex_);
+    std::size_t ideal = refreshIdealSize();
+    bool changed = splitShard(shardIndex(directory_.load(), key), ideal);
+    for(std::size_t i = 0; i + 1 < directory_.load()->shards.size(); ){
+        if(mergeShards(i, ideal)){
+            changed = true;
+        }
+        else{
+            ++i;
+        }
+    }
+    if(changed){
+        reclaim();
+    }
+}
+
+/**
+* Replaces shard index with two fresh shards holding its lower and upper half, if it holds
+* more than twice the ideal size. The items are copied, so each half gets a node arena of its
+* own. Returns whether the shard was split.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLTree<Key, Value, Compare>::splitShard(std::size_t index, std::size_t ideal)
+{
+    Directory* old = directory_.load();
+    Shard* shard = old->shards[index];
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    if(shard->tree.size() <= 2 * ideal){
+        return false;
+    }
+
+    std::vector<std::pair<Key, Value> > items(shard->tree.begin(), shard->tree.end());
+    typename std::vector<std::pair<Key, Value> >::iterator middle = items.begin() + items.size() / 2;
+    Shard* lower = new Shard(compare_);
+    Shard* upper = new Shard(compare_);
+    lower->tree.build_from_sorted(std::make_move_iterator(items.begin()), std::make_move_iterator(middle));
+    upper->tree.build_from_sorted(std::make_move_iterator(middle), std::make_move_iterator(items.end()));
+    lower->count.store(lower->tree.size(), std::memory_order_relaxed);
+    upper->count.store(upper->tree.size(), std::memory_order_relaxed);
+
+    Directory* directory = new Directory(*old);
+    directory->shards[index] = lower;
+    directory->shards.insert(directory->shards.begin() + index + 1, upper);
+    directory->bounds.insert(directory->bounds.begin() + index, upper->tree.begin()->first);
+    publish(directory, std::vector<Shard*>(1, shard));
+    shard->tree.clear();
+    return true;
+}
+
+/**
+* Replaces shards index and index + 1 with one shard holding both, if together they hold no
+* more than half the ideal size. Returns whether they were merged.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLTree<Key, Value, Compare>::mergeShards(std::size_t index, std::size_t ideal)
+{
+    Directory* old = directory_.load();
+    Shard* left = old->shards[index];
+    Shard* right = old->shards[index + 1];
+    if(left->count.load(std::memory_order_relaxed) + right->count.load(std::memory_order_relaxed) > ideal / 2){
+        return false;
+    }
+    std::lock_guard<std::mutex> leftLock(left->mutex);
+    std::lock_guard<std::mutex> rightLock(right->mutex);
+    if(left->tree.size() + right->tree.size() > ideal / 2){
+        return false;
+    }
+
+    Shard* merged = new Shard(compare_);
+    merged->tree.join(left->tree, right->tree);
+    merged->count.store(merged->tree.size(), std::memory_order_relaxed);
+
+    Directory* directory = new Directory(*old);
+    directory->shards[index] = merged;
+    directory->shards.erase(directory->shards.begin() + index + 1);
+    directory->bounds.erase(directory->bounds.begin() + index);
+    std::vector<Shard*> replaced;
+    replaced.push_back(left);
+    replaced.push_back(right);
+    publish(directory, replaced);
+    return true;
+}
+
+/**
+* Swaps in directory and retires the old one together with the shards it replaced. The caller
+* holds the directory mutex and the locks of every replaced shard, so operations waiting on
+* them see the retired mark as soon as they get in.
+*/
+template<typename Key, typename Value, typename Compare>
+void ShardedAVLTree<Key, Value, Compare>::publish(Directory* directory, const std::vector<Shard*>& replaced)
+{
+    Directory* old = directory_.load();
+    directory_.store(directory);
+    for(std::size_t i = 0; i < replaced.size(); ++i){
+        replaced[i]->retired = true;
+    }
+    Retired r = { epochs_.epoch(), old, replaced };
+    retired_.push_back(r);
+}
+
+/**
+* Tries to move the epoch on and frees the directories and shards no operation can reach any
+* more. The caller holds the directory mutex.
+*/
+template<typename Key, typename Value, typename Compare>
+void ShardedAVLTree<Key, Value, Compare>::reclaim()
+{
+    std::size_t safe = epochs_.reclaimableBefore();
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < retired_.size(); ++i){
+        if(retired_[i].epoch < safe){
+            destroy(retired_[i]);
+        }
+        else{
+            retired_[kept++] = retired_[i];
+        }
+    }
+    retired_.resize(kept);
+}
+
+template<typename Key, typename Value, typename Compare>
+void ShardedAVLTree<Key, Value, Compare>::destroy(Retired& retired)
+{
+    for(std::size_t i = 0; i < retired.shards.size(); ++i){
+        delete retired.shards[i];
+    }
+    delete retired.directory;
+}
+
+/*
+-------------------------------------------------
+End implementations for the ShardedAVLTree class.
+-------------------------------------------------
+*/
+
+#endif
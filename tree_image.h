@@ -0,0 +1,261 @@
+#ifndef TREE_IMAGE_H
+#define TREE_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TREE_IMAGE_MMAP 1
+#endif
+
+/**
+* The header at the start of a tree image, the file format written by FrozenTree::save() and
+* BinarySearchTree::save(). The image is the FrozenTree itself: after the header come the key
+* array and the value array in Eytzinger order, count + 1 slots each with slot 0 unused, each
+* starting on a 64-byte boundary. Mapping the file therefore gives arrays a FrozenTree can
+* search in place, and walking them in order gives the sorted sequence AVLTree::load() builds
+* from.
+*
+* Keys and values are stored as their raw bytes, so the format is only for trivially copyable
+* types and is read back on a machine with the same byte order and type layout; byteOrder,
+* keySize and valueSize catch the obvious mismatches. checksum covers the header up to itself
+* and both arrays; the padding between them is not part of it.
+*/
+struct TreeImageHeader
+{
+    char magic[8];          // TREE_IMAGE_MAGIC
+    uint32_t version;       // TREE_IMAGE_VERSION
+    uint32_t byteOrder;     // TREE_IMAGE_BYTE_ORDER as the writing machine stores it
+    uint32_t keySize;       // sizeof(Key)
+    uint32_t valueSize;     // sizeof(Value)
+    uint64_t count;         // number of elements
+    uint64_t keysOffset;    // byte offset of the key array
+    uint64_t valuesOffset;  // byte offset of the value array
+    uint64_t fileSize;
+    uint64_t checksum;      // treeImageChecksum() of the header and the arrays
+};
+
+static const char TREE_IMAGE_MAGIC[8] = { 'B', 'S', 'T', 'I', 'M', 'A', 'G', 'E' };
+static const uint32_t TREE_IMAGE_VERSION = 1;
+static const uint32_t TREE_IMAGE_BYTE_ORDER = 0x01020304u;
+static const std::size_t TREE_IMAGE_ALIGNMENT = 64;
+
+/**
+* A 64-bit FNV-style hash taken 8 bytes at a time, with an xor-shift after every multiply so
+* that high bits feed back into low ones. Not cryptographic; it is there to catch truncated or
+* damaged files at several GB/s. Pass the previous result as seed to continue a hash.
+*/
+inline uint64_t treeImageChecksum(const void* data, std::size_t bytes, uint64_t seed = 0xcbf29ce484222325ull)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed;
+    for(; bytes >= 8; p += 8, bytes -= 8){
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        h = (h ^ word) * 0x100000001b3ull;
+        h ^= h >> 32;
+    }
+    for(; bytes > 0; ++p, --bytes){
+        h = (h ^ *p) * 0x100000001b3ull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+/**
+* Checksum of a whole image: the header fields before checksum, then the key array and the
+* value array, count + 1 slots each.
+*/
+inline uint64_t treeImageChecksum(const TreeImageHeader& header, const void* keys, const void* values)
+{
+    uint64_t h = treeImageChecksum(&header, offsetof(TreeImageHeader, checksum));
+    h = treeImageChecksum(keys, (header.count + 1) * header.keySize, h);
+    return treeImageChecksum(values, (header.count + 1) * header.valueSize, h);
+}
+
+/**
+* Flushes file and, where the platform has fsync, forces its contents to the disk. Returns
+* false on failure. Elsewhere the data may still sit in the operating system's cache.
+*/
+inline bool syncTreeImageFile(std::FILE* file)
+{
+    if(std::fflush(file) != 0){
+        return false;
+    }
+#ifdef TREE_IMAGE_MMAP
+    return ::fsync(::fileno(file)) == 0;
+#else
+    return true;
+#endif
+}
+
+/**
+* Forces the directory entry of path to the disk after it was created or renamed, where the
+* platform allows syncing a directory. Returns false on failure.
+*/
+inline bool syncTreeImageDirectory(const std::string& path)
+{
+#ifdef TREE_IMAGE_MMAP
+    std::string::size_type slash = path.find_last_of('/');
+    std::string directory = (slash == std::string::npos) ? "." : (slash == 0) ? "/" : path.substr(0, slash);
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if(fd < 0){
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#else
+    (void)path;
+    return true;
+#endif
+}
+
+/**
+* A read-only view of a whole file: memory-mapped where the platform has mmap, otherwise read
+* into a buffer. The mapping lasts as long as the object.
+*/
+class TreeImageFile
+{
+public:
+    explicit TreeImageFile(const std::string& path);
+    ~TreeImageFile();
+
+    const unsigned char* data() const;
+    std::size_t size() const;
+
+    const TreeImageHeader& check(std::size_t keySize, std::size_t valueSize, bool verify) const;
+
+private:
+    TreeImageFile(const TreeImageFile&);
+    TreeImageFile& operator=(const TreeImageFile&);
+
+    std::string path_;
+    const unsigned char* data_;
+    std::size_t size_;
+    bool mapped_;
+    std::vector<unsigned char> buffer_;
+};
+
+/*
+---------------------------------------------------
+Begin implementations for the TreeImageFile class.
+---------------------------------------------------
+*/
+
+inline TreeImageFile::TreeImageFile(const std::string& path) :
+    path_(path),
+    data_(nullptr),
+    size_(0),
+    mapped_(false)
+{
+#ifdef TREE_IMAGE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw std::runtime_error("cannot open tree image " + path);
+    }
+    struct stat info;
+    if(::fstat(fd, &info) != 0){
+        ::close(fd);
+        throw std::runtime_error("cannot stat tree image " + path);
+    }
+    size_ = static_cast<std::size_t>(info.st_size);
+    if(size_ != 0){
+        void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p == MAP_FAILED){
+            ::close(fd);
+            throw std::runtime_error("cannot map tree image " + path);
+        }
+        data_ = static_cast<const unsigned char*>(p);
+        mapped_ = true;
+    }
+    ::close(fd);
+#else
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if(file == nullptr){
+        throw std::runtime_error("cannot open tree image " + path);
+    }
+    unsigned char chunk[65536];
+    std::size_t got;
+    while((got = std::fread(chunk, 1, sizeof(chunk), file)) != 0){
+        buffer_.insert(buffer_.end(), chunk, chunk + got);
+    }
+    bool failed = std::ferror(file) != 0;
+    std::fclose(file);
+    if(failed){
+        throw std::runtime_error("cannot read tree image " + path);
+    }
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+#endif
+}
+
+inline TreeImageFile::~TreeImageFile()
+{
+#ifdef TREE_IMAGE_MMAP
+    if(mapped_){
+        ::munmap(const_cast<unsigned char*>(data_), size_);
+    }
+#endif
+}
+
+inline const unsigned char* TreeImageFile::data() const
+{
+    return data_;
+}
+
+inline std::size_t TreeImageFile::size() const
+{
+    return size_;
+}
+
+/**
+* Returns the image's header after making sure it describes a file of this format and
+* version, with the given key and value sizes, whose arrays lie inside the file. With verify,
+* the checksum is compared too, which reads the whole file; without it, pages of a mapped
+* image are only touched as lookups reach them. Throws std::runtime_error otherwise.
+*/
+inline const TreeImageHeader& TreeImageFile::check(std::size_t keySize, std::size_t valueSize, bool verify) const
+{
+    if(size_ < sizeof(TreeImageHeader)){
+        throw std::runtime_error("tree image " + path_ + " is truncated");
+    }
+    const TreeImageHeader& header = *reinterpret_cast<const TreeImageHeader*>(data_);
+    if(std::memcmp(header.magic, TREE_IMAGE_MAGIC, sizeof(TREE_IMAGE_MAGIC)) != 0){
+        throw std::runtime_error(path_ + " is not a tree image");
+    }
+    if(header.version != TREE_IMAGE_VERSION){
+        throw std::runtime_error("tree image " + path_ + " has unsupported version " + std::to_string(header.version));
+    }
+    if(header.byteOrder != TREE_IMAGE_BYTE_ORDER || header.keySize != keySize || header.valueSize != valueSize){
+        throw std::runtime_error("tree image " + path_ + " was written for other key or value types");
+    }
+    uint64_t slots = header.count + 1;
+    if(header.fileSize != size_ || slots == 0
+       || header.keysOffset % TREE_IMAGE_ALIGNMENT != 0 || header.valuesOffset % TREE_IMAGE_ALIGNMENT != 0
+       || header.keysOffset < sizeof(TreeImageHeader) || header.keysOffset > size_ || header.valuesOffset > size_
+       || (size_ - header.keysOffset) / keySize < slots || (size_ - header.valuesOffset) / valueSize < slots){
+        throw std::runtime_error("tree image " + path_ + " is truncated or damaged");
+    }
+    if(verify && treeImageChecksum(header, data_ + header.keysOffset, data_ + header.valuesOffset) != header.checksum){
+        throw std::runtime_error("tree image " + path_ + " fails its checksum");
+    }
+    return header;
+}
+
+/*
+-------------------------------------------------
+End implementations for the TreeImageFile class.
+-------------------------------------------------
+*/
+
+#endif